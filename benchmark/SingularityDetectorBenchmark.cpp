@@ -0,0 +1,259 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "BandEdgeCache.h"
+#include "CompactLimitTable.h"
+#include "JointGroupPool.h"
+#include "SingularityDetectorCore.h"
+#include "SingularityLimitTable.h"
+#include "SingularityLimits.h"
+
+namespace {
+
+/// number of distinct positions cycled through, so branch predictors cannot learn the answer
+const int kPositions = 1024;
+
+/**
+ * @brief Random nested bands and random positions, about a third of them inside some band
+ */
+struct Fixture {
+  explicit Fixture(int number_of_joints)
+      : joints(number_of_joints),
+        positions(kPositions * number_of_joints) {
+    std::mt19937 generator(number_of_joints);
+    std::uniform_real_distribution<double> center(-2.0, 2.0);
+    std::uniform_real_distribution<double> position(-3.0, 3.0);
+    const double half_width[] = {0.3, 0.15, 0.05};
+    for (int l=0; l<3; l++) {
+      lower[l].resize(joints);
+      upper[l].resize(joints);
+    }
+    for (int i=0; i<joints; i++) {
+      const double c = center(generator);
+      for (int l=0; l<3; l++) {
+        lower[l][i] = c - half_width[l];
+        upper[l][i] = c + half_width[l];
+      }
+    }
+    for (size_t k=0; k<positions.size(); k++)
+      positions[k] = position(generator);
+    const std::vector<double>* const lower_limits[] = {&lower[0], &lower[1], &lower[2]};
+    const std::vector<double>* const upper_limits[] = {&upper[0], &upper[1], &upper[2]};
+    table.build(joints, lower_limits, upper_limits);
+  }
+
+  const double* position(int k) const { return &positions[(k & (kPositions - 1)) * joints]; }
+
+  int joints;
+  std::vector<double> lower[3];
+  std::vector<double> upper[3];
+  std::vector<double> positions;
+  SingularityLimitTable table;
+};
+
+void jointCounts(benchmark::internal::Benchmark* benchmark) {
+  benchmark->Arg(6)->Arg(7)->Arg(12)->Arg(32);
+}
+
+void BM_Reference(benchmark::State& state) {
+  const Fixture fixture(state.range(0));
+  int k = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(singularity_detector::checkSingularityLevel(
+        fixture.joints, fixture.position(k++), fixture.lower[0], fixture.upper[0], fixture.lower[1],
+        fixture.upper[1], fixture.lower[2], fixture.upper[2]));
+  }
+}
+BENCHMARK(BM_Reference)->Apply(jointCounts);
+
+void BM_Table(benchmark::State& state, BandKernel::Isa isa) {
+  Fixture fixture(state.range(0));
+  if (!BandKernel::isAvailable(isa)) {
+    state.SkipWithError("instruction set not supported by this CPU");
+    return;
+  }
+  fixture.table.setKernel(isa);
+  int k = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(fixture.table.classify(fixture.position(k++)));
+}
+BENCHMARK_CAPTURE(BM_Table, scalar, BandKernel::kScalar)->Apply(jointCounts);
+BENCHMARK_CAPTURE(BM_Table, sse2, BandKernel::kSse2)->Apply(jointCounts);
+BENCHMARK_CAPTURE(BM_Table, avx2, BandKernel::kAvx2)->Apply(jointCounts);
+BENCHMARK_CAPTURE(BM_Table, neon, BandKernel::kNeon)->Apply(jointCounts);
+
+/// fixture table quantized to 32-bit keys, fixed-point at a micro radian
+void BM_Compact(benchmark::State& state, CompactLimitTable::Mode mode, BandKernel::Isa isa) {
+  const Fixture fixture(state.range(0));
+  if (!BandKernel::isAvailable(isa)) {
+    state.SkipWithError("instruction set not supported by this CPU");
+    return;
+  }
+  CompactLimitTable table;
+  std::string error;
+  if (!table.build(fixture.table, mode, std::vector<double>(fixture.joints, 1e6), 1e-6, error)) {
+    state.SkipWithError(error.c_str());
+    return;
+  }
+  table.setKernel(isa);
+  int k = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(table.classify(fixture.position(k++)));
+}
+BENCHMARK_CAPTURE(BM_Compact, float32_scalar, CompactLimitTable::kFloat32, BandKernel::kScalar)->Apply(jointCounts);
+BENCHMARK_CAPTURE(BM_Compact, float32_sse2, CompactLimitTable::kFloat32, BandKernel::kSse2)->Apply(jointCounts);
+BENCHMARK_CAPTURE(BM_Compact, float32_avx2, CompactLimitTable::kFloat32, BandKernel::kAvx2)->Apply(jointCounts);
+BENCHMARK_CAPTURE(BM_Compact, float32_neon, CompactLimitTable::kFloat32, BandKernel::kNeon)->Apply(jointCounts);
+BENCHMARK_CAPTURE(BM_Compact, fixed32_avx2, CompactLimitTable::kFixed32, BandKernel::kAvx2)->Apply(jointCounts);
+BENCHMARK_CAPTURE(BM_Compact, fixed32_neon, CompactLimitTable::kFixed32, BandKernel::kNeon)->Apply(jointCounts);
+
+/// every joint periodic with a period of 2*pi, positions spread over several turns
+void BM_PeriodicTable(benchmark::State& state) {
+  Fixture fixture(state.range(0));
+  std::string error;
+  fixture.table.setPeriods(std::vector<double>(fixture.joints, 2.0 * M_PI), error);
+  std::vector<double> positions(fixture.positions);
+  for (size_t k=0; k<positions.size(); k++)
+    positions[k] *= 10.0;
+  int k = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(fixture.table.classify(&positions[(k++ & (kPositions - 1)) * fixture.joints]));
+}
+BENCHMARK(BM_PeriodicTable)->Apply(jointCounts);
+
+template <int N>
+void BM_Core(benchmark::State& state) {
+  const Fixture fixture(N);
+  SingularityDetectorCore<N> core;
+  core.build(fixture.table);
+  int k = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(core.classify(fixture.position(k++)));
+}
+BENCHMARK_TEMPLATE(BM_Core, 6);
+BENCHMARK_TEMPLATE(BM_Core, 7);
+
+void BM_JointLevels(benchmark::State& state) {
+  const Fixture fixture(state.range(0));
+  std::vector<uint8_t> levels(fixture.joints);
+  int k = 0;
+  for (auto _ : state) {
+    fixture.table.classifyJoints(fixture.position(k++), &levels[0]);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_JointLevels)->Apply(jointCounts);
+
+void BM_Proximity(benchmark::State& state) {
+  const Fixture fixture(state.range(0));
+  std::vector<double> proximity(fixture.joints);
+  double overall;
+  int k = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(fixture.table.classifyProximity(fixture.position(k++), &proximity[0], overall));
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_Proximity)->Apply(jointCounts);
+
+void BM_EdgeDistance(benchmark::State& state) {
+  const Fixture fixture(state.range(0));
+  BandEdgeCache edges;
+  edges.build(fixture.table);
+  std::vector<double> distance(fixture.joints);
+  double overall;
+  int k = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(edges.classifyDistance(fixture.position(k++), &distance[0], overall));
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_EdgeDistance)->Apply(jointCounts);
+
+/// nested table of state.range(1) levels over the positions of fixture
+SingularityLimitTable levelTable(const Fixture& fixture, int number_of_levels) {
+  std::vector<double> bands(2 * number_of_levels * fixture.joints);
+  for (int l=0; l<number_of_levels; l++) {
+    const double shrink = 0.3 * l / number_of_levels;
+    for (int i=0; i<fixture.joints; i++) {
+      bands[2 * l * fixture.joints + i] = fixture.lower[0][i] + shrink;
+      bands[(2 * l + 1) * fixture.joints + i] = fixture.upper[0][i] - shrink;
+    }
+  }
+  SingularityLimitTable table;
+  table.build(fixture.joints, number_of_levels, bands);
+  return table;
+}
+
+void BM_Levels(benchmark::State& state) {
+  const Fixture fixture(state.range(0));
+  const SingularityLimitTable table = levelTable(fixture, state.range(1));
+  int k = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(table.classify(fixture.position(k++)));
+}
+BENCHMARK(BM_Levels)->ArgsProduct({{6, 7, 12, 32}, {3, 5, 8, 16, 32}});
+
+void BM_Batch(benchmark::State& state) {
+  const Fixture fixture(state.range(0));
+  const size_t waypoints = state.range(1);
+  std::vector<double> trajectory(waypoints * fixture.joints);
+  for (size_t k=0; k<waypoints; k++) {
+    for (int i=0; i<fixture.joints; i++)
+      trajectory[k * fixture.joints + i] = fixture.position(k)[i];
+  }
+  std::vector<uint8_t> levels(waypoints);
+  for (auto _ : state) {
+    fixture.table.classifyBatch(&trajectory[0], waypoints, fixture.joints, &levels[0]);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * waypoints);
+}
+BENCHMARK(BM_Batch)->ArgsProduct({{6, 7, 12, 32}, {64, 4096, 65536}});
+
+/// four joint groups of equal size, classified by the pool of JointGroupPool::run()
+struct GroupFixture {
+  explicit GroupFixture(int number_of_joints)
+      : fixture(number_of_joints), groups(4), position(NULL) {
+    for (int g=0; g<4; g++)
+      groups[g].slice(fixture.table, g * number_of_joints / 4, number_of_joints / 4);
+  }
+
+  static int classify(void* context, int group) {
+    const GroupFixture* self = static_cast<const GroupFixture*>(context);
+    return self->groups[group].classify(self->position + group * self->fixture.joints / 4);
+  }
+
+  Fixture fixture;
+  std::vector<SingularityLimitTable> groups;
+  const double* position;
+};
+
+void BM_JointGroups(benchmark::State& state) {
+  GroupFixture groups(state.range(0));
+  JointGroupPool pool;
+  std::string error;
+  pool.start(4, std::vector<int>(state.range(1), -1), &GroupFixture::classify, &groups, error);
+  int k = 0;
+  for (auto _ : state) {
+    groups.position = groups.fixture.position(k++);
+    pool.run();
+    benchmark::DoNotOptimize(pool.result(0));
+  }
+}
+BENCHMARK(BM_JointGroups)->ArgsProduct({{32, 128}, {0, 1, 3}})->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,172 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SINGULARITY_DETECTOR_SINGULARITY_LEVEL_SEGMENT_H_
+#define SINGULARITY_DETECTOR_SINGULARITY_LEVEL_SEGMENT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * @brief Shared-memory layout of the singularity level published by the detector, and its reader
+ *
+ * Header-only and free of any RTT or ROS dependency, so that processes
+ * outside of the Orocos deployment only need this file to read the level.
+ */
+namespace singularity_detector {
+
+/**
+ * @brief POSIX shared-memory segment written by the detector every cycle
+ *
+ * The sequence works as a sequence lock: it is odd while the detector
+ * writes the fields and even again when done. All fields have fixed width,
+ * so the layout is the same in every process on the same machine.
+ */
+struct SingularityLevelSegment {
+  static const uint32_t kVersion = 1;
+  static const int kMaxJoints = 32;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t number_of_joints;
+  std::atomic<uint32_t> sequence;
+  /// index of the published singularity level, the scaling coefficient is one more
+  uint32_t level;
+  /// number of the detector cycle, increasing with every write
+  uint64_t cycle;
+  /// CLOCK_MONOTONIC time [ns] of the write
+  int64_t stamp_ns;
+  /// highest proximity of all joints, 0 unless the detector publishes the proximity
+  double proximity;
+  double joint_proximity[kMaxJoints];
+  /// (level, band edge) pair of every joint, zeros unless the detector publishes the joint levels
+  uint8_t joint_levels[2 * kMaxJoints];
+};
+
+/// Magic bytes of a singularity level segment
+static const char kSingularityLevelSegmentMagic[8] = {'S', 'D', 'L', 'E', 'V', 'E', 'L', '\0'};
+
+/**
+ * @brief Consistent copy of the published fields
+ */
+struct SingularityLevelSample {
+  int level;
+  uint64_t cycle;
+  int64_t stamp_ns;
+  double proximity;
+  int number_of_joints;
+  double joint_proximity[SingularityLevelSegment::kMaxJoints];
+  uint8_t joint_levels[2 * SingularityLevelSegment::kMaxJoints];
+};
+
+/**
+ * @brief Read-only mapping of a segment published by the detector's shared_memory_name property
+ *
+ * read() never blocks the detector: it copies the fields and retries when
+ * the detector wrote them meanwhile. A segment whose cycle stops increasing
+ * belongs to a detector that is not running.
+ */
+class SingularityLevelReader {
+ public:
+  SingularityLevelReader() : segment_(NULL) {}
+  ~SingularityLevelReader() { close(); }
+
+  /**
+   * @brief Map a segment
+   *
+   * @param name    POSIX shared-memory name, e.g. "/singularity_level"
+   * @param error   description of the problem when the segment cannot be used
+   * @return true   if the segment is ready to be read
+   * @return false  if it does not exist or was not written by a compatible detector
+   */
+  bool open(const std::string& name, std::string& error) {
+    close();
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+      error = "cannot open shared memory: " + name;
+      return false;
+    }
+    struct stat status;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && static_cast<std::size_t>(status.st_size) >= sizeof(SingularityLevelSegment))
+      mapping = mmap(NULL, sizeof(SingularityLevelSegment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+      error = "cannot map shared memory: " + name;
+      return false;
+    }
+    const SingularityLevelSegment* segment = static_cast<const SingularityLevelSegment*>(mapping);
+    if (std::memcmp(segment->magic, kSingularityLevelSegmentMagic, sizeof(kSingularityLevelSegmentMagic)) != 0 ||
+        segment->version != SingularityLevelSegment::kVersion) {
+      munmap(mapping, sizeof(SingularityLevelSegment));
+      error = name + " is not a singularity level segment of a compatible version";
+      return false;
+    }
+    segment_ = segment;
+    return true;
+  }
+
+  void close() {
+    if (segment_)
+      munmap(const_cast<SingularityLevelSegment*>(segment_), sizeof(SingularityLevelSegment));
+    segment_ = NULL;
+  }
+
+  bool opened() const { return segment_ != NULL; }
+
+  /**
+   * @brief Copy the last published fields
+   *
+   * @param sample        buffer for the fields
+   * @param max_attempts  copies tried before giving up on a detector writing all the time
+   * @return true   if a consistent copy has been made
+   * @return false  if the segment is not open, not written yet or the detector kept overwriting it
+   */
+  bool read(SingularityLevelSample& sample, int max_attempts = 16) const {
+    if (!segment_)
+      return false;
+    for (int attempt=0; attempt<max_attempts; attempt++) {
+      const uint32_t begin = segment_->sequence.load(std::memory_order_acquire);
+      if (begin & 1)
+        continue;
+      sample.level = segment_->level;
+      sample.cycle = segment_->cycle;
+      sample.stamp_ns = segment_->stamp_ns;
+      sample.proximity = segment_->proximity;
+      sample.number_of_joints = segment_->number_of_joints;
+      if (sample.number_of_joints > SingularityLevelSegment::kMaxJoints)
+        sample.number_of_joints = SingularityLevelSegment::kMaxJoints;
+      for (int i=0; i<sample.number_of_joints; i++) {
+        sample.joint_proximity[i] = segment_->joint_proximity[i];
+        sample.joint_levels[2*i] = segment_->joint_levels[2*i];
+        sample.joint_levels[2*i+1] = segment_->joint_levels[2*i+1];
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (begin != 0 && segment_->sequence.load(std::memory_order_relaxed) == begin)
+        return true;
+    }
+    return false;
+  }
+
+ private:
+  SingularityLevelReader(const SingularityLevelReader&);
+  SingularityLevelReader& operator=(const SingularityLevelReader&);
+
+  const SingularityLevelSegment* segment_;
+};
+
+}  // namespace singularity_detector
+
+#endif  // SINGULARITY_DETECTOR_SINGULARITY_LEVEL_SEGMENT_H_
@@ -0,0 +1,49 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef ALIGNED_ALLOCATOR_H_
+#define ALIGNED_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+
+/**
+ * @brief Standard allocator returning memory aligned to Alignment bytes, used for SIMD loads
+ */
+template <typename T, std::size_t Alignment>
+class AlignedAllocator {
+ public:
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  AlignedAllocator() {}
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+  T* allocate(std::size_t n) {
+    void* memory = NULL;
+    if (posix_memalign(&memory, Alignment, n * sizeof(T)) != 0)
+      throw std::bad_alloc();
+    return static_cast<T*>(memory);
+  }
+
+  void deallocate(T* memory, std::size_t) {
+    std::free(memory);
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+#endif  // ALIGNED_ALLOCATOR_H_
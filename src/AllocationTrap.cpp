@@ -0,0 +1,89 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "AllocationTrap.h"
+
+#ifdef SINGULARITY_DETECTOR_ALLOCATION_TRAP
+
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+namespace {
+
+/// true while the calling thread is inside a ScopedAllocationTrap
+thread_local bool trap_armed = false;
+
+void* trappedAllocate(std::size_t size) {
+  if (trap_armed) {
+    static const char message[] = "singularity_detector: heap allocation on the real-time path\n";
+    ssize_t ignored = ::write(STDERR_FILENO, message, sizeof(message) - 1);
+    (void)ignored;
+    std::abort();
+  }
+  void* memory = std::malloc(size ? size : 1);
+  if (!memory)
+    throw std::bad_alloc();
+  return memory;
+}
+
+}  // namespace
+
+ScopedAllocationTrap::ScopedAllocationTrap()
+    : was_armed_(trap_armed) {
+  trap_armed = true;
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  Eigen::internal::set_is_malloc_allowed(false);
+#endif
+}
+
+ScopedAllocationTrap::~ScopedAllocationTrap() {
+  trap_armed = was_armed_;
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  Eigen::internal::set_is_malloc_allowed(!was_armed_);
+#endif
+}
+
+ScopedAllocationPermit::ScopedAllocationPermit()
+    : was_armed_(trap_armed) {
+  trap_armed = false;
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  Eigen::internal::set_is_malloc_allowed(true);
+#endif
+}
+
+ScopedAllocationPermit::~ScopedAllocationPermit() {
+  trap_armed = was_armed_;
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  Eigen::internal::set_is_malloc_allowed(!was_armed_);
+#endif
+}
+
+void* operator new(std::size_t size) {
+  return trappedAllocate(size);
+}
+
+void* operator new[](std::size_t size) {
+  return trappedAllocate(size);
+}
+
+void operator delete(void* memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept {
+  std::free(memory);
+}
+
+#endif  // SINGULARITY_DETECTOR_ALLOCATION_TRAP
@@ -0,0 +1,63 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef ALLOCATION_TRAP_H_
+#define ALLOCATION_TRAP_H_
+
+#ifdef SINGULARITY_DETECTOR_ALLOCATION_TRAP
+#include <eigen3/Eigen/Core>
+#endif
+
+
+/**
+ * @brief Scope in which any heap allocation of the calling thread aborts the process
+ *
+ * Enabled with the SINGULARITY_DETECTOR_ALLOCATION_TRAP build option, otherwise
+ * the guard compiles to nothing. Eigen allocations are trapped through
+ * EIGEN_RUNTIME_NO_MALLOC (requires assertions, i.e. a Debug build), all other
+ * allocations through the replaced global operator new.
+ */
+class ScopedAllocationTrap {
+ public:
+#ifdef SINGULARITY_DETECTOR_ALLOCATION_TRAP
+  ScopedAllocationTrap();
+  ~ScopedAllocationTrap();
+
+ private:
+  bool was_armed_;
+#else
+  ScopedAllocationTrap() {}
+#endif
+
+ private:
+  ScopedAllocationTrap(const ScopedAllocationTrap&);
+  ScopedAllocationTrap& operator=(const ScopedAllocationTrap&);
+};
+
+/**
+ * @brief Scope inside a ScopedAllocationTrap in which the calling thread may allocate again
+ *
+ * Only for the reads which reallocate on invalid input alone, e.g. a joint
+ * sample of wrong size, and which drop that input.
+ */
+class ScopedAllocationPermit {
+ public:
+#ifdef SINGULARITY_DETECTOR_ALLOCATION_TRAP
+  ScopedAllocationPermit();
+  ~ScopedAllocationPermit();
+
+ private:
+  bool was_armed_;
+#else
+  ScopedAllocationPermit() {}
+#endif
+
+ private:
+  ScopedAllocationPermit(const ScopedAllocationPermit&);
+  ScopedAllocationPermit& operator=(const ScopedAllocationPermit&);
+};
+
+#endif  // ALLOCATION_TRAP_H_
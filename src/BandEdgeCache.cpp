@@ -0,0 +1,180 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "BandEdgeCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+/**
+ * @brief Highest level whose band holds a joint position, with the strict comparisons of the band kernels
+ */
+int jointLevel(const SingularityLimitTable& table, int joint, double q) {
+  int level = 0;
+  for (int l=1; l<=table.number_of_levels(); l++)
+    level = (q < table.upper(l, joint) && q > table.lower(l, joint)) ? l : level;
+  return level;
+}
+
+template <typename T>
+bool writeArray(std::FILE* file, const std::vector<T>& values) {
+  return values.empty() || std::fwrite(&values[0], sizeof(T), values.size(), file) == values.size();
+}
+
+template <typename T>
+bool readArray(std::FILE* file, std::vector<T>& values, std::size_t size) {
+  values.resize(size);
+  return size == 0 || std::fread(&values[0], sizeof(T), size, file) == size;
+}
+
+}  // namespace
+
+BandEdgeCache::BandEdgeCache()
+    : number_of_joints_(0),
+      stride_(0) {
+}
+
+void BandEdgeCache::build(const SingularityLimitTable& table) {
+  const double inf = std::numeric_limits<double>::infinity();
+  number_of_joints_ = table.number_of_joints();
+  std::vector<std::vector<double> > joint_edges(number_of_joints_);
+  std::vector<std::vector<uint8_t> > joint_interval_levels(number_of_joints_);
+  std::vector<std::vector<uint8_t> > joint_edge_levels(number_of_joints_);
+  stride_ = 0;
+  for (int i=0; i<number_of_joints_; i++) {
+    std::vector<double> candidates;
+    for (int l=1; l<=table.number_of_levels(); l++) {
+      // edges at infinity can never be crossed
+      if (std::isfinite(table.lower(l, i)))
+        candidates.push_back(table.lower(l, i));
+      if (std::isfinite(table.upper(l, i)))
+        candidates.push_back(table.upper(l, i));
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    std::vector<double>& edges = joint_edges[i];
+    std::vector<uint8_t>& interval_levels = joint_interval_levels[i];
+    std::vector<uint8_t>& edge_levels = joint_edge_levels[i];
+    const std::size_t m = candidates.size();
+    interval_levels.push_back(m ? jointLevel(table, i, candidates[0] - 1.0) : 0);
+    for (std::size_t k=0; k<m; k++) {
+      const double above = k+1 < m ? 0.5 * (candidates[k] + candidates[k+1]) : candidates[k] + 1.0;
+      const uint8_t above_level = jointLevel(table, i, above);
+      const uint8_t edge_level = jointLevel(table, i, candidates[k]);
+      // the level of the joint does not change here, the intervals on both sides merge
+      if (edge_level == interval_levels.back() && above_level == interval_levels.back())
+        continue;
+      edges.push_back(candidates[k]);
+      edge_levels.push_back(edge_level);
+      interval_levels.push_back(above_level);
+    }
+    stride_ = std::max<int>(stride_, edges.size());
+  }
+
+  const int row = stride_ + 2;
+  edges_.assign(number_of_joints_ * row, inf);
+  interval_levels_.assign(number_of_joints_ * (row + 1), 0);
+  edge_levels_.assign(number_of_joints_ * (stride_ + 1), 0);
+  wrap_.assign(3 * number_of_joints_, 0.0);
+  for (int i=0; i<number_of_joints_; i++) {
+    const std::vector<double>& edges = joint_edges[i];
+    const std::vector<uint8_t>& levels = joint_interval_levels[i];
+    const std::size_t m = edges.size();
+    const double period = table.period(i);
+    double* row_edges = &edges_[i * row];
+    uint8_t* edge_levels = &edge_levels_[i * (stride_ + 1)];
+    uint8_t* interval_levels = &interval_levels_[i * (row + 1)];
+    std::copy(edges.begin(), edges.end(), row_edges + 1);
+    std::copy(joint_edge_levels[i].begin(), joint_edge_levels[i].end(), edge_levels);
+    std::copy(levels.begin(), levels.end(), interval_levels + 1);
+    std::fill(interval_levels + 1 + levels.size(), interval_levels + row + 1, levels.back());
+    if (period > 0.0 && m > 0) {
+      // a periodic joint is framed by the images of its outer edges one period away
+      row_edges[0] = edges[m-1] - period;
+      row_edges[m+1] = edges[0] + period;
+      edge_levels[m] = edge_levels[0];
+      interval_levels[0] = levels[m-1];
+      interval_levels[m+2] = levels[1];
+      wrap_[3*i] = table.period_center(i);
+      wrap_[3*i+1] = period;
+      wrap_[3*i+2] = 1.0 / period;
+    } else {
+      // the framing edges are never passed, their intervals repeat the outer levels
+      row_edges[0] = -inf;
+      interval_levels[0] = levels.front();
+    }
+  }
+}
+
+int BandEdgeCache::classifyDistance(const double* joint_position, double* distance, double& overall) const {
+  const double inf = std::numeric_limits<double>::infinity();
+  const int row = stride_ + 2;
+  int max = 0;
+  overall = inf;
+  for (int i=0; i<number_of_joints_; i++) {
+    const double q = wrapPosition(joint_position[i], wrap_[3*i], wrap_[3*i+1], wrap_[3*i+2]);
+    const double* edges = &edges_[i * row];
+    const uint8_t* interval_levels = &interval_levels_[i * (row + 1)];
+    const int k = locate(edges, q);
+    const double down = q - edges[k];
+    const double up = edges[k+1] - q;
+    // indices and masks instead of branches, the positions are hard to predict
+    const int on_edge = up == 0.0;
+    const int interval_level = interval_levels[k+1];
+    const int edge_level = edge_levels_[i * (stride_ + 1) + k];
+    const int level = interval_level + on_edge * (edge_level - interval_level);
+    // the level beyond the nearest edge tells the sign
+    const int upwards = up <= down;
+    const int beyond = interval_levels[k + 2 * upwards];
+    const double magnitude = std::min(up, down);
+    distance[i] = beyond > level || magnitude == inf ? magnitude : -magnitude;
+    overall = std::fabs(distance[i]) < std::fabs(overall) ? distance[i] : overall;
+    max = std::max(max, level);
+  }
+  return max;
+}
+
+void BandEdgeCache::edgeMargins(const double* joint_position, double* margins) const {
+  const int row = stride_ + 2;
+  for (int i=0; i<number_of_joints_; i++) {
+    const double q = wrapPosition(joint_position[i], wrap_[3*i], wrap_[3*i+1], wrap_[3*i+2]);
+    const double* edges = &edges_[i * row];
+    const int k = locate(edges, q);
+    margins[i] = std::min(q - edges[k], edges[k+1] - q);
+  }
+}
+
+bool BandEdgeCache::write(std::FILE* file) const {
+  const int32_t sizes[] = {number_of_joints_, stride_};
+  return std::fwrite(sizes, sizeof(sizes), 1, file) == 1 && writeArray(file, edges_) &&
+         writeArray(file, interval_levels_) && writeArray(file, wrap_) && writeArray(file, edge_levels_);
+}
+
+bool BandEdgeCache::read(std::FILE* file, int number_of_joints) {
+  int32_t sizes[2];
+  // every level has two edges at most
+  bool valid = std::fread(sizes, sizeof(sizes), 1, file) == 1 && sizes[0] == number_of_joints &&
+               sizes[1] >= 0 && sizes[1] <= 2 * SingularityLimitTable::kMaxLevels;
+  if (valid) {
+    const std::size_t n = number_of_joints;
+    const std::size_t row = sizes[1] + 2;
+    valid = readArray(file, edges_, n * row) && readArray(file, interval_levels_, n * (row + 1)) &&
+            readArray(file, wrap_, 3 * n) && readArray(file, edge_levels_, n * (sizes[1] + 1));
+  }
+  number_of_joints_ = valid ? sizes[0] : 0;
+  stride_ = valid ? sizes[1] : 0;
+  if (!valid) {
+    edges_.clear();
+    interval_levels_.clear();
+    wrap_.clear();
+    edge_levels_.clear();
+  }
+  return valid;
+}
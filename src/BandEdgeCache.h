@@ -0,0 +1,118 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef BAND_EDGE_CACHE_H_
+#define BAND_EDGE_CACHE_H_
+
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+
+#include "SingularityLimitTable.h"
+
+
+/**
+ * @brief Sorted band edges of every joint, tagged with the level on both sides, precomputed at configuration time
+ *
+ * Only the edges the level of their joint changes at are kept, so the
+ * nearest edge is also the nearest level transition of the joint. The edges
+ * of every joint are framed by -inf and padded with +inf to the same count,
+ * so locating a joint position and measuring its distances to both
+ * neighbouring edges is a fixed number of comparisons without branches.
+ *
+ * Periodic joints of the table are reduced into their period window first
+ * and framed by the images of their outer edges, so distances across the
+ * window boundary are measured correctly.
+ *
+ * The signed distance of a joint is the distance to its nearest edge,
+ * positive when crossing it raises the level of the joint (towards the
+ * singularity) and negative when it lowers it.
+ */
+class BandEdgeCache {
+ public:
+  BandEdgeCache();
+
+  /**
+   * @brief Collect, sort and tag the edges of all bands of a limit table
+   *
+   * @param table   limits to cache, not referenced afterwards
+   */
+  void build(const SingularityLimitTable& table);
+
+  /**
+   * @brief Classify a position and measure the signed distance of every joint to its nearest level transition
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   * @param distance        buffer for number_of_joints() signed distances
+   * @param overall         signed distance of the joint closest to a transition, a lower bound of the
+   *                        joint motion before the level of the position can change
+   * @return int            index of the singularity level of the position, 0 if none
+   */
+  int classifyDistance(const double* joint_position, double* distance, double& overall) const;
+
+  /**
+   * @brief Measure how far every joint is from its nearest level transition
+   *
+   * Same margins as SingularityLimitTable::edgeMargins(), but edges that do
+   * not change the level of their joint are skipped, so the margins are never
+   * smaller.
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   * @param margins         buffer for number_of_joints() unsigned distances
+   */
+  void edgeMargins(const double* joint_position, double* margins) const;
+
+  /**
+   * @brief Write the cache in the binary layout read back by read()
+   *
+   * @param file    stream opened for binary writing
+   * @return false  if the cache could not be written completely
+   */
+  bool write(std::FILE* file) const;
+
+  /**
+   * @brief Take over a cache written by write() from the same limit table
+   *
+   * @param file              stream opened for binary reading
+   * @param number_of_joints  number of joints the cache has to be of
+   * @return false  if the cache is truncated or of another number of joints, the cache is then left empty
+   */
+  bool read(std::FILE* file, int number_of_joints);
+
+  int number_of_joints() const { return number_of_joints_; }
+  /// Number of edges of every joint including the padding, without the framing
+  int stride() const { return stride_; }
+
+ private:
+  /**
+   * @brief Locate a joint position among the edges of its joint
+   *
+   * @param edges   row of the joint in edges_
+   * @return int    number of edges below the position, the position lies between
+   *                edges[below] and edges[below+1]
+   */
+  int locate(const double* edges, double q) const {
+    int below = 0;
+    for (int k=1; k<=stride_; k++)
+      below += q > edges[k];
+    return below;
+  }
+
+  int number_of_joints_;
+  int stride_;
+  /// stride_+2 edges per joint: -inf, the edges in increasing order, padding with +inf;
+  /// periodic joints have the images of the last and first edges in place of the first two infinities
+  std::vector<double> edges_;
+  /// stride_+3 levels per joint: of the interval beyond the lower framing edge, then of the interval
+  /// below the first edge and of the interval above every edge
+  std::vector<uint8_t> interval_levels_;
+  /// center, period and inverse period of every joint, zeros for joints that are not periodic
+  std::vector<double> wrap_;
+  /// stride_+1 levels per joint: of the position exactly on every edge, outside of the bands it bounds, and padding
+  std::vector<uint8_t> edge_levels_;
+};
+
+#endif  // BAND_EDGE_CACHE_H_
@@ -0,0 +1,753 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "BandKernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BAND_KERNEL_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define BAND_KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+/**
+ * @brief Joint positions of the last, partially filled SIMD chunk
+ *
+ * The position vector is not padded, so its tail is copied into a full
+ * register-wide buffer. Lanes past the last joint face the padding limits.
+ */
+struct TailChunk {
+  TailChunk(const BandTableView& table, const double* joint_position)
+      : offset(table.number_of_joints & ~(BandKernel::kSimdWidth - 1)) {
+    for (int i=0; i<BandKernel::kSimdWidth; i++)
+      values[i] = 0.0;
+    for (int i=offset; i<table.number_of_joints; i++)
+      values[i - offset] = joint_position[i];
+  }
+  bool empty(const BandTableView& table) const { return offset == table.padded_joints; }
+
+  alignas(BandKernel::kAlignment) double values[BandKernel::kSimdWidth];
+  int offset;
+};
+
+inline const double* lowerRow(const BandTableView& table, int level) {
+  return table.bands + 2 * (level - 1) * table.padded_joints;
+}
+
+inline const int32_t* lowerRow(const CompactBandView& table, int level) {
+  return table.bands + 2 * (level - 1) * table.padded_joints;
+}
+
+#ifdef BAND_KERNEL_X86
+
+__attribute__((target("sse2")))
+inline __m128d insideSse2(__m128d inside, __m128d position, const double* lower, const double* upper) {
+  __m128d below_upper = _mm_cmplt_pd(position, _mm_load_pd(upper));
+  __m128d above_lower = _mm_cmpgt_pd(position, _mm_load_pd(lower));
+  return _mm_or_pd(inside, _mm_and_pd(below_upper, above_lower));
+}
+
+/// wrapPosition() of two lanes starting at joint j, position itself without periodic joints
+__attribute__((target("sse2")))
+inline __m128d wrapSse2(const BandTableView& table, __m128d position, int j) {
+  if (!table.wrap)
+    return position;
+  const double* center = table.wrap + j;
+  const __m128d magic = _mm_set1_pd(kRoundingMagic);
+  const __m128d offset = _mm_mul_pd(_mm_sub_pd(position, _mm_load_pd(center)),
+                                    _mm_load_pd(center + 2 * table.padded_joints));
+  const __m128d turns = _mm_sub_pd(_mm_add_pd(offset, magic), magic);
+  return _mm_sub_pd(position, _mm_mul_pd(turns, _mm_load_pd(center + table.padded_joints)));
+}
+
+__attribute__((target("sse2")))
+inline bool anyInsideSse2(const BandTableView& table, const TailChunk& tail, const double* joint_position, int level) {
+  const double* lower = lowerRow(table, level);
+  const double* upper = lower + table.padded_joints;
+  __m128d inside = _mm_setzero_pd();
+  for (int j=0; j<tail.offset; j+=2)
+    inside = insideSse2(inside, wrapSse2(table, _mm_loadu_pd(joint_position + j), j), lower + j, upper + j);
+  if (!tail.empty(table)) {
+    for (int j=0; j<BandKernel::kSimdWidth; j+=2)
+      inside = insideSse2(inside, wrapSse2(table, _mm_load_pd(tail.values + j), tail.offset + j),
+                          lower + tail.offset + j, upper + tail.offset + j);
+  }
+  return _mm_movemask_pd(inside) != 0;
+}
+
+__attribute__((target("sse2")))
+int classifySse2(const BandTableView& table, const double* joint_position) {
+  const TailChunk tail(table, joint_position);
+  if (table.nested) {
+    // a level holds some joint only if all levels below it do, so bisect the levels
+    if (!anyInsideSse2(table, tail, joint_position, 1))
+      return 0;
+    int found = 1;
+    int missing = table.number_of_levels + 1;
+    while (missing - found > 1) {
+      const int level = (found + missing) / 2;
+      if (anyInsideSse2(table, tail, joint_position, level))
+        found = level;
+      else
+        missing = level;
+    }
+    return found;
+  }
+  for (int level=table.number_of_levels; level>0; level--) {
+    if (anyInsideSse2(table, tail, joint_position, level))
+      return level;
+  }
+  return 0;
+}
+
+__attribute__((target("sse2")))
+inline void jointLevelsChunkSse2(const BandTableView& table, __m128d q, int offset, uint8_t* levels) {
+  q = wrapSse2(table, q, offset);
+  __m128d level = _mm_setzero_pd();
+  for (int l=1; l<=table.number_of_levels; l++) {
+    const double* lower = lowerRow(table, l) + offset;
+    const double* upper = lower + table.padded_joints;
+    const __m128d inside = insideSse2(_mm_setzero_pd(), q, lower, upper);
+    // later, inner levels override the outer ones
+    level = _mm_or_pd(_mm_and_pd(inside, _mm_set1_pd(l)), _mm_andnot_pd(inside, level));
+  }
+  alignas(16) double values[2];
+  _mm_store_pd(values, level);
+  levels[0] = static_cast<uint8_t>(values[0]);
+  levels[1] = static_cast<uint8_t>(values[1]);
+}
+
+__attribute__((target("sse2")))
+void jointLevelsSse2(const BandTableView& table, const double* joint_position, uint8_t* levels) {
+  const TailChunk tail(table, joint_position);
+  for (int j=0; j<tail.offset; j+=2)
+    jointLevelsChunkSse2(table, _mm_loadu_pd(joint_position + j), j, levels + j);
+  if (!tail.empty(table)) {
+    uint8_t tail_levels[BandKernel::kSimdWidth];
+    for (int j=0; j<BandKernel::kSimdWidth; j+=2)
+      jointLevelsChunkSse2(table, _mm_load_pd(tail.values + j), tail.offset + j, tail_levels + j);
+    for (int i=tail.offset; i<table.number_of_joints; i++)
+      levels[i] = tail_levels[i - tail.offset];
+  }
+}
+
+__attribute__((target("avx2")))
+inline __m256d insideAvx2(__m256d inside, __m256d position, const double* lower, const double* upper) {
+  __m256d below_upper = _mm256_cmp_pd(position, _mm256_load_pd(upper), _CMP_LT_OQ);
+  __m256d above_lower = _mm256_cmp_pd(position, _mm256_load_pd(lower), _CMP_GT_OQ);
+  return _mm256_or_pd(inside, _mm256_and_pd(below_upper, above_lower));
+}
+
+/// wrapPosition() of four lanes starting at joint j, position itself without periodic joints
+__attribute__((target("avx2")))
+inline __m256d wrapAvx2(const BandTableView& table, __m256d position, int j) {
+  if (!table.wrap)
+    return position;
+  const double* center = table.wrap + j;
+  const __m256d magic = _mm256_set1_pd(kRoundingMagic);
+  const __m256d offset = _mm256_mul_pd(_mm256_sub_pd(position, _mm256_load_pd(center)),
+                                       _mm256_load_pd(center + 2 * table.padded_joints));
+  const __m256d turns = _mm256_sub_pd(_mm256_add_pd(offset, magic), magic);
+  return _mm256_sub_pd(position, _mm256_mul_pd(turns, _mm256_load_pd(center + table.padded_joints)));
+}
+
+__attribute__((target("avx2")))
+inline bool anyInsideAvx2(const BandTableView& table, const TailChunk& tail, const double* joint_position, int level) {
+  const double* lower = lowerRow(table, level);
+  const double* upper = lower + table.padded_joints;
+  __m256d inside = _mm256_setzero_pd();
+  for (int j=0; j<tail.offset; j+=4)
+    inside = insideAvx2(inside, wrapAvx2(table, _mm256_loadu_pd(joint_position + j), j), lower + j, upper + j);
+  if (!tail.empty(table))
+    inside = insideAvx2(inside, wrapAvx2(table, _mm256_load_pd(tail.values), tail.offset),
+                        lower + tail.offset, upper + tail.offset);
+  return _mm256_movemask_pd(inside) != 0;
+}
+
+__attribute__((target("avx2")))
+int classifyAvx2(const BandTableView& table, const double* joint_position) {
+  const TailChunk tail(table, joint_position);
+  if (table.nested) {
+    // a level holds some joint only if all levels below it do, so bisect the levels
+    if (!anyInsideAvx2(table, tail, joint_position, 1))
+      return 0;
+    int found = 1;
+    int missing = table.number_of_levels + 1;
+    while (missing - found > 1) {
+      const int level = (found + missing) / 2;
+      if (anyInsideAvx2(table, tail, joint_position, level))
+        found = level;
+      else
+        missing = level;
+    }
+    return found;
+  }
+  for (int level=table.number_of_levels; level>0; level--) {
+    if (anyInsideAvx2(table, tail, joint_position, level))
+      return level;
+  }
+  return 0;
+}
+
+__attribute__((target("avx2")))
+inline void jointLevelsChunkAvx2(const BandTableView& table, __m256d q, int offset, uint8_t* levels) {
+  q = wrapAvx2(table, q, offset);
+  __m256d level = _mm256_setzero_pd();
+  for (int l=1; l<=table.number_of_levels; l++) {
+    const double* lower = lowerRow(table, l) + offset;
+    const double* upper = lower + table.padded_joints;
+    const __m256d inside = insideAvx2(_mm256_setzero_pd(), q, lower, upper);
+    // later, inner levels override the outer ones
+    level = _mm256_blendv_pd(level, _mm256_set1_pd(l), inside);
+  }
+  alignas(16) int32_t values[4];
+  _mm_store_si128(reinterpret_cast<__m128i*>(values), _mm256_cvttpd_epi32(level));
+  for (int i=0; i<4; i++)
+    levels[i] = static_cast<uint8_t>(values[i]);
+}
+
+__attribute__((target("avx2")))
+void jointLevelsAvx2(const BandTableView& table, const double* joint_position, uint8_t* levels) {
+  const TailChunk tail(table, joint_position);
+  for (int j=0; j<tail.offset; j+=4)
+    jointLevelsChunkAvx2(table, _mm256_loadu_pd(joint_position + j), j, levels + j);
+  if (!tail.empty(table)) {
+    uint8_t tail_levels[BandKernel::kSimdWidth];
+    jointLevelsChunkAvx2(table, _mm256_load_pd(tail.values), tail.offset, tail_levels);
+    for (int i=tail.offset; i<table.number_of_joints; i++)
+      levels[i] = tail_levels[i - tail.offset];
+  }
+}
+
+__attribute__((target("sse2")))
+inline bool anyInsideCompactSse2(const CompactBandView& table, const int32_t* keys, int level) {
+  const int32_t* lower = lowerRow(table, level);
+  const int32_t* upper = lower + table.padded_joints;
+  __m128i inside = _mm_setzero_si128();
+  for (int j=0; j<table.padded_joints; j+=4) {
+    const __m128i q = _mm_load_si128(reinterpret_cast<const __m128i*>(keys + j));
+    const __m128i below_upper = _mm_cmplt_epi32(q, _mm_load_si128(reinterpret_cast<const __m128i*>(upper + j)));
+    const __m128i above_lower = _mm_cmpgt_epi32(q, _mm_load_si128(reinterpret_cast<const __m128i*>(lower + j)));
+    inside = _mm_or_si128(inside, _mm_and_si128(below_upper, above_lower));
+  }
+  return _mm_movemask_epi8(inside) != 0;
+}
+
+__attribute__((target("sse2")))
+int classifyCompactSse2(const CompactBandView& table, const int32_t* keys) {
+  if (table.nested) {
+    if (!anyInsideCompactSse2(table, keys, 1))
+      return 0;
+    int found = 1;
+    int missing = table.number_of_levels + 1;
+    while (missing - found > 1) {
+      const int level = (found + missing) / 2;
+      if (anyInsideCompactSse2(table, keys, level))
+        found = level;
+      else
+        missing = level;
+    }
+    return found;
+  }
+  for (int level=table.number_of_levels; level>0; level--) {
+    if (anyInsideCompactSse2(table, keys, level))
+      return level;
+  }
+  return 0;
+}
+
+__attribute__((target("avx2")))
+inline bool anyInsideCompactAvx2(const CompactBandView& table, const int32_t* keys, int level) {
+  const int32_t* lower = lowerRow(table, level);
+  const int32_t* upper = lower + table.padded_joints;
+  __m256i inside = _mm256_setzero_si256();
+  for (int j=0; j<table.padded_joints; j+=8) {
+    const __m256i q = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys + j));
+    const __m256i below_upper = _mm256_cmpgt_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(upper + j)), q);
+    const __m256i above_lower = _mm256_cmpgt_epi32(q, _mm256_load_si256(reinterpret_cast<const __m256i*>(lower + j)));
+    inside = _mm256_or_si256(inside, _mm256_and_si256(below_upper, above_lower));
+  }
+  return !_mm256_testz_si256(inside, inside);
+}
+
+__attribute__((target("avx2")))
+int classifyCompactAvx2(const CompactBandView& table, const int32_t* keys) {
+  if (table.nested) {
+    if (!anyInsideCompactAvx2(table, keys, 1))
+      return 0;
+    int found = 1;
+    int missing = table.number_of_levels + 1;
+    while (missing - found > 1) {
+      const int level = (found + missing) / 2;
+      if (anyInsideCompactAvx2(table, keys, level))
+        found = level;
+      else
+        missing = level;
+    }
+    return found;
+  }
+  for (int level=table.number_of_levels; level>0; level--) {
+    if (anyInsideCompactAvx2(table, keys, level))
+      return level;
+  }
+  return 0;
+}
+
+/// floatKey() of four float lanes
+__attribute__((target("sse2")))
+inline __m128i floatKeysSse2(__m128 values) {
+  const __m128i bits = _mm_castps_si128(values);
+  return _mm_xor_si128(bits, _mm_and_si128(_mm_srai_epi32(bits, 31), _mm_set1_epi32(0x7fffffff)));
+}
+
+/// two doubles from j on, zero past count; loaded straight into the register, not through a buffer
+__attribute__((target("sse2")))
+inline __m128d loadJointsSse2(const double* values, int j, int count) {
+  if (count - j >= 2)
+    return _mm_loadu_pd(values + j);
+  return count - j == 1 ? _mm_load_sd(values + j) : _mm_setzero_pd();
+}
+
+__attribute__((target("sse2")))
+inline __m128i fixedKeysSse2(const double* joint_position, const double* scale, int j, int number_of_joints) {
+  const __m128d saturation = _mm_set1_pd(kFixedSaturation);
+  const __m128d negative_saturation = _mm_set1_pd(-kFixedSaturation);
+  const __m128d scaled = _mm_mul_pd(loadJointsSse2(joint_position, j, number_of_joints),
+                                    loadJointsSse2(scale, j, number_of_joints));
+  // the limit goes first so that NaN passes both and converts to INT32_MIN
+  return _mm_cvtpd_epi32(_mm_max_pd(negative_saturation, _mm_min_pd(saturation, scaled)));
+}
+
+__attribute__((target("sse2")))
+void compactKeysSse2(const double* joint_position, const double* scale, int number_of_joints, int32_t* keys) {
+  const int padded = (number_of_joints + BandKernel::kCompactWidth - 1) & ~(BandKernel::kCompactWidth - 1);
+  for (int j=0; j<padded; j+=4) {
+    __m128i chunk;
+    if (!scale) {
+      chunk = floatKeysSse2(_mm_movelh_ps(_mm_cvtpd_ps(loadJointsSse2(joint_position, j, number_of_joints)),
+                                          _mm_cvtpd_ps(loadJointsSse2(joint_position, j + 2, number_of_joints))));
+    } else {
+      chunk = _mm_unpacklo_epi64(fixedKeysSse2(joint_position, scale, j, number_of_joints),
+                                 fixedKeysSse2(joint_position, scale, j + 2, number_of_joints));
+    }
+    _mm_store_si128(reinterpret_cast<__m128i*>(keys + j), chunk);
+  }
+}
+
+/// four doubles from j on, zero past count; the last chunk is loaded masked, not through a buffer
+__attribute__((target("avx2")))
+inline __m256d loadJointsAvx2(const double* values, int j, int count) {
+  if (count - j >= 4)
+    return _mm256_loadu_pd(values + j);
+  const __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(count - j), _mm256_setr_epi64x(0, 1, 2, 3));
+  return _mm256_maskload_pd(values + j, mask);
+}
+
+__attribute__((target("avx2")))
+inline __m128i fixedKeysAvx2(const double* joint_position, const double* scale, int j, int number_of_joints) {
+  const __m256d saturation = _mm256_set1_pd(kFixedSaturation);
+  const __m256d negative_saturation = _mm256_set1_pd(-kFixedSaturation);
+  const __m256d scaled = _mm256_mul_pd(loadJointsAvx2(joint_position, j, number_of_joints),
+                                       loadJointsAvx2(scale, j, number_of_joints));
+  // the limit goes first so that NaN passes both and converts to INT32_MIN
+  return _mm256_cvtpd_epi32(_mm256_max_pd(negative_saturation, _mm256_min_pd(saturation, scaled)));
+}
+
+__attribute__((target("avx2")))
+void compactKeysAvx2(const double* joint_position, const double* scale, int number_of_joints, int32_t* keys) {
+  const int padded = (number_of_joints + BandKernel::kCompactWidth - 1) & ~(BandKernel::kCompactWidth - 1);
+  for (int j=0; j<padded; j+=8) {
+    __m256i chunk;
+    if (!scale) {
+      const __m128 low = _mm256_cvtpd_ps(loadJointsAvx2(joint_position, j, number_of_joints));
+      const __m128 high = _mm256_cvtpd_ps(loadJointsAvx2(joint_position, j + 4, number_of_joints));
+      const __m256i bits = _mm256_castps_si256(_mm256_set_m128(high, low));
+      chunk = _mm256_xor_si256(bits, _mm256_and_si256(_mm256_srai_epi32(bits, 31), _mm256_set1_epi32(0x7fffffff)));
+    } else {
+      chunk = _mm256_set_m128i(fixedKeysAvx2(joint_position, scale, j + 4, number_of_joints),
+                               fixedKeysAvx2(joint_position, scale, j, number_of_joints));
+    }
+    _mm256_store_si256(reinterpret_cast<__m256i*>(keys + j), chunk);
+  }
+}
+
+#endif  // BAND_KERNEL_X86
+
+#ifdef BAND_KERNEL_NEON
+
+inline uint64x2_t insideNeon(uint64x2_t inside, float64x2_t position, const double* lower, const double* upper) {
+  uint64x2_t below_upper = vcltq_f64(position, vld1q_f64(upper));
+  uint64x2_t above_lower = vcgtq_f64(position, vld1q_f64(lower));
+  return vorrq_u64(inside, vandq_u64(below_upper, above_lower));
+}
+
+/// wrapPosition() of two lanes starting at joint j, position itself without periodic joints
+inline float64x2_t wrapNeon(const BandTableView& table, float64x2_t position, int j) {
+  if (!table.wrap)
+    return position;
+  const double* center = table.wrap + j;
+  const float64x2_t magic = vdupq_n_f64(kRoundingMagic);
+  const float64x2_t offset = vmulq_f64(vsubq_f64(position, vld1q_f64(center)),
+                                       vld1q_f64(center + 2 * table.padded_joints));
+  const float64x2_t turns = vsubq_f64(vaddq_f64(offset, magic), magic);
+  return vsubq_f64(position, vmulq_f64(turns, vld1q_f64(center + table.padded_joints)));
+}
+
+inline bool anyInsideNeon(const BandTableView& table, const TailChunk& tail, const double* joint_position, int level) {
+  const double* lower = lowerRow(table, level);
+  const double* upper = lower + table.padded_joints;
+  uint64x2_t inside = vdupq_n_u64(0);
+  for (int j=0; j<tail.offset; j+=2)
+    inside = insideNeon(inside, wrapNeon(table, vld1q_f64(joint_position + j), j), lower + j, upper + j);
+  if (!tail.empty(table)) {
+    for (int j=0; j<BandKernel::kSimdWidth; j+=2)
+      inside = insideNeon(inside, wrapNeon(table, vld1q_f64(tail.values + j), tail.offset + j),
+                          lower + tail.offset + j, upper + tail.offset + j);
+  }
+  return vmaxvq_u32(vreinterpretq_u32_u64(inside)) != 0;
+}
+
+int classifyNeon(const BandTableView& table, const double* joint_position) {
+  const TailChunk tail(table, joint_position);
+  if (table.nested) {
+    // a level holds some joint only if all levels below it do, so bisect the levels
+    if (!anyInsideNeon(table, tail, joint_position, 1))
+      return 0;
+    int found = 1;
+    int missing = table.number_of_levels + 1;
+    while (missing - found > 1) {
+      const int level = (found + missing) / 2;
+      if (anyInsideNeon(table, tail, joint_position, level))
+        found = level;
+      else
+        missing = level;
+    }
+    return found;
+  }
+  for (int level=table.number_of_levels; level>0; level--) {
+    if (anyInsideNeon(table, tail, joint_position, level))
+      return level;
+  }
+  return 0;
+}
+
+inline void jointLevelsChunkNeon(const BandTableView& table, float64x2_t q, int offset, uint8_t* levels) {
+  q = wrapNeon(table, q, offset);
+  float64x2_t level = vdupq_n_f64(0.0);
+  for (int l=1; l<=table.number_of_levels; l++) {
+    const double* lower = lowerRow(table, l) + offset;
+    const double* upper = lower + table.padded_joints;
+    const uint64x2_t inside = insideNeon(vdupq_n_u64(0), q, lower, upper);
+    // later, inner levels override the outer ones
+    level = vbslq_f64(inside, vdupq_n_f64(l), level);
+  }
+  levels[0] = static_cast<uint8_t>(vgetq_lane_f64(level, 0));
+  levels[1] = static_cast<uint8_t>(vgetq_lane_f64(level, 1));
+}
+
+void jointLevelsNeon(const BandTableView& table, const double* joint_position, uint8_t* levels) {
+  const TailChunk tail(table, joint_position);
+  for (int j=0; j<tail.offset; j+=2)
+    jointLevelsChunkNeon(table, vld1q_f64(joint_position + j), j, levels + j);
+  if (!tail.empty(table)) {
+    uint8_t tail_levels[BandKernel::kSimdWidth];
+    for (int j=0; j<BandKernel::kSimdWidth; j+=2)
+      jointLevelsChunkNeon(table, vld1q_f64(tail.values + j), tail.offset + j, tail_levels + j);
+    for (int i=tail.offset; i<table.number_of_joints; i++)
+      levels[i] = tail_levels[i - tail.offset];
+  }
+}
+
+inline bool anyInsideCompactNeon(const CompactBandView& table, const int32_t* keys, int level) {
+  const int32_t* lower = lowerRow(table, level);
+  const int32_t* upper = lower + table.padded_joints;
+  uint32x4_t inside = vdupq_n_u32(0);
+  for (int j=0; j<table.padded_joints; j+=4) {
+    const int32x4_t q = vld1q_s32(keys + j);
+    inside = vorrq_u32(inside, vandq_u32(vcltq_s32(q, vld1q_s32(upper + j)), vcgtq_s32(q, vld1q_s32(lower + j))));
+  }
+  return vmaxvq_u32(inside) != 0;
+}
+
+int classifyCompactNeon(const CompactBandView& table, const int32_t* keys) {
+  if (table.nested) {
+    if (!anyInsideCompactNeon(table, keys, 1))
+      return 0;
+    int found = 1;
+    int missing = table.number_of_levels + 1;
+    while (missing - found > 1) {
+      const int level = (found + missing) / 2;
+      if (anyInsideCompactNeon(table, keys, level))
+        found = level;
+      else
+        missing = level;
+    }
+    return found;
+  }
+  for (int level=table.number_of_levels; level>0; level--) {
+    if (anyInsideCompactNeon(table, keys, level))
+      return level;
+  }
+  return 0;
+}
+
+/// two doubles from j on, zero past count
+inline float64x2_t loadJointsNeon(const double* values, int j, int count) {
+  if (count - j >= 2)
+    return vld1q_f64(values + j);
+  return count - j == 1 ? vsetq_lane_f64(values[j], vdupq_n_f64(0.0), 0) : vdupq_n_f64(0.0);
+}
+
+inline int32x2_t fixedKeysNeon(const double* joint_position, const double* scale, int j, int number_of_joints) {
+  const float64x2_t scaled = vmulq_f64(loadJointsNeon(joint_position, j, number_of_joints),
+                                       loadJointsNeon(scale, j, number_of_joints));
+  const float64x2_t clamped = vmaxq_f64(vdupq_n_f64(-kFixedSaturation), vminq_f64(vdupq_n_f64(kFixedSaturation), scaled));
+  // the conversion turns NaN into 0, select INT32_MIN for it as the x86 conversions do
+  const int64x2_t rounded = vbslq_s64(vceqq_f64(scaled, scaled), vcvtnq_s64_f64(clamped), vdupq_n_s64(INT32_MIN));
+  return vmovn_s64(rounded);
+}
+
+void compactKeysNeon(const double* joint_position, const double* scale, int number_of_joints, int32_t* keys) {
+  const int padded = (number_of_joints + BandKernel::kCompactWidth - 1) & ~(BandKernel::kCompactWidth - 1);
+  for (int j=0; j<padded; j+=4) {
+    int32x4_t chunk;
+    if (!scale) {
+      const int32x4_t bits = vreinterpretq_s32_f32(
+          vcombine_f32(vcvt_f32_f64(loadJointsNeon(joint_position, j, number_of_joints)),
+                       vcvt_f32_f64(loadJointsNeon(joint_position, j + 2, number_of_joints))));
+      chunk = veorq_s32(bits, vandq_s32(vshrq_n_s32(bits, 31), vdupq_n_s32(0x7fffffff)));
+    } else {
+      chunk = vcombine_s32(fixedKeysNeon(joint_position, scale, j, number_of_joints),
+                           fixedKeysNeon(joint_position, scale, j + 2, number_of_joints));
+    }
+    vst1q_s32(keys + j, chunk);
+  }
+}
+
+#endif  // BAND_KERNEL_NEON
+
+}  // namespace
+
+namespace {
+
+inline double wrapScalar(const BandTableView& table, const double* joint_position, int i) {
+  if (!table.wrap)
+    return joint_position[i];
+  const double* center = table.wrap;
+  return wrapPosition(joint_position[i], center[i], center[table.padded_joints + i],
+                      center[2 * table.padded_joints + i]);
+}
+
+inline bool anyInsideScalar(const BandTableView& table, const double* joint_position, int level) {
+  const double* lower = lowerRow(table, level);
+  const double* upper = lower + table.padded_joints;
+  bool inside = false;
+  for (int i=0; i<table.number_of_joints; i++) {
+    const double q = wrapScalar(table, joint_position, i);
+    inside |= (q < upper[i]) & (q > lower[i]);
+  }
+  return inside;
+}
+
+inline bool anyInsideCompactScalar(const CompactBandView& table, const int32_t* keys, int level) {
+  const int32_t* lower = lowerRow(table, level);
+  const int32_t* upper = lower + table.padded_joints;
+  bool inside = false;
+  for (int i=0; i<table.number_of_joints; i++)
+    inside |= (keys[i] < upper[i]) & (keys[i] > lower[i]);
+  return inside;
+}
+
+}  // namespace
+
+int BandKernel::classifyScalar(const BandTableView& table, const double* joint_position) {
+  if (table.nested) {
+    // a level holds some joint only if all levels below it do, so bisect the levels
+    if (!anyInsideScalar(table, joint_position, 1))
+      return 0;
+    int found = 1;
+    int missing = table.number_of_levels + 1;
+    while (missing - found > 1) {
+      const int level = (found + missing) / 2;
+      if (anyInsideScalar(table, joint_position, level))
+        found = level;
+      else
+        missing = level;
+    }
+    return found;
+  }
+  for (int level=table.number_of_levels; level>0; level--) {
+    if (anyInsideScalar(table, joint_position, level))
+      return level;
+  }
+  return 0;
+}
+
+void BandKernel::jointLevelsScalar(const BandTableView& table, const double* joint_position, uint8_t* levels) {
+  for (int i=0; i<table.number_of_joints; i++) {
+    const double q = wrapScalar(table, joint_position, i);
+    int level = 0;
+    for (int l=1; l<=table.number_of_levels; l++) {
+      const double* lower = lowerRow(table, l);
+      const double* upper = lower + table.padded_joints;
+      level = (q < upper[i] && q > lower[i]) ? l : level;
+    }
+    levels[i] = static_cast<uint8_t>(level);
+  }
+}
+
+int BandKernel::classifyCompactScalar(const CompactBandView& table, const int32_t* keys) {
+  if (table.nested) {
+    if (!anyInsideCompactScalar(table, keys, 1))
+      return 0;
+    int found = 1;
+    int missing = table.number_of_levels + 1;
+    while (missing - found > 1) {
+      const int level = (found + missing) / 2;
+      if (anyInsideCompactScalar(table, keys, level))
+        found = level;
+      else
+        missing = level;
+    }
+    return found;
+  }
+  for (int level=table.number_of_levels; level>0; level--) {
+    if (anyInsideCompactScalar(table, keys, level))
+      return level;
+  }
+  return 0;
+}
+
+bool BandKernel::isAvailable(Isa isa) {
+  switch (isa) {
+    case kScalar:
+      return true;
+#ifdef BAND_KERNEL_X86
+    case kSse2:
+      return __builtin_cpu_supports("sse2");
+    case kAvx2:
+      return __builtin_cpu_supports("avx2");
+#endif
+#ifdef BAND_KERNEL_NEON
+    case kNeon:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+BandKernel::Isa BandKernel::detect() {
+  static const Isa preference[] = {kAvx2, kNeon, kSse2};
+  for (unsigned i=0; i<sizeof(preference)/sizeof(preference[0]); i++) {
+    if (isAvailable(preference[i]))
+      return preference[i];
+  }
+  return kScalar;
+}
+
+BandKernel::ClassifyFunction BandKernel::classifyFunction(Isa isa) {
+  if (!isAvailable(isa))
+    return &BandKernel::classifyScalar;
+  switch (isa) {
+#ifdef BAND_KERNEL_X86
+    case kSse2:
+      return &classifySse2;
+    case kAvx2:
+      return &classifyAvx2;
+#endif
+#ifdef BAND_KERNEL_NEON
+    case kNeon:
+      return &classifyNeon;
+#endif
+    default:
+      return &BandKernel::classifyScalar;
+  }
+}
+
+BandKernel::JointLevelsFunction BandKernel::jointLevelsFunction(Isa isa) {
+  if (!isAvailable(isa))
+    return &BandKernel::jointLevelsScalar;
+  switch (isa) {
+#ifdef BAND_KERNEL_X86
+    case kSse2:
+      return &jointLevelsSse2;
+    case kAvx2:
+      return &jointLevelsAvx2;
+#endif
+#ifdef BAND_KERNEL_NEON
+    case kNeon:
+      return &jointLevelsNeon;
+#endif
+    default:
+      return &BandKernel::jointLevelsScalar;
+  }
+}
+
+BandKernel::CompactClassifyFunction BandKernel::compactClassifyFunction(Isa isa) {
+  if (!isAvailable(isa))
+    return &BandKernel::classifyCompactScalar;
+  switch (isa) {
+#ifdef BAND_KERNEL_X86
+    case kSse2:
+      return &classifyCompactSse2;
+    case kAvx2:
+      return &classifyCompactAvx2;
+#endif
+#ifdef BAND_KERNEL_NEON
+    case kNeon:
+      return &classifyCompactNeon;
+#endif
+    default:
+      return &BandKernel::classifyCompactScalar;
+  }
+}
+
+void BandKernel::compactKeysScalar(const double* joint_position, const double* scale, int number_of_joints,
+                                   int32_t* keys) {
+  if (!scale) {
+    for (int i=0; i<number_of_joints; i++)
+      keys[i] = floatKey(static_cast<float>(joint_position[i]));
+    return;
+  }
+  for (int i=0; i<number_of_joints; i++)
+    keys[i] = fixedKey(joint_position[i] * scale[i]);
+}
+
+BandKernel::CompactKeysFunction BandKernel::compactKeysFunction(Isa isa) {
+  if (!isAvailable(isa))
+    return &BandKernel::compactKeysScalar;
+  switch (isa) {
+#ifdef BAND_KERNEL_X86
+    case kSse2:
+      return &compactKeysSse2;
+    case kAvx2:
+      return &compactKeysAvx2;
+#endif
+#ifdef BAND_KERNEL_NEON
+    case kNeon:
+      return &compactKeysNeon;
+#endif
+    default:
+      return &BandKernel::compactKeysScalar;
+  }
+}
+
+const char* BandKernel::name(Isa isa) {
+  switch (isa) {
+    case kSse2:
+      return "sse2";
+    case kAvx2:
+      return "avx2";
+    case kNeon:
+      return "neon";
+    default:
+      return "scalar";
+  }
+}
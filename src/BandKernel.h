@@ -0,0 +1,173 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef BAND_KERNEL_H_
+#define BAND_KERNEL_H_
+
+#include <cstring>
+#include <stdint.h>
+
+
+/**
+ * @brief Read-only view of the packed singularity band limits
+ *
+ * Level l (1-based) occupies 2*padded_joints doubles starting at
+ * bands + 2*(l-1)*padded_joints: first the lower limits, then the upper ones.
+ * Padding lanes hold +inf / -inf, so they never fall inside a band.
+ * In a nested table the band of every level lies within the band of the
+ * level below it for all joints.
+ *
+ * Periodic joints are reduced into one period before being compared. wrap
+ * holds three rows of padded_joints doubles: the center of the period window
+ * of every joint, the period and its inverse; joints that are not periodic
+ * and padding lanes have zero period and inverse. wrap is NULL when no joint
+ * is periodic.
+ */
+struct BandTableView {
+  const double* bands;
+  const double* wrap;
+  int number_of_levels;
+  int number_of_joints;
+  int padded_joints;
+  bool nested;
+};
+
+/**
+ * @brief Read-only view of band limits quantized to 32-bit keys, see CompactLimitTable
+ *
+ * Same layout as BandTableView with int32_t keys in place of the doubles and
+ * rows padded to BandKernel::kCompactWidth keys. Padding lanes hold
+ * INT32_MAX / INT32_MIN, so any key in a padding lane is outside.
+ */
+struct CompactBandView {
+  const int32_t* bands;
+  int number_of_levels;
+  int number_of_joints;
+  int padded_joints;
+  bool nested;
+};
+
+/// Adding and subtracting 1.5 * 2^52 rounds any double below 2^51 to the nearest integer
+const double kRoundingMagic = 6755399441055744.0;
+
+/**
+ * @brief Reduce a joint position into the period window around center, without fmod and branches
+ *
+ * @param q         joint position
+ * @param center    center of the period window
+ * @param period    period, 0 for a joint that is not periodic
+ * @param inverse   inverse of the period, 0 for a joint that is not periodic
+ * @return double   position within [center - period/2, center + period/2], q itself if not periodic
+ */
+inline double wrapPosition(double q, double center, double period, double inverse) {
+  const double turns = ((q - center) * inverse + kRoundingMagic) - kRoundingMagic;
+  return q - turns * period;
+}
+
+/// Fixed-point keys of positions saturate here, beyond every finite edge of a compact table
+const double kFixedSaturation = 2147483646.0;
+
+/**
+ * @brief Order preserving key of a float: integer comparison of two keys is float comparison of their values
+ */
+inline int32_t floatKey(float value) {
+  int32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  // negative floats are sign and magnitude, flip the magnitude so that they decrease
+  return bits ^ ((bits >> 31) & 0x7fffffff);
+}
+
+/**
+ * @brief Nearest fixed-point key of a scaled position, rounding half to even like the SIMD conversions
+ *
+ * Infinities saturate to the finite keys, NaN gets INT32_MIN, which no band holds.
+ */
+inline int32_t fixedKey(double scaled) {
+  const double clamped = scaled < -kFixedSaturation ? -kFixedSaturation
+                                                    : (scaled > kFixedSaturation ? kFixedSaturation : scaled);
+  return scaled == scaled ? static_cast<int32_t>((clamped + kRoundingMagic) - kRoundingMagic) : INT32_MIN;
+}
+
+/**
+ * @brief Band classification kernels, one implementation per instruction set
+ */
+class BandKernel {
+ public:
+  /// Number of doubles every band row is padded to, the widest supported SIMD register
+  static const int kSimdWidth = 4;
+  /// Alignment in bytes of every band row
+  static const int kAlignment = kSimdWidth * sizeof(double);
+
+  /// Number of 32-bit keys every compact band row is padded to, twice the lanes of the double rows
+  static const int kCompactWidth = 8;
+  /// Alignment in bytes of every compact band row
+  static const int kCompactAlignment = kCompactWidth * sizeof(int32_t);
+
+  enum Isa { kScalar = 0, kSse2, kAvx2, kNeon };
+
+  /**
+   * @brief Find the highest level whose band holds any joint
+   *
+   * Nested tables are classified by bisecting the levels, so the cost grows
+   * with the logarithm of the number of levels, and positions outside of all
+   * bands cost a single pass over the joints.
+   *
+   * @param table           band limits
+   * @param joint_position  pointer to table.number_of_joints joint positions
+   * @return int            index of the singularity level, 0 if none
+   */
+  typedef int (*ClassifyFunction)(const BandTableView& table, const double* joint_position);
+
+  /**
+   * @brief Find for every joint the highest level whose band holds it
+   *
+   * @param table           band limits
+   * @param joint_position  pointer to table.number_of_joints joint positions
+   * @param levels          buffer for table.number_of_joints singularity level indices
+   */
+  typedef void (*JointLevelsFunction)(const BandTableView& table, const double* joint_position, uint8_t* levels);
+
+  /**
+   * @brief Find the highest level whose compact band holds any joint, bisecting the levels of nested tables
+   *
+   * @param table   quantized band limits
+   * @param keys    pointer to table.padded_joints joint position keys aligned to kCompactAlignment,
+   *                the padding lanes may hold anything
+   * @return int    index of the singularity level, 0 if none
+   */
+  typedef int (*CompactClassifyFunction)(const CompactBandView& table, const int32_t* keys);
+
+  /**
+   * @brief Convert joint positions to the keys of a compact table
+   *
+   * @param joint_position    pointer to number_of_joints joint positions
+   * @param scale             fixed-point units per position unit of every joint, NULL for float32 keys
+   * @param number_of_joints  number of joints
+   * @param keys              buffer for number_of_joints keys, see floatKey() and fixedKey(), aligned to
+   *                          kCompactAlignment and padded to kCompactWidth. The SIMD kernels fill the
+   *                          padding as well, with stores as wide as the loads of the classification, so
+   *                          the keys are forwarded from the stores instead of stalling on them
+   */
+  typedef void (*CompactKeysFunction)(const double* joint_position, const double* scale, int number_of_joints,
+                                      int32_t* keys);
+
+  /// Best instruction set supported by the running CPU
+  static Isa detect();
+  /// Kernel for the given instruction set, the scalar one when it is not available
+  static ClassifyFunction classifyFunction(Isa isa);
+  static JointLevelsFunction jointLevelsFunction(Isa isa);
+  static CompactClassifyFunction compactClassifyFunction(Isa isa);
+  static CompactKeysFunction compactKeysFunction(Isa isa);
+  static bool isAvailable(Isa isa);
+  static const char* name(Isa isa);
+
+  static int classifyScalar(const BandTableView& table, const double* joint_position);
+  static void jointLevelsScalar(const BandTableView& table, const double* joint_position, uint8_t* levels);
+  static int classifyCompactScalar(const CompactBandView& table, const int32_t* keys);
+  static void compactKeysScalar(const double* joint_position, const double* scale, int number_of_joints, int32_t* keys);
+};
+
+#endif  // BAND_KERNEL_H_
@@ -0,0 +1,227 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "CompactLimitTable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+namespace {
+
+/// finite fixed-point edges have to stay within this range of keys, well inside the saturation of the positions
+const double kFixedRange = 1073741824.0;
+
+/**
+ * @brief Quantize a band edge to the float whose comparison changes closest to the edge
+ *
+ * fl(q) > c holds from the midpoint between c and the next float on and
+ * fl(q) < c up to the midpoint between the previous float and c, the
+ * deviation is the distance of that midpoint from the edge.
+ *
+ * @return false  if the edge is finite but beyond the float range
+ */
+bool quantizeFloatEdge(double edge, bool upper, int32_t& key, double& deviation) {
+  const float inf = std::numeric_limits<float>::infinity();
+  if (std::isinf(edge)) {
+    key = floatKey(static_cast<float>(edge));
+    deviation = 0.0;
+    return true;
+  }
+  if (std::fabs(edge) > std::numeric_limits<float>::max())
+    return false;
+  const float nearest = static_cast<float>(edge);
+  const float candidates[] = {std::nextafter(nearest, -inf), nearest, std::nextafter(nearest, inf)};
+  deviation = std::numeric_limits<double>::infinity();
+  for (int k=0; k<3; k++) {
+    const float neighbour = std::nextafter(candidates[k], upper ? -inf : inf);
+    const double threshold = 0.5 * (static_cast<double>(candidates[k]) + neighbour);
+    if (std::fabs(threshold - edge) < deviation) {
+      deviation = std::fabs(threshold - edge);
+      key = floatKey(candidates[k]);
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Quantize a band edge to the fixed-point key whose comparison changes closest to the edge
+ *
+ * round(q*scale) > k holds from q*scale = k+0.5 on and round(q*scale) < k up
+ * to q*scale = k-0.5, so the key is offset by half a unit away from the band.
+ *
+ * @return false  if the edge is finite but beyond the range of the keys
+ */
+bool quantizeFixedEdge(double edge, double scale, bool upper, int32_t& key, double& deviation) {
+  if (std::isinf(edge)) {
+    key = edge < 0.0 ? std::numeric_limits<int32_t>::min() : std::numeric_limits<int32_t>::max();
+    deviation = 0.0;
+    return true;
+  }
+  const double offset = upper ? 0.5 : -0.5;
+  const double nearest = std::floor(edge * scale + offset + 0.5);
+  if (!(std::fabs(nearest) <= kFixedRange))
+    return false;
+  key = static_cast<int32_t>(nearest);
+  deviation = std::fabs((nearest - offset) / scale - edge);
+  return true;
+}
+
+}  // namespace
+
+CompactLimitTable::CompactLimitTable()
+    : mode_(kFloat32),
+      quantization_error_(0.0),
+      isa_(BandKernel::detect()),
+      classify_(BandKernel::compactClassifyFunction(isa_)),
+      keys_(BandKernel::compactKeysFunction(isa_)) {
+  view_.bands = NULL;
+  view_.number_of_levels = 0;
+  view_.number_of_joints = 0;
+  view_.padded_joints = 0;
+  view_.nested = false;
+}
+
+CompactLimitTable::CompactLimitTable(const CompactLimitTable& other)
+    : bands_(other.bands_),
+      scale_(other.scale_),
+      view_(other.view_),
+      mode_(other.mode_),
+      quantization_error_(other.quantization_error_),
+      isa_(other.isa_),
+      classify_(other.classify_),
+      keys_(other.keys_) {
+  view_.bands = bands_.empty() ? NULL : &bands_[0];
+}
+
+CompactLimitTable& CompactLimitTable::operator=(const CompactLimitTable& other) {
+  bands_ = other.bands_;
+  scale_ = other.scale_;
+  view_ = other.view_;
+  view_.bands = bands_.empty() ? NULL : &bands_[0];
+  mode_ = other.mode_;
+  quantization_error_ = other.quantization_error_;
+  isa_ = other.isa_;
+  classify_ = other.classify_;
+  keys_ = other.keys_;
+  return *this;
+}
+
+bool CompactLimitTable::parseMode(const std::string& name, Mode& mode) {
+  if (name == "float32")
+    mode = kFloat32;
+  else if (name == "fixed32")
+    mode = kFixed32;
+  else
+    return false;
+  return true;
+}
+
+bool CompactLimitTable::build(const SingularityLimitTable& table, Mode mode, const std::vector<double>& resolution,
+                              double tolerance, std::string& error) {
+  const int n = table.number_of_joints();
+  const int levels = table.number_of_levels();
+  std::ostringstream message;
+  if (n <= 0 || n > kMaxJoints || table.periodic()) {
+    message << "compact limit table needs 1 to " << kMaxJoints << " joints that are not periodic";
+    error = message.str();
+    return false;
+  }
+  if (mode == kFixed32 && (resolution.size() != static_cast<std::size_t>(n) ||
+      std::count_if(resolution.begin(), resolution.end(),
+                    [](double r) { return r > 0.0 && std::isfinite(r); }) != n)) {
+    message << "fixed32 needs a positive resolution for each of the " << n << " joints";
+    error = message.str();
+    return false;
+  }
+  if (!(tolerance >= 0.0)) {
+    error = "quantization tolerance must not be negative";
+    return false;
+  }
+
+  const int width = BandKernel::kCompactWidth;
+  const int padded_joints = (n + width - 1) / width * width;
+  std::vector<int32_t, AlignedAllocator<int32_t, BandKernel::kCompactAlignment> > bands(2 * levels * padded_joints);
+  double worst = 0.0;
+  for (int l=1; l<=levels; l++) {
+    int32_t* lower = &bands[2 * (l - 1) * padded_joints];
+    int32_t* upper = lower + padded_joints;
+    for (int i=0; i<padded_joints; i++) {
+      // padding lanes get an empty band, like the padding of the double table
+      lower[i] = std::numeric_limits<int32_t>::max();
+      upper[i] = std::numeric_limits<int32_t>::min();
+    }
+    for (int i=0; i<n; i++) {
+      for (int side=0; side<2; side++) {
+        const double edge = side ? table.upper(l, i) : table.lower(l, i);
+        int32_t& key = side ? upper[i] : lower[i];
+        double deviation;
+        const bool quantized = mode == kFloat32 ? quantizeFloatEdge(edge, side, key, deviation)
+                                                : quantizeFixedEdge(edge, resolution[i], side, key, deviation);
+        const char* edge_name = side ? " upper" : " lower";
+        if (!quantized) {
+          message << "level " << l << edge_name << " edge of joint " << i << " is out of the range of the "
+                  << (mode == kFloat32 ? "float32" : "fixed32") << " keys";
+          error = message.str();
+          return false;
+        }
+        if (deviation > tolerance) {
+          message << "quantization moves the level " << l << edge_name << " edge of joint " << i << " by "
+                  << deviation << ", more than the tolerance of " << tolerance;
+          error = message.str();
+          return false;
+        }
+        worst = std::max(worst, deviation);
+      }
+    }
+  }
+
+  bands_.swap(bands);
+  scale_.assign(n, 1.0);
+  if (mode == kFixed32)
+    scale_ = resolution;
+  mode_ = mode;
+  quantization_error_ = worst;
+  view_.bands = &bands_[0];
+  view_.number_of_levels = levels;
+  view_.number_of_joints = n;
+  view_.padded_joints = padded_joints;
+  // quantization keeps the order of the edges, but equal keys may now nest bands that were not nested before
+  view_.nested = true;
+  for (int l=2; l<=levels; l++) {
+    for (int i=0; i<n; i++)
+      view_.nested &= bands_[row(l) + i] >= bands_[row(l-1) + i] &&
+                      bands_[row(l) + padded_joints + i] <= bands_[row(l-1) + padded_joints + i];
+  }
+  return true;
+}
+
+int CompactLimitTable::classify(const double* joint_position) const {
+  alignas(BandKernel::kCompactAlignment) int32_t keys[kMaxJoints];
+  keys_(joint_position, mode_ == kFixed32 ? &scale_[0] : NULL, view_.number_of_joints, keys);
+  return classify_(view_, keys);
+}
+
+int CompactLimitTable::classify(const float* joint_position) const {
+  alignas(BandKernel::kCompactAlignment) int32_t keys[kMaxJoints];
+  for (int i=0; i<view_.number_of_joints; i++)
+    keys[i] = floatKey(joint_position[i]);
+  return classifyKeys(keys);
+}
+
+int CompactLimitTable::classifyCounts(const int32_t* counts) const {
+  alignas(BandKernel::kCompactAlignment) int32_t keys[kMaxJoints];
+  std::memcpy(keys, counts, view_.number_of_joints * sizeof(int32_t));
+  return classifyKeys(keys);
+}
+
+void CompactLimitTable::setKernel(BandKernel::Isa isa) {
+  isa_ = BandKernel::isAvailable(isa) ? isa : BandKernel::kScalar;
+  classify_ = BandKernel::compactClassifyFunction(isa_);
+  keys_ = BandKernel::compactKeysFunction(isa_);
+}
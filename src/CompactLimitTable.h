@@ -0,0 +1,123 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef COMPACT_LIMIT_TABLE_H_
+#define COMPACT_LIMIT_TABLE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "AlignedAllocator.h"
+#include "BandKernel.h"
+#include "SingularityLimitTable.h"
+
+
+/**
+ * @brief Singularity level limits quantized to 32 bits, for controllers short of memory bandwidth
+ *
+ * Every limit is stored as an int32_t key, half the size of a double, so a
+ * SIMD register compares twice as many joints. In float32 mode the keys are
+ * the bit patterns of single precision floats remapped so that integer order
+ * is float order; in fixed32 mode they are fixed-point positions, e.g. encoder
+ * counts, at a given resolution per joint. Both are compared by the same
+ * integer kernels.
+ *
+ * Quantization can only change the band membership of positions close to a
+ * band edge. build() measures for every edge how far the quantized threshold
+ * lies from it and refuses the table when that exceeds the tolerance, so any
+ * finite position farther than quantization_error() from all edges is
+ * classified exactly like by the double table. Positions are converted to
+ * keys by SIMD kernels as well, fixed-point keys saturate beyond the edges.
+ */
+class CompactLimitTable {
+ public:
+  enum Mode { kFloat32 = 0, kFixed32 };
+  /// Highest number of joints, positions are converted on the stack
+  static const int kMaxJoints = 64;
+
+  CompactLimitTable();
+  CompactLimitTable(const CompactLimitTable& other);
+  CompactLimitTable& operator=(const CompactLimitTable& other);
+
+  /**
+   * @brief Parse the name of a numeric mode, "float32" or "fixed32"
+   *
+   * @return false  if the name is unknown
+   */
+  static bool parseMode(const std::string& name, Mode& mode);
+
+  /**
+   * @brief Quantize the limits of a table and check the quantization error
+   *
+   * @param table       limits to quantize, without periodic joints
+   * @param mode        numeric mode of the keys
+   * @param resolution  fixed32 only: number_of_joints() position units per key, e.g. encoder counts per radian
+   * @param tolerance   largest distance from a band edge at which quantization may change band membership
+   * @param error       description of the problem when the table cannot be quantized
+   * @return true   if the table has been built
+   * @return false  if the table has periodic or too many joints, the resolution is invalid, an edge is out of
+   *                the range of the keys or it moves by more than the tolerance
+   */
+  bool build(const SingularityLimitTable& table, Mode mode, const std::vector<double>& resolution, double tolerance,
+             std::string& error);
+
+  /**
+   * @brief Find the highest level of proximity to the singularity achieved by any axis
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions in the units of the double table
+   * @return int            index of the singularity level of the position, 0 if none
+   */
+  int classify(const double* joint_position) const;
+
+  /**
+   * @brief Classify single precision positions, float32 mode only
+   */
+  int classify(const float* joint_position) const;
+
+  /**
+   * @brief Classify fixed-point positions, e.g. raw encoder counts, fixed32 mode only
+   *
+   * @param counts  pointer to number_of_joints() positions in units of 1 / resolution,
+   *                INT32_MIN counts as outside of all bands
+   */
+  int classifyCounts(const int32_t* counts) const;
+
+  /**
+   * @brief Select the classification kernel, the scalar one if the CPU does not support the instruction set
+   */
+  void setKernel(BandKernel::Isa isa);
+  BandKernel::Isa kernel() const { return isa_; }
+
+  Mode mode() const { return mode_; }
+  /// Largest distance of a quantized threshold from its band edge
+  double quantization_error() const { return quantization_error_; }
+  int number_of_joints() const { return view_.number_of_joints; }
+  int number_of_levels() const { return view_.number_of_levels; }
+  bool nested() const { return view_.nested; }
+  const CompactBandView& view() const { return view_; }
+
+ private:
+  int row(int level) const { return 2 * (level - 1) * view_.padded_joints; }
+  int classifyKeys(int32_t* keys) const {
+    for (int i=view_.number_of_joints; i<view_.padded_joints; i++)
+      keys[i] = 0;
+    return classify_(view_, keys);
+  }
+
+  /// rows stored level after level like the double table: [level 1 lower | level 1 upper | level 2 lower | ...]
+  std::vector<int32_t, AlignedAllocator<int32_t, BandKernel::kCompactAlignment> > bands_;
+  /// keys per position unit of every joint in fixed32 mode
+  std::vector<double> scale_;
+  CompactBandView view_;
+  Mode mode_;
+  double quantization_error_;
+  BandKernel::Isa isa_;
+  BandKernel::CompactClassifyFunction classify_;
+  BandKernel::CompactKeysFunction keys_;
+};
+
+#endif  // COMPACT_LIMIT_TABLE_H_
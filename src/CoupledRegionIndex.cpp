@@ -0,0 +1,257 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "CoupledRegionIndex.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+#include "SingularityLimitTable.h"
+
+namespace {
+
+/// largest number of regions in a leaf
+const int kLeafSize = 4;
+/// depth from which no node is split any more, bounds the traversal stack
+const int kMaxDepth = 48;
+/// unconstrained bounds are clamped to this value when looking for a split
+const double kUnbounded = 1e6;
+
+double center(double lower, double upper) {
+  return 0.5 * (std::max(lower, -kUnbounded) + std::min(upper, kUnbounded));
+}
+
+}  // namespace
+
+CoupledRegionIndex::CoupledRegionIndex()
+    : number_of_joints_(0) {
+}
+
+bool CoupledRegionIndex::build(int number_of_joints, const std::vector<Region>& regions, std::string& error) {
+  const std::size_t n = number_of_joints;
+  for (std::size_t r=0; r<regions.size(); r++) {
+    const Region& region = regions[r];
+    std::ostringstream prefix;
+    prefix << "coupled region " << r << ": ";
+    if (region.level < 1 || region.level > SingularityLimitTable::kMaxLevels) {
+      prefix << "level must be between 1 and " << SingularityLimitTable::kMaxLevels;
+      error = prefix.str();
+      return false;
+    }
+    if (region.lower.size() != n || region.upper.size() != n) {
+      error = prefix.str() + "box has wrong size";
+      return false;
+    }
+    for (std::size_t i=0; i<n; i++) {
+      if (!(region.lower[i] < region.upper[i])) {
+        error = prefix.str() + "box is empty";
+        return false;
+      }
+    }
+    if (region.normals.size() != region.offsets.size() * n) {
+      error = prefix.str() + "half-space has wrong size";
+      return false;
+    }
+  }
+
+  number_of_joints_ = number_of_joints;
+  nodes_.clear();
+  node_lower_.clear();
+  node_upper_.clear();
+  levels_.clear();
+  lower_.clear();
+  upper_.clear();
+  halfspace_begin_.assign(1, 0);
+  normals_.clear();
+  offsets_.clear();
+  if (regions.empty())
+    return true;
+
+  std::vector<int> order(regions.size());
+  for (std::size_t r=0; r<regions.size(); r++)
+    order[r] = r;
+  buildNode(regions, order, 0, order.size(), 0);
+
+  // leaves address contiguous ranges of order, so store the regions in that order
+  for (std::size_t k=0; k<order.size(); k++) {
+    const Region& region = regions[order[k]];
+    levels_.push_back(region.level);
+    lower_.insert(lower_.end(), region.lower.begin(), region.lower.end());
+    upper_.insert(upper_.end(), region.upper.begin(), region.upper.end());
+    normals_.insert(normals_.end(), region.normals.begin(), region.normals.end());
+    offsets_.insert(offsets_.end(), region.offsets.begin(), region.offsets.end());
+    halfspace_begin_.push_back(offsets_.size());
+  }
+  return true;
+}
+
+int CoupledRegionIndex::buildNode(const std::vector<Region>& regions, std::vector<int>& order, int begin, int end,
+                                  int depth) {
+  const int n = number_of_joints_;
+  const int index = nodes_.size();
+  nodes_.push_back(Node());
+  node_lower_.resize((index + 1) * n, std::numeric_limits<double>::infinity());
+  node_upper_.resize((index + 1) * n, -std::numeric_limits<double>::infinity());
+  int max_level = 0;
+  for (int k=begin; k<end; k++) {
+    const Region& region = regions[order[k]];
+    max_level = std::max(max_level, region.level);
+    for (int i=0; i<n; i++) {
+      node_lower_[index * n + i] = std::min(node_lower_[index * n + i], region.lower[i]);
+      node_upper_[index * n + i] = std::max(node_upper_[index * n + i], region.upper[i]);
+    }
+  }
+  nodes_[index].max_level = max_level;
+  if (end - begin <= kLeafSize || depth >= kMaxDepth) {
+    nodes_[index].first = begin;
+    nodes_[index].count = end - begin;
+    return index;
+  }
+
+  // median split along the joint with the widest spread of region centers
+  int axis = 0;
+  double widest = -1.0;
+  for (int i=0; i<n; i++) {
+    double low = std::numeric_limits<double>::infinity();
+    double high = -std::numeric_limits<double>::infinity();
+    for (int k=begin; k<end; k++) {
+      const double c = center(regions[order[k]].lower[i], regions[order[k]].upper[i]);
+      low = std::min(low, c);
+      high = std::max(high, c);
+    }
+    if (high - low > widest) {
+      widest = high - low;
+      axis = i;
+    }
+  }
+  const int middle = begin + (end - begin) / 2;
+  std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](int a, int b) {
+    return center(regions[a].lower[axis], regions[a].upper[axis]) <
+           center(regions[b].lower[axis], regions[b].upper[axis]);
+  });
+  buildNode(regions, order, begin, middle, depth + 1);
+  const int right = buildNode(regions, order, middle, end, depth + 1);
+  nodes_[index].first = right;
+  nodes_[index].count = 0;
+  return index;
+}
+
+bool CoupledRegionIndex::load(std::istream& in, int number_of_joints, std::string& error) {
+  std::vector<Region> regions;
+  return parse(in, number_of_joints, regions, error) && build(number_of_joints, regions, error);
+}
+
+bool CoupledRegionIndex::parse(std::istream& in, int number_of_joints, std::vector<Region>& regions,
+                               std::string& error) {
+  bool open = false;
+  std::string line;
+  for (int line_number=1; std::getline(in, line); line_number++) {
+    const std::size_t comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+    std::istringstream words(line);
+    std::string keyword;
+    if (!(words >> keyword))
+      continue;
+
+    std::ostringstream prefix;
+    prefix << "coupled regions line " << line_number << ": ";
+    bool valid = true;
+    if (keyword == "region") {
+      Region region;
+      valid = !open && (words >> region.level);
+      region.lower.assign(number_of_joints, -std::numeric_limits<double>::infinity());
+      region.upper.assign(number_of_joints, std::numeric_limits<double>::infinity());
+      regions.push_back(region);
+      open = true;
+    } else if (keyword == "box") {
+      int joint;
+      double lower, upper;
+      valid = open && (words >> joint >> lower >> upper) && joint >= 0 && joint < number_of_joints;
+      if (valid) {
+        regions.back().lower[joint] = lower;
+        regions.back().upper[joint] = upper;
+      }
+    } else if (keyword == "halfspace") {
+      valid = open;
+      double coefficient;
+      for (int i=0; valid && i<=number_of_joints; i++) {
+        valid = static_cast<bool>(words >> coefficient);
+        if (valid && i < number_of_joints)
+          regions.back().normals.push_back(coefficient);
+        else if (valid)
+          regions.back().offsets.push_back(coefficient);
+      }
+    } else if (keyword == "end") {
+      valid = open;
+      open = false;
+    } else {
+      valid = false;
+    }
+    std::string rest;
+    if (!valid || (words >> rest)) {
+      error = prefix.str() + "unexpected \"" + line + "\"";
+      return false;
+    }
+  }
+  if (open) {
+    error = "coupled regions: missing end of the last region";
+    return false;
+  }
+  return true;
+}
+
+bool CoupledRegionIndex::inside(int region, const double* joint_position) const {
+  const int n = number_of_joints_;
+  const double* lower = &lower_[region * n];
+  const double* upper = &upper_[region * n];
+  bool holds = true;
+  for (int i=0; i<n; i++)
+    holds &= joint_position[i] > lower[i] && joint_position[i] < upper[i];
+  for (int h=halfspace_begin_[region]; holds && h<halfspace_begin_[region+1]; h++) {
+    const double* normal = &normals_[h * n];
+    double dot = 0.0;
+    for (int i=0; i<n; i++)
+      dot += normal[i] * joint_position[i];
+    holds = dot < offsets_[h];
+  }
+  return holds;
+}
+
+int CoupledRegionIndex::classify(const double* joint_position) const {
+  if (nodes_.empty())
+    return 0;
+  const int n = number_of_joints_;
+  // depth first, one pending right child per level of the hierarchy
+  int stack[kMaxDepth + 2];
+  int top = 0;
+  stack[top++] = 0;
+  int best = 0;
+  while (top > 0) {
+    const int index = stack[--top];
+    const Node& node = nodes_[index];
+    if (node.max_level <= best)
+      continue;
+    const double* lower = &node_lower_[index * n];
+    const double* upper = &node_upper_[index * n];
+    bool holds = true;
+    for (int i=0; i<n; i++)
+      holds &= joint_position[i] > lower[i] && joint_position[i] < upper[i];
+    if (!holds)
+      continue;
+    if (node.count > 0) {
+      for (int r=node.first; r<node.first+node.count; r++) {
+        if (levels_[r] > best && inside(r, joint_position))
+          best = levels_[r];
+      }
+    } else {
+      stack[top++] = node.first;
+      stack[top++] = index + 1;
+    }
+  }
+  return best;
+}
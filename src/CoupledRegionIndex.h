@@ -0,0 +1,120 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef COUPLED_REGION_INDEX_H_
+#define COUPLED_REGION_INDEX_H_
+
+#include <istream>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief Singularity regions over several joints at once, stored in a bounding volume hierarchy
+ *
+ * A region is the intersection of a box over the joints (joints without
+ * bounds are unconstrained) and of any number of half-spaces a*q < b. A
+ * position inside a region is at least at the level of the region. Regions
+ * are kept in a flat BVH over their boxes, so a query visits only the
+ * branches whose bounds hold the position and may still raise the level.
+ *
+ * Text format read by load(), '#' starts a comment:
+ * @code
+ * region <level>
+ *   box <joint> <lower> <upper>
+ *   halfspace <a_0> ... <a_n-1> <b>
+ * end
+ * @endcode
+ */
+class CoupledRegionIndex {
+ public:
+  /// Description of one region over number_of_joints joints
+  struct Region {
+    int level;
+    /// box bounds of every joint, -inf / +inf for unconstrained joints
+    std::vector<double> lower;
+    std::vector<double> upper;
+    /// number_of_joints coefficients per half-space, row after row
+    std::vector<double> normals;
+    std::vector<double> offsets;
+  };
+
+  CoupledRegionIndex();
+
+  /**
+   * @brief Build the index of the given regions
+   *
+   * @param number_of_joints  number of robot joints
+   * @param regions           regions to index
+   * @param error             description of the first invalid region
+   * @return true   if the index has been built
+   * @return false  if any region has wrong size or level
+   */
+  bool build(int number_of_joints, const std::vector<Region>& regions, std::string& error);
+
+  /**
+   * @brief Parse regions in the text format and build the index of them
+   *
+   * @param in                stream to parse
+   * @param number_of_joints  number of robot joints
+   * @param error             description and line of the first error
+   * @return true   if the index has been built
+   * @return false  if the stream is malformed or any region is invalid
+   */
+  bool load(std::istream& in, int number_of_joints, std::string& error);
+
+  /**
+   * @brief Parse regions in the text format without indexing them
+   *
+   * @param in                stream to parse
+   * @param number_of_joints  number of robot joints
+   * @param regions           parsed regions, appended to
+   * @param error             description and line of the first error
+   * @return true   if the stream is well formed
+   * @return false  otherwise
+   */
+  static bool parse(std::istream& in, int number_of_joints, std::vector<Region>& regions, std::string& error);
+
+  /**
+   * @brief Find the highest level of all regions holding the position
+   *
+   * @param joint_position  pointer to number_of_joints joint positions
+   * @return int            index of the singularity level, 0 if no region holds the position
+   */
+  int classify(const double* joint_position) const;
+
+  bool empty() const { return levels_.empty(); }
+  /// Highest level of all regions, 0 if there are none
+  int max_level() const { return nodes_.empty() ? 0 : nodes_[0].max_level; }
+  int size() const { return static_cast<int>(levels_.size()); }
+
+ private:
+  /// inner nodes have count 0, their left child follows them and the right one is at first
+  struct Node {
+    int first;
+    int count;
+    int max_level;
+  };
+
+  int buildNode(const std::vector<Region>& regions, std::vector<int>& order, int begin, int end, int depth);
+  bool inside(int region, const double* joint_position) const;
+
+  int number_of_joints_;
+  std::vector<Node> nodes_;
+  /// bounds of the node boxes, number_of_joints_ per node
+  std::vector<double> node_lower_;
+  std::vector<double> node_upper_;
+  /// regions sorted by leaf, bounds number_of_joints_ per region
+  std::vector<int> levels_;
+  std::vector<double> lower_;
+  std::vector<double> upper_;
+  /// half-spaces of region r are [halfspace_begin_[r], halfspace_begin_[r+1])
+  std::vector<int> halfspace_begin_;
+  std::vector<double> normals_;
+  std::vector<double> offsets_;
+};
+
+#endif  // COUPLED_REGION_INDEX_H_
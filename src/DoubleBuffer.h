@@ -0,0 +1,108 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef DOUBLE_BUFFER_H_
+#define DOUBLE_BUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+
+/**
+ * @brief Two copies of a value, refilled by one writer thread while the readers keep using the other
+ *
+ * The writer fills the unpublished slot and publishes it with a single
+ * index store. The periodic reader takes the published slot for one cycle
+ * with acquire() and hands it back with release(); any number of other
+ * threads pin it for the duration of a query with pin(). Neither ever
+ * blocks. A slot is handed to the writer again only once the periodic
+ * reader does not hold it and no query pins it any more, so no reader sees a
+ * value being modified, and a reader which is stopped or not stepped never
+ * holds the writer up. Writers have to be serialized by the caller.
+ */
+template <typename T>
+class DoubleBuffer {
+ public:
+  DoubleBuffer() : published_(0), in_use_(kNone) {
+    pins_[0].store(0);
+    pins_[1].store(0);
+    versions_[0] = versions_[1] = 0;
+  }
+
+  /// Writer side: slot to fill before publish(), NULL while a reader may still use it
+  T* beginWrite() {
+    const int published = published_.load(std::memory_order_relaxed);
+    if (in_use_.load() == 1 - published || pins_[1 - published].load() != 0)
+      return NULL;
+    return &slots_[1 - published];
+  }
+
+  /// Writer side: hand the slot returned by beginWrite() to the readers
+  void publish() {
+    const int published = published_.load(std::memory_order_relaxed);
+    versions_[1 - published] = versions_[published] + 1;
+    published_.store(1 - published);
+  }
+
+  /// Writer side: the last published value, which the writer never modifies
+  const T& published() const { return slots_[published_.load(std::memory_order_relaxed)]; }
+  /// Writer side: number of publish() calls up to the last published value
+  uint64_t version() const { return versions_[published_.load(std::memory_order_relaxed)]; }
+
+  /**
+   * @brief Periodic reader: take the last published value, valid until release()
+   *
+   * @param version   number of publish() calls up to the value, which tells a refilled slot from the one held before
+   */
+  const T& acquire(uint64_t& version) {
+    for (;;) {
+      const int published = published_.load();
+      in_use_.store(published);
+      // the writer may have published the other slot meanwhile and be refilling this one
+      if (published_.load() == published) {
+        version = versions_[published];
+        return slots_[published];
+      }
+    }
+  }
+
+  /// Periodic reader: hand the value of acquire() back, e.g. at the end of a cycle
+  void release() { in_use_.store(kNone, std::memory_order_release); }
+
+  /**
+   * @brief Any thread: pin the last published value until unpin()
+   *
+   * @param slot  number of the pinned slot, to be passed to unpin()
+   */
+  const T& pin(int& slot) const {
+    for (;;) {
+      slot = published_.load();
+      pins_[slot].fetch_add(1);
+      // the writer may have published the other slot meanwhile and be refilling this one
+      if (published_.load() == slot)
+        return slots_[slot];
+      pins_[slot].fetch_sub(1);
+    }
+  }
+
+  void unpin(int slot) const { pins_[slot].fetch_sub(1, std::memory_order_release); }
+
+ private:
+  /// in_use_ while the periodic reader holds no slot
+  static const int kNone = -1;
+
+  T slots_[2];
+  /// version of every slot, written by the writer before the slot is published
+  uint64_t versions_[2];
+  std::atomic<int> published_;
+  /// slot held by the periodic reader, kNone between two cycles
+  std::atomic<int> in_use_;
+  /// number of queries pinning every slot
+  mutable std::atomic<int> pins_[2];
+};
+
+#endif  // DOUBLE_BUFFER_H_
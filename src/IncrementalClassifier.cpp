@@ -0,0 +1,42 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "IncrementalClassifier.h"
+
+#include <cmath>
+
+IncrementalClassifier::IncrementalClassifier()
+    : valid_(false) {
+}
+
+void IncrementalClassifier::reset(int number_of_joints) {
+  valid_ = false;
+  position_.assign(number_of_joints, 0.0);
+  margins_.assign(number_of_joints, 0.0);
+}
+
+bool IncrementalClassifier::needsUpdate(const double* joint_position) const {
+  if (!valid_)
+    return true;
+  bool moved = false;
+  for (size_t i=0; i<position_.size(); i++)
+    moved |= !(std::fabs(joint_position[i] - position_[i]) < margins_[i]);
+  return moved;
+}
+
+void IncrementalClassifier::update(const double* joint_position, const SingularityLimitTable& table) {
+  for (size_t i=0; i<position_.size(); i++)
+    position_[i] = joint_position[i];
+  table.edgeMargins(joint_position, &margins_[0]);
+  valid_ = true;
+}
+
+void IncrementalClassifier::update(const double* joint_position, const BandEdgeCache& edges) {
+  for (size_t i=0; i<position_.size(); i++)
+    position_[i] = joint_position[i];
+  edges.edgeMargins(joint_position, &margins_[0]);
+  valid_ = true;
+}
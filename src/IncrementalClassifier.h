@@ -0,0 +1,71 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef INCREMENTAL_CLASSIFIER_H_
+#define INCREMENTAL_CLASSIFIER_H_
+
+#include <vector>
+
+#include "BandEdgeCache.h"
+#include "SingularityLimitTable.h"
+
+
+/**
+ * @brief Skip test for positions that cannot have changed their singularity level
+ *
+ * Remembers the last classified position together with the distance of every
+ * joint to its closest band edge. A new position needs to be classified again
+ * only once some joint has moved at least by its margin.
+ */
+class IncrementalClassifier {
+ public:
+  IncrementalClassifier();
+
+  /**
+   * @brief Preallocate the buffers and forget the last classified position
+   *
+   * @param number_of_joints  number of robot joints
+   */
+  void reset(int number_of_joints);
+
+  /// Forget the last classified position without touching the buffers, e.g. after the limits changed
+  void invalidate() { valid_ = false; }
+
+  /**
+   * @brief Check whether a position may lie in another cell than the last classified one
+   *
+   * @param joint_position  pointer to number_of_joints joint positions
+   * @return true   if the position has to be classified
+   * @return false  if its level is the last classified one
+   */
+  bool needsUpdate(const double* joint_position) const;
+
+  /**
+   * @brief Remember a classified position and its margins to the band edges
+   *
+   * @param joint_position  pointer to number_of_joints joint positions
+   * @param table           limit table the position has been classified against
+   */
+  void update(const double* joint_position, const SingularityLimitTable& table);
+
+  /**
+   * @brief Remember a classified position and its margins to the cached level transitions
+   *
+   * The margins skip the edges the level of their joint does not change at,
+   * so positions are classified again less often than with the table.
+   *
+   * @param joint_position  pointer to number_of_joints joint positions
+   * @param edges           edge cache of the limit table the position has been classified against
+   */
+  void update(const double* joint_position, const BandEdgeCache& edges);
+
+ private:
+  bool valid_;
+  std::vector<double> position_;
+  std::vector<double> margins_;
+};
+
+#endif  // INCREMENTAL_CLASSIFIER_H_
@@ -0,0 +1,177 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "JointGroupPool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+/// tell the core that the thread is polling, so a sibling hyperthread gets the pipeline
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+bool pinThread(std::thread& thread, int cpu, std::string& error) {
+#ifdef __linux__
+  if (cpu >= CPU_SETSIZE) {
+    error = "joint group worker CPU " + std::to_string(cpu) + " out of range";
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0) {
+    error = "cannot pin joint group worker to CPU " + std::to_string(cpu);
+    return false;
+  }
+  return true;
+#else
+  (void)thread;
+  error = "joint group workers are pinned to CPUs only on Linux, CPU " + std::to_string(cpu);
+  return false;
+#endif
+}
+
+}  // namespace
+
+const std::chrono::milliseconds JointGroupPool::kSpinTime(10);
+
+JointGroupPool::JointGroupPool()
+    : task_(NULL),
+      context_(NULL),
+      runs_(0),
+      generation_(0),
+      remaining_(0),
+      running_(false),
+      sleepers_(0) {
+}
+
+JointGroupPool::~JointGroupPool() {
+  stop();
+}
+
+bool JointGroupPool::start(int number_of_tasks, const std::vector<int>& cpus, Task task, void* context,
+                           std::string& error) {
+  stop();
+  const int number_of_queues = cpus.size() + 1;
+  std::vector<Queue, AlignedAllocator<Queue, kCacheLine> > queues(number_of_queues);
+  for (int q=0; q<number_of_queues; q++) {
+    // contiguous blocks, neighbouring tasks share more of their data than distant ones
+    queues[q].begin = q * number_of_tasks / number_of_queues;
+    queues[q].end = (q + 1) * number_of_tasks / number_of_queues;
+    queues[q].cursor.store(queues[q].end, std::memory_order_relaxed);
+  }
+  queues_.swap(queues);
+  std::vector<Result, AlignedAllocator<Result, kCacheLine> > results(number_of_tasks > 0 ? number_of_tasks : 0);
+  for (std::size_t t=0; t<results.size(); t++)
+    results[t].value = 0;
+  results_.swap(results);
+  task_ = task;
+  context_ = context;
+  runs_ = 0;
+  generation_.store(0);
+  remaining_.store(0);
+  running_.store(true);
+  for (std::size_t w=0; w<cpus.size(); w++) {
+    threads_.push_back(std::thread(&JointGroupPool::worker, this, static_cast<int>(w + 1)));
+    if (cpus[w] >= 0 && !pinThread(threads_.back(), cpus[w], error)) {
+      stop();
+      return false;
+    }
+  }
+  return true;
+}
+
+void JointGroupPool::stop() {
+  if (threads_.empty())
+    return;
+  running_.store(false);
+  {
+    // taken so that a worker between its last check and its wait cannot miss the notification
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_.notify_all();
+  }
+  for (std::size_t w=0; w<threads_.size(); w++)
+    threads_[w].join();
+  threads_.clear();
+}
+
+void JointGroupPool::run() {
+  if (threads_.empty()) {
+    // nothing to share the tasks with, skip the atomics
+    for (std::size_t t=0; t<results_.size(); t++)
+      results_[t].value = task_(context_, t);
+    return;
+  }
+  const uint32_t generation = ++runs_;
+  for (std::size_t q=0; q<queues_.size(); q++)
+    queues_[q].cursor.store(static_cast<uint64_t>(generation) << 32 | queues_[q].begin, std::memory_order_relaxed);
+  remaining_.store(results_.size(), std::memory_order_relaxed);
+  generation_.store(generation);
+  // a worker counts itself as sleeping before its last look at the generation, so one of both sees the other
+  if (sleepers_.load() > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_.notify_all();
+  }
+  work(0, generation);
+  while (remaining_.load(std::memory_order_acquire) > 0)
+    cpuRelax();
+}
+
+int JointGroupPool::claim(int queue, uint32_t generation) {
+  Queue& q = queues_[queue];
+  uint64_t cursor = q.cursor.load(std::memory_order_acquire);
+  // a worker still looking for work of an earlier run finds another generation and leaves the queue alone
+  while (static_cast<uint32_t>(cursor >> 32) == generation && static_cast<int>(cursor & 0xffffffffu) < q.end) {
+    if (q.cursor.compare_exchange_weak(cursor, cursor + 1, std::memory_order_acquire))
+      return static_cast<int>(cursor & 0xffffffffu);
+  }
+  return -1;
+}
+
+void JointGroupPool::work(int queue, uint32_t generation) {
+  const int number_of_queues = queues_.size();
+  // own queue first, then steal from the others in turn
+  for (int k=0; k<number_of_queues; k++) {
+    const int victim = (queue + k) % number_of_queues;
+    for (int t=claim(victim, generation); t>=0; t=claim(victim, generation)) {
+      results_[t].value = task_(context_, t);
+      remaining_.fetch_sub(1, std::memory_order_release);
+    }
+  }
+}
+
+void JointGroupPool::worker(int queue) {
+  uint32_t seen = 0;
+  std::chrono::steady_clock::time_point idle_since = std::chrono::steady_clock::now();
+  while (running_.load(std::memory_order_acquire)) {
+    const uint32_t generation = generation_.load(std::memory_order_acquire);
+    if (generation != seen) {
+      seen = generation;
+      work(queue, generation);
+      idle_since = std::chrono::steady_clock::now();
+      continue;
+    }
+    if (std::chrono::steady_clock::now() - idle_since < kSpinTime) {
+      cpuRelax();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleepers_.fetch_add(1);
+    while (generation_.load() == seen && running_.load())
+      wake_.wait(lock);
+    sleepers_.fetch_sub(1);
+    idle_since = std::chrono::steady_clock::now();
+  }
+}
@@ -0,0 +1,106 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef JOINT_GROUP_POOL_H_
+#define JOINT_GROUP_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AlignedAllocator.h"
+
+
+/**
+ * @brief Fixed pool of worker threads running the same set of tasks, e.g. joint groups, once per cycle
+ *
+ * The tasks are split into one queue per worker and one for the thread
+ * calling run(), which works along. Every thread drains its own queue first,
+ * so a task keeps running on the same core with its data in that core's
+ * cache, and then steals from the other queues, so tasks of uneven cost do
+ * not leave threads idle. run() returns once all tasks are done, without
+ * allocating; it takes a lock only to wake workers which went to sleep after
+ * kSpinTime without work, i.e. never while the cycles keep coming.
+ */
+class JointGroupPool {
+ public:
+  /// Runs the task of the given index and returns its result, e.g. the level of a joint group
+  typedef int (*Task)(void* context, int task);
+  static const std::size_t kCacheLine = 64;
+  /// Time a worker polls for the next run before it blocks, longer than any control period
+  static const std::chrono::milliseconds kSpinTime;
+
+  JointGroupPool();
+  ~JointGroupPool();
+
+  /**
+   * @brief Start the workers, not to be called from the real-time thread
+   *
+   * @param number_of_tasks   number of tasks of every run()
+   * @param cpus              CPU every worker is pinned to, -1 for a worker that is not pinned;
+   *                          empty to run all tasks in the calling thread
+   * @param task              function running one task
+   * @param context           passed to every call of task
+   * @param error             description of the problem when the pool cannot be started
+   * @return true   if the pool is ready to run
+   * @return false  if a worker cannot be pinned to its CPU
+   */
+  bool start(int number_of_tasks, const std::vector<int>& cpus, Task task, void* context, std::string& error);
+
+  /// Stop and join the workers
+  void stop();
+
+  /**
+   * @brief Real-time side: run every task once and wait for all of them
+   */
+  void run();
+
+  /// Result of a task in the last run()
+  int result(int task) const { return results_[task].value; }
+  int number_of_tasks() const { return results_.size(); }
+  int number_of_workers() const { return threads_.size(); }
+
+ private:
+  JointGroupPool(const JointGroupPool&);
+  JointGroupPool& operator=(const JointGroupPool&);
+
+  /// tasks [begin, end) of one thread; the cursor holds the generation of the run above the next task
+  struct alignas(kCacheLine) Queue {
+    std::atomic<uint64_t> cursor;
+    int begin;
+    int end;
+  };
+  /// a cache line per result, so that threads finishing neighbouring tasks do not share one
+  struct alignas(kCacheLine) Result {
+    int value;
+  };
+
+  int claim(int queue, uint32_t generation);
+  void work(int queue, uint32_t generation);
+  void worker(int queue);
+
+  std::vector<Queue, AlignedAllocator<Queue, kCacheLine> > queues_;
+  std::vector<Result, AlignedAllocator<Result, kCacheLine> > results_;
+  std::vector<std::thread> threads_;
+  Task task_;
+  void* context_;
+  /// number of the last run, touched only by the thread calling run()
+  uint32_t runs_;
+  alignas(kCacheLine) std::atomic<uint32_t> generation_;
+  std::atomic<int> remaining_;
+  alignas(kCacheLine) std::atomic<bool> running_;
+  std::atomic<int> sleepers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+};
+
+#endif  // JOINT_GROUP_POOL_H_
@@ -0,0 +1,114 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "LatencyRecorder.h"
+
+#include <algorithm>
+#include <limits>
+
+LatencyHistogram::LatencyHistogram() {
+  for (int b=0; b<kBins; b++)
+    counts_[b].store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+  min_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bin(uint64_t nanoseconds) {
+  if (nanoseconds < 2 * kSubBins)
+    return static_cast<int>(nanoseconds);
+  // 63 - clz is the index of the highest set bit, at least 6 here
+  const int shift = 63 - __builtin_clzll(nanoseconds) - 5;
+  const int b = 2 * kSubBins + (shift - 1) * kSubBins + static_cast<int>((nanoseconds >> shift) - kSubBins);
+  return b < kBins ? b : kBins - 1;
+}
+
+uint64_t LatencyHistogram::upperBound(int bin) {
+  if (bin < 2 * kSubBins)
+    return bin;
+  const int shift = (bin - 2 * kSubBins) / kSubBins + 1;
+  const uint64_t mantissa = (bin - 2 * kSubBins) % kSubBins + kSubBins;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+  // single writer: plain read-modify-store sequences are enough
+  std::atomic<uint32_t>& counter = counts_[bin(nanoseconds)];
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  if (nanoseconds < min_.load(std::memory_order_relaxed))
+    min_.store(nanoseconds, std::memory_order_relaxed);
+  if (nanoseconds > max_.load(std::memory_order_relaxed))
+    max_.store(nanoseconds, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::clear() {
+  for (int b=0; b<kBins; b++)
+    counts_[b].store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+  min_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::percentile(const uint32_t* counts, uint64_t count, double fraction) const {
+  const uint64_t rank = static_cast<uint64_t>(fraction * count);
+  uint64_t seen = 0;
+  for (int b=0; b<kBins; b++) {
+    seen += counts[b];
+    // the bound of the last bin is not one of longer durations, at most the longest one is reported
+    if (seen > rank)
+      return std::min(upperBound(b), max_.load(std::memory_order_relaxed)) * 1e-3;
+  }
+  return max_.load(std::memory_order_relaxed) * 1e-3;
+}
+
+LatencyHistogram::Summary LatencyHistogram::summary() const {
+  // a snapshot of the counts keeps all percentiles consistent with each other
+  uint32_t counts[kBins];
+  uint64_t count = 0;
+  for (int b=0; b<kBins; b++) {
+    counts[b] = counts_[b].load(std::memory_order_relaxed);
+    count += counts[b];
+  }
+  Summary summary;
+  summary.count = count;
+  if (count == 0) {
+    summary.min = summary.p50 = summary.p90 = summary.p99 = summary.p999 = summary.max = 0.0;
+    return summary;
+  }
+  summary.min = min_.load(std::memory_order_relaxed) * 1e-3;
+  summary.p50 = percentile(counts, count, 0.5);
+  summary.p90 = percentile(counts, count, 0.9);
+  summary.p99 = percentile(counts, count, 0.99);
+  summary.p999 = percentile(counts, count, 0.999);
+  summary.max = max_.load(std::memory_order_relaxed) * 1e-3;
+  return summary;
+}
+
+LatencyRecorder::LatencyRecorder()
+    : clear_requested_(false) {
+}
+
+void LatencyRecorder::reset(std::size_t ring_capacity) {
+  samples_.reset(ring_capacity);
+  cycle_.clear();
+  sample_to_output_.clear();
+  clear_requested_.store(false, std::memory_order_relaxed);
+}
+
+void LatencyRecorder::record(int64_t cycle_ns, int64_t sample_to_output_ns) {
+  if (clear_requested_.exchange(false, std::memory_order_acquire)) {
+    cycle_.clear();
+    sample_to_output_.clear();
+  }
+  cycle_.record(cycle_ns > 0 ? cycle_ns : 0);
+  if (sample_to_output_ns >= 0)
+    sample_to_output_.record(sample_to_output_ns);
+  Sample sample;
+  sample.cycle_ns = cycle_ns;
+  sample.sample_to_output_ns = sample_to_output_ns;
+  samples_.push(sample);
+}
@@ -0,0 +1,92 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef LATENCY_RECORDER_H_
+#define LATENCY_RECORDER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+#include "SpscRing.h"
+
+
+/**
+ * @brief Histogram of durations with constant-time, lock-free recording
+ *
+ * Durations below 64 ns get a bin each, longer ones one of 32 bins per power
+ * of two, so every recorded value is known within about 3 %. Recorded by one
+ * thread, read by any.
+ */
+class LatencyHistogram {
+ public:
+  struct Summary {
+    uint64_t count;
+    /// durations in microseconds
+    double min, p50, p90, p99, p999, max;
+  };
+
+  LatencyHistogram();
+
+  void record(uint64_t nanoseconds);
+  /// Forget all recorded durations, to be called by the recording thread
+  void clear();
+  /// Percentiles of all recorded durations, constant time and allocation-free
+  Summary summary() const;
+
+ private:
+  static const int kSubBins = 32;
+  static const int kBins = 2 * kSubBins + 35 * kSubBins;
+
+  static int bin(uint64_t nanoseconds);
+  /// largest duration of a bin
+  static uint64_t upperBound(int bin);
+  double percentile(const uint32_t* counts, uint64_t count, double fraction) const;
+
+  std::atomic<uint32_t> counts_[kBins];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> min_;
+  std::atomic<uint64_t> max_;
+};
+
+/**
+ * @brief Records per-cycle execution time and sample-to-output latency of updateHook()
+ *
+ * Every cycle updates two LatencyHistograms and appends the raw sample to a
+ * lock-free ring a non real-time thread can drain.
+ */
+class LatencyRecorder {
+ public:
+  struct Sample {
+    /// execution time of the cycle
+    int64_t cycle_ns;
+    /// time from reading a new joint position to writing its level, -1 without a new position
+    int64_t sample_to_output_ns;
+  };
+
+  LatencyRecorder();
+
+  /// Allocate the sample ring, not thread-safe
+  void reset(std::size_t ring_capacity);
+  /// Called once per cycle by the real-time thread
+  void record(int64_t cycle_ns, int64_t sample_to_output_ns);
+  /// Ask the real-time thread to clear the histograms on its next record()
+  void requestClear() { clear_requested_.store(true, std::memory_order_release); }
+  /// Consumer side of the sample ring
+  bool pop(Sample& sample) { return samples_.pop(sample); }
+  std::size_t dropped() const { return samples_.dropped(); }
+
+  const LatencyHistogram& cycle() const { return cycle_; }
+  const LatencyHistogram& sample_to_output() const { return sample_to_output_; }
+
+ private:
+  LatencyHistogram cycle_;
+  LatencyHistogram sample_to_output_;
+  SpscRing<Sample> samples_;
+  std::atomic<bool> clear_requested_;
+};
+
+#endif  // LATENCY_RECORDER_H_
@@ -0,0 +1,61 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "LevelFilter.h"
+
+LevelFilter::LevelFilter()
+    : min_dwell_(0.0),
+      valid_(false),
+      level_(0),
+      pending_level_(0),
+      pending_since_(0.0),
+      transitions_(0) {
+}
+
+void LevelFilter::configure(double min_dwell) {
+  min_dwell_ = min_dwell > 0.0 ? min_dwell : 0.0;
+  reset();
+}
+
+void LevelFilter::reset() {
+  valid_ = false;
+  level_ = 0;
+  pending_level_ = 0;
+  pending_since_ = 0.0;
+  transitions_ = 0;
+}
+
+int LevelFilter::update(int raw_level, int released_level, double now) {
+  if (!valid_) {
+    valid_ = true;
+    level_ = raw_level;
+    pending_level_ = raw_level;
+    return level_;
+  }
+  if (raw_level >= level_) {
+    // escalation is never delayed
+    if (raw_level > level_)
+      transitions_++;
+    level_ = raw_level;
+    pending_level_ = level_;
+    return level_;
+  }
+  // the widened bands hold the position at least at its raw level
+  const int target = released_level < raw_level ? raw_level : released_level;
+  if (target >= level_) {
+    pending_level_ = level_;
+    return level_;
+  }
+  // the dwell time runs from the first cycle below the current level
+  if (pending_level_ == level_)
+    pending_since_ = now;
+  pending_level_ = target;
+  if (now - pending_since_ >= min_dwell_) {
+    level_ = pending_level_;
+    transitions_++;
+  }
+  return level_;
+}
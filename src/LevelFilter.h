@@ -0,0 +1,56 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef LEVEL_FILTER_H_
+#define LEVEL_FILTER_H_
+
+
+/**
+ * @brief Hysteresis and debounce state machine on the singularity level
+ *
+ * A higher level is always taken over at once, so the robot is never slowed
+ * down too late. A lower level is taken over only once the position has left
+ * the band of the current level widened by the hysteresis margin and has
+ * stayed below it for the minimum dwell time. Every update is constant time.
+ */
+class LevelFilter {
+ public:
+  LevelFilter();
+
+  /**
+   * @param min_dwell   time [s] a lower level has to persist before it is taken over, 0 for none
+   */
+  void configure(double min_dwell);
+
+  /// Forget the filtered level, the next update takes over the raw one
+  void reset();
+
+  /**
+   * @brief Feed a new classification and get the filtered level
+   *
+   * @param raw_level       level of the position against the original bands
+   * @param released_level  level of the position against the bands widened by the hysteresis margin
+   * @param now             time of the position [s], non-decreasing
+   * @return int            filtered index of the singularity level
+   */
+  int update(int raw_level, int released_level, double now);
+
+  int level() const { return level_; }
+  double min_dwell() const { return min_dwell_; }
+  /// Number of level changes of the filtered output since reset()
+  unsigned transitions() const { return transitions_; }
+
+ private:
+  double min_dwell_;
+  bool valid_;
+  int level_;
+  /// lower level waiting for the dwell time to pass, equal to level_ when none
+  int pending_level_;
+  double pending_since_;
+  unsigned transitions_;
+};
+
+#endif  // LEVEL_FILTER_H_
@@ -0,0 +1,356 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "LimitTableCompiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+namespace {
+
+const char kCacheMagic[8] = {'S', 'D', 'L', 'T', 'A', 'B', '\0', '\0'};
+const uint64_t kFnvOffset = 14695981039346656037ull;
+const uint64_t kFnvPrime = 1099511628211ull;
+/// longest warning read back from a cache file
+const uint32_t kMaxStringLength = 4096;
+
+/// fixed-size start of a cache file, followed by the bands and the periods of the source, the warnings, the tables
+/// and the edge cache, closed by the FNV-1a checksum of everything before it
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t number_of_joints;
+  uint32_t number_of_levels;
+  uint32_t number_of_periods;
+  uint32_t require_nested;
+  uint32_t reserved;
+  uint64_t key;
+  double hysteresis;
+};
+
+uint64_t fnv1a(uint64_t hash, const void* data, std::size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (std::size_t k=0; k<size; k++)
+    hash = (hash ^ bytes[k]) * kFnvPrime;
+  return hash;
+}
+
+uint64_t fnv1a(uint64_t hash, const std::vector<double>& values) {
+  const uint64_t size = values.size();
+  hash = fnv1a(hash, &size, sizeof(size));
+  return values.empty() ? hash : fnv1a(hash, &values[0], values.size() * sizeof(double));
+}
+
+bool anyPeriodic(const std::vector<double>& periods) {
+  return std::count(periods.begin(), periods.end(), 0.0) != static_cast<long>(periods.size());
+}
+
+/**
+ * @brief Read values stored in a cache file and compare them to the expected ones
+ */
+bool readMatching(std::FILE* file, const std::vector<double>& expected) {
+  std::vector<double> values(expected.size());
+  return values.empty() || (std::fread(&values[0], sizeof(double), values.size(), file) == values.size() &&
+                            std::memcmp(&values[0], &expected[0], values.size() * sizeof(double)) == 0);
+}
+
+/// length of every string, then its characters
+bool writeStrings(std::FILE* file, const std::vector<std::string>& strings) {
+  const uint32_t count = strings.size();
+  bool written = std::fwrite(&count, sizeof(count), 1, file) == 1;
+  for (std::size_t k=0; written && k<strings.size(); k++) {
+    const uint32_t length = strings[k].size();
+    written = std::fwrite(&length, sizeof(length), 1, file) == 1 &&
+              std::fwrite(strings[k].data(), 1, length, file) == length;
+  }
+  return written;
+}
+
+bool readStrings(std::FILE* file, std::vector<std::string>& strings) {
+  uint32_t count;
+  if (std::fread(&count, sizeof(count), 1, file) != 1)
+    return false;
+  strings.clear();
+  for (uint32_t k=0; k<count; k++) {
+    uint32_t length;
+    if (std::fread(&length, sizeof(length), 1, file) != 1 || length > kMaxStringLength)
+      return false;
+    std::string text(length, '\0');
+    if (length > 0 && std::fread(&text[0], 1, length, file) != length)
+      return false;
+    strings.push_back(text);
+  }
+  return true;
+}
+
+bool readFile(const std::string& path, std::vector<unsigned char>& contents) {
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  contents.clear();
+  unsigned char chunk[4096];
+  std::size_t count;
+  while ((count = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+    contents.insert(contents.end(), chunk, chunk + count);
+  const bool read = !std::ferror(file);
+  std::fclose(file);
+  return read;
+}
+
+CacheHeader cacheHeader(const LimitTableSource& source, int number_of_levels) {
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = LimitTableCompiler::kVersion;
+  header.number_of_joints = source.number_of_joints;
+  header.number_of_levels = number_of_levels;
+  header.number_of_periods = source.periods.size();
+  header.require_nested = source.require_nested;
+  header.key = LimitTableCompiler::key(source);
+  header.hysteresis = source.hysteresis;
+  return header;
+}
+
+}  // namespace
+
+LimitTableCompiler::LimitTableCompiler()
+    : cached_(false) {
+}
+
+bool LimitTableCompiler::gather(int number_of_joints,
+                                const std::vector<double>* const lower_limits[SingularityLimitTable::kNumberOfLevels],
+                                const std::vector<double>* const upper_limits[SingularityLimitTable::kNumberOfLevels],
+                                LimitTableSource& source) {
+  const std::size_t errors = errors_.size();
+  const std::size_t size = number_of_joints > 0 ? number_of_joints : 0;
+  for (int l=0; l<SingularityLimitTable::kNumberOfLevels; l++) {
+    const std::vector<double>* const limits[] = {lower_limits[l], upper_limits[l]};
+    for (int side=0; side<2; side++) {
+      if (limits[side]->size() != size) {
+        std::ostringstream message;
+        message << "level " << l+1 << (side ? " upper" : " lower") << " limits wrong size: " << limits[side]->size()
+                << ", should be: " << number_of_joints;
+        errors_.push_back(message.str());
+      }
+    }
+  }
+  if (errors_.size() != errors)
+    return false;
+  source.number_of_joints = number_of_joints;
+  source.require_nested = false;
+  source.bands.clear();
+  source.bands.reserve(2 * SingularityLimitTable::kNumberOfLevels * size);
+  for (int l=0; l<SingularityLimitTable::kNumberOfLevels; l++) {
+    source.bands.insert(source.bands.end(), lower_limits[l]->begin(), lower_limits[l]->end());
+    source.bands.insert(source.bands.end(), upper_limits[l]->begin(), upper_limits[l]->end());
+  }
+  return true;
+}
+
+bool LimitTableCompiler::validate(const LimitTableSource& source, int& number_of_levels) {
+  const std::size_t errors = errors_.size();
+  const int n = source.number_of_joints;
+  const std::size_t row = n > 0 ? 2 * n : 0;
+  const std::vector<double>& bands = source.bands;
+  if (row == 0 || bands.empty() || bands.size() % row != 0 ||
+      bands.size() / row > static_cast<std::size_t>(SingularityLimitTable::kMaxLevels)) {
+    std::ostringstream message;
+    message << "band table wrong size: " << bands.size() << ", should be a multiple of " << row
+            << " for at most " << SingularityLimitTable::kMaxLevels << " levels";
+    errors_.push_back(message.str());
+    return false;
+  }
+  if (!(source.hysteresis >= 0.0))
+    errors_.push_back("level hysteresis must not be negative");
+
+  const int levels = bands.size() / row;
+  for (int l=0; l<levels; l++) {
+    const double* lower = &bands[l * row];
+    const double* upper = lower + n;
+    for (int i=0; i<n; i++) {
+      std::ostringstream message;
+      message << "level " << l+1 << " joint " << i;
+      if (std::isnan(lower[i]) || std::isnan(upper[i])) {
+        errors_.push_back(message.str() + " limit is not a number");
+        continue;
+      }
+      if (lower[i] > upper[i]) {
+        errors_.push_back(message.str() + " lower limit above the upper one");
+        continue;
+      }
+      // the bands are open, a joint is never strictly between equal limits
+      if (lower[i] == upper[i])
+        warnings_.push_back(message.str() + " band is empty");
+      if (l > 0 && !(lower[i] >= lower[i - static_cast<int>(row)] && upper[i] <= upper[i - static_cast<int>(row)])) {
+        message << " band not within the band of level " << l;
+        (source.require_nested ? errors_ : warnings_).push_back(message.str());
+      }
+    }
+  }
+
+  const std::vector<double>& periods = source.periods;
+  if (anyPeriodic(periods) && periods.size() != static_cast<std::size_t>(n)) {
+    std::ostringstream message;
+    message << "joint periods wrong size: " << periods.size() << ", should be: " << n;
+    errors_.push_back(message.str());
+  } else if (anyPeriodic(periods)) {
+    for (int i=0; i<n; i++) {
+      if (periods[i] == 0.0)
+        continue;
+      std::ostringstream message;
+      message << "joint " << i;
+      if (!(periods[i] > 0.0) || !std::isfinite(periods[i])) {
+        errors_.push_back(message.str() + " period must be positive");
+        continue;
+      }
+      double lowest = std::numeric_limits<double>::infinity();
+      double highest = -std::numeric_limits<double>::infinity();
+      for (int l=0; l<levels; l++) {
+        lowest = std::min(lowest, bands[l * row + i]);
+        highest = std::max(highest, bands[l * row + n + i]);
+      }
+      // the hysteresis table has to fit as well
+      if (!std::isfinite(lowest) || !std::isfinite(highest) || highest - lowest + 2.0 * source.hysteresis > periods[i])
+        errors_.push_back("bands of periodic " + message.str() + " do not fit into its period");
+    }
+  }
+  number_of_levels = levels;
+  return errors_.size() == errors;
+}
+
+bool LimitTableCompiler::compile(const LimitTableSource& source, const std::string& cache_directory,
+                                 SingularityLimitTable& table, SingularityLimitTable& hysteresis_table,
+                                 BandEdgeCache& edge_cache) {
+  const std::string path = cache_directory.empty() ? std::string() : cachePath(cache_directory, source);
+  // a file is only stored for a valid source, which it holds in full
+  cached_ = !path.empty() && load(path, source, table, hysteresis_table, edge_cache);
+  if (cached_)
+    return true;
+
+  const std::size_t warnings = warnings_.size();
+  int number_of_levels = 0;
+  if (!validate(source, number_of_levels))
+    return false;
+  if (!table.build(source.number_of_joints, number_of_levels, source.bands)) {
+    errors_.push_back("limit table cannot be built");
+    return false;
+  }
+  hysteresis_table = table;
+  hysteresis_table.widen(source.hysteresis);
+  std::string error;
+  if (!table.setPeriods(source.periods, error) || !hysteresis_table.setPeriods(source.periods, error)) {
+    errors_.push_back(error);
+    return false;
+  }
+  edge_cache.build(table);
+  if (!path.empty() &&
+      !store(path, source, number_of_levels, std::vector<std::string>(warnings_.begin() + warnings, warnings_.end()),
+             table, hysteresis_table, edge_cache))
+    warnings_.push_back("cannot write limit cache: " + path);
+  return true;
+}
+
+uint64_t LimitTableCompiler::key(const LimitTableSource& source) {
+  const uint32_t version = kVersion;
+  const int32_t number_of_joints = source.number_of_joints;
+  const uint32_t require_nested = source.require_nested;
+  uint64_t hash = fnv1a(kFnvOffset, &version, sizeof(version));
+  hash = fnv1a(hash, &number_of_joints, sizeof(number_of_joints));
+  hash = fnv1a(hash, &require_nested, sizeof(require_nested));
+  hash = fnv1a(hash, &source.hysteresis, sizeof(source.hysteresis));
+  hash = fnv1a(hash, source.bands);
+  return fnv1a(hash, source.periods);
+}
+
+std::string LimitTableCompiler::cachePath(const std::string& cache_directory, const LimitTableSource& source) {
+  char name[64];
+  std::snprintf(name, sizeof(name), "singularity_limits_%016llx.cache",
+                static_cast<unsigned long long>(key(source)));
+  return cache_directory + "/" + name;
+}
+
+bool LimitTableCompiler::load(const std::string& path, const LimitTableSource& source, SingularityLimitTable& table,
+                              SingularityLimitTable& hysteresis_table, BandEdgeCache& edge_cache) {
+  const std::size_t row = 2 * static_cast<std::size_t>(std::max(source.number_of_joints, 0));
+  if (row == 0 || source.bands.size() % row != 0)
+    return false;
+  std::vector<unsigned char> contents;
+  if (!readFile(path, contents) || contents.size() < sizeof(CacheHeader) + sizeof(uint64_t))
+    return false;
+  // a file cut short or changed after it has been written is rebuilt
+  const std::size_t size = contents.size() - sizeof(uint64_t);
+  uint64_t checksum;
+  std::memcpy(&checksum, &contents[size], sizeof(checksum));
+  if (fnv1a(kFnvOffset, &contents[0], size) != checksum)
+    return false;
+  std::FILE* file = fmemopen(&contents[0], size, "rb");
+  if (!file)
+    return false;
+  const CacheHeader expected = cacheHeader(source, source.bands.size() / row);
+  CacheHeader header;
+  std::vector<std::string> warnings;
+  // read aside, the tables keep their kernel and are only replaced by a complete file
+  SingularityLimitTable loaded_table = table;
+  SingularityLimitTable loaded_hysteresis_table = hysteresis_table;
+  BandEdgeCache loaded_edge_cache;
+  // the source is stored in full, so a hash collision is never taken over
+  const bool loaded = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                      std::memcmp(&header, &expected, sizeof(header)) == 0 &&
+                      readMatching(file, source.bands) && readMatching(file, source.periods) &&
+                      readStrings(file, warnings) && loaded_table.read(file, source.number_of_joints) &&
+                      loaded_hysteresis_table.read(file, source.number_of_joints) &&
+                      loaded_edge_cache.read(file, source.number_of_joints) && std::fgetc(file) == EOF;
+  std::fclose(file);
+  if (!loaded)
+    return false;
+  table = loaded_table;
+  hysteresis_table = loaded_hysteresis_table;
+  edge_cache = loaded_edge_cache;
+  warnings_.insert(warnings_.end(), warnings.begin(), warnings.end());
+  return true;
+}
+
+bool LimitTableCompiler::store(const std::string& path, const LimitTableSource& source, int number_of_levels,
+                               const std::vector<std::string>& warnings, const SingularityLimitTable& table,
+                               const SingularityLimitTable& hysteresis_table, const BandEdgeCache& edge_cache) const {
+  // assembled in memory to be closed by its checksum
+  char* buffer = NULL;
+  std::size_t size = 0;
+  std::FILE* memory = open_memstream(&buffer, &size);
+  if (!memory)
+    return false;
+  const CacheHeader header = cacheHeader(source, number_of_levels);
+  bool written = std::fwrite(&header, sizeof(header), 1, memory) == 1 &&
+                 std::fwrite(&source.bands[0], sizeof(double), source.bands.size(), memory) == source.bands.size() &&
+                 (source.periods.empty() ||
+                  std::fwrite(&source.periods[0], sizeof(double), source.periods.size(), memory) ==
+                      source.periods.size()) &&
+                 writeStrings(memory, warnings) && table.write(memory) && hysteresis_table.write(memory) &&
+                 edge_cache.write(memory);
+  written = std::fclose(memory) == 0 && written;
+  const uint64_t checksum = fnv1a(kFnvOffset, buffer, size);
+
+  // written aside and renamed, so a concurrent load never sees a partial file
+  const std::string temporary = path + ".tmp";
+  std::FILE* file = written ? std::fopen(temporary.c_str(), "wb") : NULL;
+  if (file) {
+    written = std::fwrite(buffer, 1, size, file) == size && std::fwrite(&checksum, sizeof(checksum), 1, file) == 1;
+    written = std::fclose(file) == 0 && written;
+  }
+  std::free(buffer);
+  if (!file)
+    return false;
+  if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,125 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef LIMIT_TABLE_COMPILER_H_
+#define LIMIT_TABLE_COMPILER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "BandEdgeCache.h"
+#include "SingularityLimitTable.h"
+
+
+/**
+ * @brief Limit configuration a runtime limit table is compiled from
+ */
+struct LimitTableSource {
+  LimitTableSource() : number_of_joints(0), hysteresis(0.0), require_nested(true) {}
+
+  int number_of_joints;
+  /// 2*number_of_joints limits per level, ordered from level 1: first the lower limits of all joints, then the upper ones
+  std::vector<double> bands;
+  /// period of every joint, 0 for a joint that is not periodic; empty for none
+  std::vector<double> periods;
+  /// margin the bands are widened by in the hysteresis table
+  double hysteresis;
+  /// whether a band outside of the band of the level below is an error or only a warning
+  bool require_nested;
+};
+
+/**
+ * @brief Validate a limit configuration and compile it into the runtime tables
+ *
+ * Validation does not stop at the first problem: every wrong size, every
+ * band turned upside down or outside of the band below and every period the
+ * bands do not fit into is reported, so a configuration is fixed in one go.
+ * Diagnostics accumulate over the calls of one compiler.
+ *
+ * The compiled tables can be cached in a directory. A cache file is named
+ * after a hash of the source and holds the source itself, the warnings of
+ * its validation, the limit table, the hysteresis table and the edge cache,
+ * closed by a checksum. A file is only taken over for exactly the same
+ * source written by the same cache version and SIMD padding; validation and
+ * building are skipped then. A missing, stale or corrupt file is rebuilt.
+ */
+class LimitTableCompiler {
+ public:
+  static const uint32_t kVersion = 2;
+
+  LimitTableCompiler();
+
+  /**
+   * @brief Gather the three levels of named limits into a source, reporting every limit of wrong size
+   *
+   * Bands of the named limits do not have to be nested, a band outside of the
+   * level below is only warned about.
+   *
+   * @param number_of_joints    number of robot joints
+   * @param lower_limits        lower limits of every singularity level, ordered from level 1
+   * @param upper_limits        upper limits of every singularity level, ordered from level 1
+   * @param source              source to fill, its periods and hysteresis are kept
+   * @return true   if all limits have proper size
+   * @return false  otherwise
+   */
+  bool gather(int number_of_joints,
+              const std::vector<double>* const lower_limits[SingularityLimitTable::kNumberOfLevels],
+              const std::vector<double>* const upper_limits[SingularityLimitTable::kNumberOfLevels],
+              LimitTableSource& source);
+
+  /**
+   * @brief Check the size, ordering and nesting of the bands and the periods of a source
+   *
+   * @param source              configuration to check
+   * @param number_of_levels    number of singularity levels of the bands
+   * @return true   if no error has been found
+   * @return false  otherwise, see errors()
+   */
+  bool validate(const LimitTableSource& source, int& number_of_levels);
+
+  /**
+   * @brief Validate a source and build the runtime tables of it, or read them from the cache if possible
+   *
+   * @param source              configuration to compile
+   * @param cache_directory     directory of the cache files, empty for no cache
+   * @param table               limit table with the periods set
+   * @param hysteresis_table    table widened by the hysteresis of the source
+   * @param edge_cache          sorted edges of table
+   * @return true   if the tables have been built
+   * @return false  if the source is invalid, see errors()
+   */
+  bool compile(const LimitTableSource& source, const std::string& cache_directory, SingularityLimitTable& table,
+               SingularityLimitTable& hysteresis_table, BandEdgeCache& edge_cache);
+
+  /**
+   * @brief 64-bit FNV-1a hash of everything a compiled table depends on
+   */
+  static uint64_t key(const LimitTableSource& source);
+
+  /**
+   * @brief Path of the cache file of a source in a cache directory
+   */
+  static std::string cachePath(const std::string& cache_directory, const LimitTableSource& source);
+
+  const std::vector<std::string>& errors() const { return errors_; }
+  const std::vector<std::string>& warnings() const { return warnings_; }
+  /// Whether the last compile() took the tables over from a cache file
+  bool cached() const { return cached_; }
+
+ private:
+  bool load(const std::string& path, const LimitTableSource& source, SingularityLimitTable& table,
+            SingularityLimitTable& hysteresis_table, BandEdgeCache& edge_cache);
+  bool store(const std::string& path, const LimitTableSource& source, int number_of_levels,
+             const std::vector<std::string>& warnings, const SingularityLimitTable& table,
+             const SingularityLimitTable& hysteresis_table, const BandEdgeCache& edge_cache) const;
+
+  std::vector<std::string> errors_;
+  std::vector<std::string> warnings_;
+  bool cached_;
+};
+
+#endif  // LIMIT_TABLE_COMPILER_H_
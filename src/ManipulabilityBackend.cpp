@@ -0,0 +1,93 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "ManipulabilityBackend.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "SingularityLimitTable.h"
+
+ManipulabilityBackend::ManipulabilityBackend()
+    : metric_(kManipulability),
+      reuse_tolerance_(0.0),
+      has_last_(false),
+      measure_(0.0),
+      level_(0) {
+}
+
+bool ManipulabilityBackend::parseMetric(const std::string& name, Metric& metric) {
+  if (name == "manipulability") {
+    metric = kManipulability;
+    return true;
+  }
+  if (name == "min_singular_value") {
+    metric = kMinimumSingularValue;
+    return true;
+  }
+  return false;
+}
+
+bool ManipulabilityBackend::configure(const KDL::Chain& chain, Metric metric, const std::vector<double>& thresholds,
+                                      double reuse_tolerance) {
+  if (thresholds.empty() || thresholds.size() > static_cast<size_t>(SingularityLimitTable::kMaxLevels))
+    return false;
+  for (size_t l=0; l<thresholds.size(); l++) {
+    if (thresholds[l] <= 0.0 || (l > 0 && thresholds[l] >= thresholds[l-1]))
+      return false;
+  }
+  const unsigned int joints = chain.getNrOfJoints();
+  if (joints == 0)
+    return false;
+
+  chain_ = chain;
+  solver_.reset(new KDL::ChainJntToJacSolver(chain_));
+  joint_array_.resize(joints);
+  jacobian_.resize(joints);
+  const int gram_size = std::min(6u, joints);
+  gram_.setZero(gram_size, gram_size);
+  eigen_solver_ = Eigen::SelfAdjointEigenSolver<GramMatrix>(gram_size);
+
+  metric_ = metric;
+  thresholds_ = thresholds;
+  reuse_tolerance_ = reuse_tolerance;
+  has_last_ = false;
+  last_position_.setZero(joints);
+  measure_ = 0.0;
+  level_ = 0;
+  return true;
+}
+
+int ManipulabilityBackend::classify(const Eigen::VectorXd& joint_position) {
+  // a small motion cannot move the robot noticeably closer to a singularity, keep the last result
+  if (has_last_ && (joint_position - last_position_).cwiseAbs().maxCoeff() <= reuse_tolerance_)
+    return level_;
+  joint_array_.data = joint_position;
+  last_position_ = joint_position;
+  has_last_ = true;
+
+  measure_ = evaluate();
+  level_ = 0;
+  for (size_t l=0; l<thresholds_.size(); l++)
+    level_ = measure_ < thresholds_[l] ? static_cast<int>(l+1) : level_;
+  return level_;
+}
+
+double ManipulabilityBackend::evaluate() {
+  if (solver_->JntToJac(joint_array_, jacobian_) < 0)
+    return 0.0;   // treat a failed evaluation as singular
+  if (jacobian_.data.cols() >= 6)
+    gram_.noalias() = jacobian_.data * jacobian_.data.transpose();
+  else
+    gram_.noalias() = jacobian_.data.transpose() * jacobian_.data;
+  eigen_solver_.compute(gram_, Eigen::EigenvaluesOnly);
+
+  // eigenvalues of the Gram matrix are the squared singular values of J, in increasing order
+  const Eigen::SelfAdjointEigenSolver<GramMatrix>::RealVectorType& eigenvalues = eigen_solver_.eigenvalues();
+  if (metric_ == kMinimumSingularValue)
+    return std::sqrt(std::max(eigenvalues[0], 0.0));
+  return std::sqrt(std::max(eigenvalues.prod(), 0.0));
+}
@@ -0,0 +1,91 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef MANIPULABILITY_BACKEND_H_
+#define MANIPULABILITY_BACKEND_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+#include <kdl/chain.hpp>
+#include <kdl/chainjnttojacsolver.hpp>
+#include <kdl/jacobian.hpp>
+#include <kdl/jntarray.hpp>
+
+
+/**
+ * @brief Detection backend classifying the position by a Jacobian based measure of dexterity
+ *
+ * The geometric Jacobian of the chain is evaluated every cycle and reduced to
+ * either the Yoshikawa manipulability or the minimum singular value. The
+ * lower the measure, the closer the robot is to a singularity: level l is
+ * reached when the measure falls below the l-th threshold.
+ */
+class ManipulabilityBackend {
+ public:
+  enum Metric { kManipulability, kMinimumSingularValue };
+
+  ManipulabilityBackend();
+
+  /**
+   * @brief Parse the metric name used by the manipulability_metric property
+   *
+   * @param name    "manipulability" or "min_singular_value"
+   * @param metric  parsed metric
+   * @return true   if the name is known
+   */
+  static bool parseMetric(const std::string& name, Metric& metric);
+
+  /**
+   * @brief Prepare the Jacobian solver and all buffers for the chain
+   *
+   * @param chain             kinematic chain of the robot
+   * @param metric            measure compared to the thresholds
+   * @param thresholds        measure below which level 1, 2, ... is reached, strictly decreasing
+   * @param reuse_tolerance   largest joint motion [rad] for which the last result is reused
+   * @return true   if the backend is ready
+   * @return false  if the thresholds are not strictly decreasing and positive
+   */
+  bool configure(const KDL::Chain& chain, Metric metric, const std::vector<double>& thresholds,
+                 double reuse_tolerance);
+
+  /**
+   * @brief Find the singularity level of a joint position
+   *
+   * @param joint_position  joint position of number_of_joints() size
+   * @return int            index of the singularity level of the position, 0 if none
+   */
+  int classify(const Eigen::VectorXd& joint_position);
+
+  /// measure computed for the last evaluated position
+  double measure() const { return measure_; }
+  int number_of_joints() const { return joint_array_.rows(); }
+
+ private:
+  /// J*J^T, or J^T*J for chains of less than 6 joints, never larger than 6x6
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, 6, 6> GramMatrix;
+
+  double evaluate();
+
+  KDL::Chain chain_;
+  std::unique_ptr<KDL::ChainJntToJacSolver> solver_;
+  KDL::JntArray joint_array_;
+  KDL::Jacobian jacobian_;
+  GramMatrix gram_;
+  Eigen::SelfAdjointEigenSolver<GramMatrix> eigen_solver_;
+
+  Metric metric_;
+  std::vector<double> thresholds_;
+  double reuse_tolerance_;
+  bool has_last_;
+  Eigen::VectorXd last_position_;
+  double measure_;
+  int level_;
+};
+
+#endif  // MANIPULABILITY_BACKEND_H_
@@ -0,0 +1,53 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SEQ_LOCK_H_
+#define SEQ_LOCK_H_
+
+#include <atomic>
+#include <stdint.h>
+
+
+/**
+ * @brief Sequence lock for one writer and any number of lock-free readers
+ *
+ * The writer makes the sequence odd while it updates the protected data and
+ * even again when done. A reader copies the data between readBegin() and
+ * readValid() and repeats the copy when the sequence has changed meanwhile.
+ * The object is address-free, so it may also live in shared memory.
+ */
+class SeqLock {
+ public:
+  SeqLock() : sequence_(0) {}
+
+  void writeBegin() {
+    sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void writeEnd() {
+    sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /// Sequence number to pass to readValid(), odd while a write is in progress
+  uint32_t readBegin() const {
+    return sequence_.load(std::memory_order_acquire);
+  }
+
+  /// Check that no write overlapped the reads started by readBegin()
+  bool readValid(uint32_t sequence) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (sequence & 1) == 0 && sequence_.load(std::memory_order_relaxed) == sequence;
+  }
+
+  /// Number of completed writes
+  uint32_t writes() const { return sequence_.load(std::memory_order_acquire) / 2; }
+
+ private:
+  std::atomic<uint32_t> sequence_;
+};
+
+#endif  // SEQ_LOCK_H_
@@ -0,0 +1,33 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "SharedJointBuffer.h"
+
+#include <cstddef>
+
+SharedJointBuffer::SharedJointBuffer(int number_of_joints)
+    : position_(number_of_joints > 0 ? number_of_joints : 0, 0.0) {
+}
+
+void SharedJointBuffer::write(const double* joint_position) {
+  lock_.writeBegin();
+  for (std::size_t i=0; i<position_.size(); i++)
+    position_[i] = joint_position[i];
+  lock_.writeEnd();
+}
+
+bool SharedJointBuffer::read(double* joint_position, uint32_t& sequence) const {
+  for (int attempt=0; attempt<kMaxReadAttempts; attempt++) {
+    const uint32_t begin = lock_.readBegin();
+    for (std::size_t i=0; i<position_.size(); i++)
+      joint_position[i] = position_[i];
+    if (lock_.readValid(begin)) {
+      sequence = begin / 2;
+      return true;
+    }
+  }
+  return false;
+}
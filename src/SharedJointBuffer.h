@@ -0,0 +1,56 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SHARED_JOINT_BUFFER_H_
+#define SHARED_JOINT_BUFFER_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "SeqLock.h"
+
+
+/**
+ * @brief Joint position buffer owned by a controller and read in-process by the detector
+ *
+ * The controller writes every new position into the buffer and the detector
+ * reads it without any port, connection or lock. When the detector runs as
+ * a slave of the controller's activity both sides share one thread and the
+ * position is classified in the same tick it was produced; readers in other
+ * threads are protected by the sequence lock.
+ */
+class SharedJointBuffer {
+ public:
+  explicit SharedJointBuffer(int number_of_joints);
+
+  int number_of_joints() const { return static_cast<int>(position_.size()); }
+
+  /**
+   * @brief Publish a new joint position, to be called by the owning controller only
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   */
+  void write(const double* joint_position);
+
+  /**
+   * @brief Copy the last published position
+   *
+   * @param joint_position  buffer for number_of_joints() joint positions
+   * @param sequence        number of the position published, increasing with every write
+   * @return true   if a consistent position has been copied
+   * @return false  if the writer kept overwriting the buffer during all attempts
+   */
+  bool read(double* joint_position, uint32_t& sequence) const;
+
+ private:
+  /// attempts of read() before giving up on a writer in progress
+  static const int kMaxReadAttempts = 4;
+
+  SeqLock lock_;
+  std::vector<double> position_;
+};
+
+#endif  // SHARED_JOINT_BUFFER_H_
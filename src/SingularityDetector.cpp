@@ -5,9 +5,59 @@
  *****************************************************************************/
 
 #include "SingularityDetector.h"
+#include "AllocationTrap.h"
+#include "SingularityLimits.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <thread>
+
+#include <kdl/tree.hpp>
+#include <kdl_parser/kdl_parser.hpp>
+#include <rtt_rosclock/rtt_rosclock.h>
 
 SingularityDetector::SingularityDetector(const std::string& name)
-    : RTT::TaskContext(name, PreOperational) {
+    : RTT::TaskContext(name, PreOperational),
+      number_of_joints(0),
+      limits(NULL),
+      limits_version(0),
+      singularity_map_verification_samples(0),
+      batch_parallel_threshold(static_cast<int>(SingularityLimitTable().parallel_threshold())),
+      numeric_mode("double"),
+      quantization_tolerance(1e-6),
+      publish_proximity(false),
+      publish_joint_levels(false),
+      publish_edge_distance(false),
+      detection_backend("interval"),
+      manipulability_metric("manipulability"),
+      jacobian_reuse_tolerance(0.0),
+      backend(kIntervalBackend),
+      incremental_evaluation(false),
+      heartbeat_period(0.0),
+      raw_singularity_level(0),
+      level_hysteresis(0.0),
+      level_min_dwell(0.0),
+      level_filtering(false),
+      look_ahead_horizon(0.0),
+      previous_sample_time(0),
+      previous_sample_valid(false),
+      scaling_published(false),
+      published_scaling(0),
+      last_publish_time(0),
+      joint_buffer(NULL),
+      joint_buffer_read(false),
+      joint_buffer_sequence(0),
+      input_burst_size(0),
+      input_sample_period(0.0),
+      joint_burst_count(0),
+      previous_burst_time(0),
+      previous_burst_valid(false),
+      max_sample_age(0.0),
+      journal_capacity(1024),
+      journal_level(0) {
 
   this->addProperty("number_of_joints", number_of_joints);
   this->addProperty("singularity_level1_lower", l1_lower);
@@ -16,8 +66,77 @@ SingularityDetector::SingularityDetector(const std::string& name)
   this->addProperty("singularity_level2_upper", l2_upper);
   this->addProperty("singularity_level3_lower", l3_lower);
   this->addProperty("singularity_level3_upper", l3_upper);
+  this->addProperty("singularity_bands", singularity_bands);
+  this->addProperty("joint_periods", joint_periods);
+  this->addProperty("limit_cache_directory", limit_cache_directory);
+  this->addProperty("coupled_regions_file", coupled_regions_file);
+  this->addProperty("singularity_map_file", singularity_map_file);
+  this->addProperty("singularity_map_verification_samples", singularity_map_verification_samples);
+  this->addProperty("batch_parallel_threshold", batch_parallel_threshold);
+  this->addProperty("numeric_mode", numeric_mode);
+  this->addProperty("position_resolution", position_resolution);
+  this->addProperty("quantization_tolerance", quantization_tolerance);
+  this->addProperty("joint_groups", joint_groups);
+  this->addProperty("joint_group_cpus", joint_group_cpus);
+  this->addProperty("publish_proximity", publish_proximity);
+  this->addProperty("publish_joint_levels", publish_joint_levels);
+  this->addProperty("publish_edge_distance", publish_edge_distance);
+  this->addProperty("detection_backend", detection_backend);
+  this->addProperty("robot_description", robot_description);
+  this->addProperty("base_link", base_link);
+  this->addProperty("tip_link", tip_link);
+  this->addProperty("manipulability_metric", manipulability_metric);
+  this->addProperty("manipulability_thresholds", manipulability_thresholds);
+  this->addProperty("jacobian_reuse_tolerance", jacobian_reuse_tolerance);
+  this->addProperty("incremental_evaluation", incremental_evaluation);
+  this->addProperty("heartbeat_period", heartbeat_period);
+  this->addProperty("level_hysteresis", level_hysteresis);
+  this->addProperty("level_min_dwell", level_min_dwell);
+  this->addProperty("look_ahead_horizon", look_ahead_horizon);
+  this->addProperty("shared_memory_name", shared_memory_name);
+  this->addProperty("input_burst_size", input_burst_size);
+  this->addProperty("input_sample_period", input_sample_period);
+  this->addProperty("max_sample_age", max_sample_age);
+  this->addProperty("journal_file", journal_file);
+  this->addProperty("journal_capacity", journal_capacity);
   this->addPort("JointPosition", port_joint_position);
+  this->addPort("JointState", port_joint_state);
+  this->addPort("SingularityLevelStamped", port_singularity_level_stamped);
   this->addPort("SingularityScaler", port_singularity_scaling);
+  this->addPort("SingularityProximity", port_singularity_proximity);
+  this->addPort("JointSingularityProximity", port_joint_singularity_proximity);
+  this->addPort("JointSingularityLevels", port_joint_singularity_levels);
+  this->addPort("JointGroupLevels", port_joint_group_levels);
+  this->addPort("SingularityDistance", port_singularity_distance);
+  this->addPort("JointSingularityDistance", port_joint_singularity_distance);
+  this->addPort("JointVelocity", port_joint_velocity);
+  this->addPort("PredictedSingularityScaler", port_predicted_singularity_scaling);
+  this->addPort("SingularityEntryTime", port_singularity_entry_time);
+  this->addPort("JointSingularityEntryTime", port_joint_singularity_entry_time);
+  this->addPort("WorstSampleTime", port_worst_sample_time);
+  this->addOperation("classifyTrajectory", &SingularityDetector::classifyTrajectory, this, RTT::ClientThread)
+      .doc("Classify every waypoint (matrix column) of a trajectory, returns false if not configured or of wrong size")
+      .arg("waypoints", "joint positions, one column per waypoint")
+      .arg("levels", "singularity level index of every waypoint");
+  this->addOperation("classifyConfiguration", &SingularityDetector::classifyConfiguration, this, RTT::ClientThread)
+      .doc("Singularity level index of a configuration against the current limits, -1 if not configured or of wrong size")
+      .arg("joint_position", "configuration to classify");
+  this->addOperation("reloadLimits", &SingularityDetector::reloadLimits, this, RTT::ClientThread)
+      .doc("Validate the current limit properties and use them from the next cycle on, without stopping the component");
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+  latency_diagnostics_period = 0;
+  latency_ring_capacity = 4096;
+  latency_diagnostics_counter = 0;
+  this->addProperty("latency_diagnostics_period", latency_diagnostics_period);
+  this->addProperty("latency_ring_capacity", latency_ring_capacity);
+  this->addPort("LatencyDiagnostics", port_latency_diagnostics);
+  this->addOperation("getLatencyStatistics", &SingularityDetector::getLatencyStatistics, this, RTT::ClientThread)
+      .doc("Cycle time and sample-to-output latency [us]: count, min, p50, p90, p99, p99.9, max of each");
+  this->addOperation("resetLatencyStatistics", &SingularityDetector::resetLatencyStatistics, this, RTT::ClientThread)
+      .doc("Clear the latency histograms at the next cycle");
+  this->addOperation("drainLatencySamples", &SingularityDetector::drainLatencySamples, this, RTT::ClientThread)
+      .doc("Take the buffered raw samples [ns] as cycle time, sample-to-output pairs (-1 without a new sample)");
+#endif
 }
 
 SingularityDetector::~SingularityDetector() {
@@ -34,10 +153,163 @@ bool SingularityDetector::configureHook() {
   try {
     if (number_of_joints <= 0)
       return false;
-    if (!checkAllLimitsSize(number_of_joints, l1_lower, l1_upper, l2_lower, l2_upper, l3_lower, l3_upper))
+    if (level_hysteresis < 0.0 || level_min_dwell < 0.0) {
+      RTT::Logger::log(RTT::Logger::Error) << "level hysteresis and minimum dwell time must not be negative"
+                                           << RTT::endlog();
+      return false;
+    }
+    if (joint_buffer && joint_buffer->number_of_joints() != number_of_joints) {
+      // attached for another number of joints, reading it would run past its end
+      RTT::Logger::log(RTT::Logger::Error) << "attached joint buffer wrong size: " << joint_buffer->number_of_joints()
+                                           << ", should be: " << number_of_joints << RTT::endlog();
+      return false;
+    }
+    if (!configureJointGroups())
+      return false;
+    // held up to the end, a reloadLimits() meanwhile waits for the configuration to finish
+    std::lock_guard<std::mutex> lock(limits_mutex);
+    // updateHook() released the slot it used last, so it is free as soon as no query pins it
+    LimitSet* limit_set = beginLimitSetWrite();
+    if (!limit_set)
+      return false;
+    // the backend first, the limit set depends on it
+    if (!configureBackend() || !buildLimitSet(*limit_set) || !configureCoupledRegions(*limit_set) ||
+        !checkCoupledRegionLevels(*limit_set))
+      return false;
+    limit_sets.publish();
+    limits = &limit_sets.published();
+    if (publish_edge_distance && limits->limit_table.number_of_joints() == 0) {
+      RTT::Logger::log(RTT::Logger::Error) << "the edge distance needs interval limits" << RTT::endlog();
+      return false;
+    }
+    if (!configureSingularityMap())
       return false;
-    joint_position.resize(number_of_joints);
+    if (!group_first_joints.empty()) {
+      std::string error;
+      if (!group_pool.start(group_first_joints.size(), joint_group_cpus, &SingularityDetector::classifyJointGroup,
+                            this, error)) {
+        RTT::Logger::log(RTT::Logger::Error) << error << RTT::endlog();
+        return false;
+      }
+      RTT::Logger::log(RTT::Logger::Info) << group_first_joints.size() << " joint groups classified by "
+                                          << group_pool.number_of_workers() << " workers and the component thread"
+                                          << RTT::endlog();
+    }
+    if (level_hysteresis > 0.0 && backend != kIntervalBackend)
+      RTT::Logger::log(RTT::Logger::Warning) << "level hysteresis is ignored by the " << detection_backend
+                                             << " backend" << RTT::endlog();
+    if (look_ahead_horizon < 0.0 || (look_ahead_horizon > 0.0 && backend != kIntervalBackend)) {
+      RTT::Logger::log(RTT::Logger::Error) << "look-ahead needs a positive horizon and the interval backend"
+                                           << RTT::endlog();
+      return false;
+    }
+    if (max_sample_age < 0.0) {
+      RTT::Logger::log(RTT::Logger::Error) << "maximum sample age must not be negative" << RTT::endlog();
+      return false;
+    }
+    if (input_burst_size < 0 || input_sample_period < 0.0 || (input_burst_size > 0 && backend != kIntervalBackend)) {
+      RTT::Logger::log(RTT::Logger::Error) << "input bursts need a non-negative size and sample period "
+                                           << "and the interval backend" << RTT::endlog();
+      return false;
+    }
+    level_filter.configure(level_min_dwell);
+    level_filtering = limits->hysteresis > 0.0 || level_filter.min_dwell() > 0.0;
+    if (limits->core_variant == kDynamicCore)
+      RTT::Logger::log(RTT::Logger::Info) << "singularity band kernel: " << BandKernel::name(limits->limit_table.kernel())
+                                          << RTT::endlog();
+    else if (limits->core_variant == kCompactCore)
+      RTT::Logger::log(RTT::Logger::Info) << "singularity band kernel: " << BandKernel::name(limits->compact_table.kernel())
+                                          << " on " << numeric_mode << " limits, exact beyond "
+                                          << limits->compact_table.quantization_error() << " of the band edges"
+                                          << RTT::endlog();
+    else
+      RTT::Logger::log(RTT::Logger::Info) << "singularity classifier specialized for " << number_of_joints
+                                          << " joints" << RTT::endlog();
+    // preallocate everything touched by updateHook()
+    joint_position.setZero(number_of_joints);
+    joint_sample.setZero(number_of_joints);
+    incremental_classifier.reset(number_of_joints);
     singularity_scaling.data = 1.0;   // init scaling parameter value
+    port_singularity_scaling.setDataSample(singularity_scaling);
+    singularity_proximity.data = 0.0;
+    port_singularity_proximity.setDataSample(singularity_proximity);
+    joint_singularity_proximity.setZero(number_of_joints);
+    port_joint_singularity_proximity.setDataSample(joint_singularity_proximity);
+    joint_singularity_levels.layout.dim.resize(2);
+    joint_singularity_levels.layout.dim[0].label = "joint";
+    joint_singularity_levels.layout.dim[0].size = number_of_joints;
+    joint_singularity_levels.layout.dim[0].stride = 2 * number_of_joints;
+    joint_singularity_levels.layout.dim[1].label = "level_edge";
+    joint_singularity_levels.layout.dim[1].size = 2;
+    joint_singularity_levels.layout.dim[1].stride = 2;
+    joint_singularity_levels.layout.data_offset = 0;
+    joint_singularity_levels.data.assign(2 * number_of_joints, 0);
+    port_joint_singularity_levels.setDataSample(joint_singularity_levels);
+    joint_group_levels.layout.dim.resize(1);
+    joint_group_levels.layout.dim[0].label = "group";
+    joint_group_levels.layout.dim[0].size = group_first_joints.size();
+    joint_group_levels.layout.dim[0].stride = group_first_joints.size();
+    joint_group_levels.layout.data_offset = 0;
+    joint_group_levels.data.assign(group_first_joints.size(), 0);
+    port_joint_group_levels.setDataSample(joint_group_levels);
+    singularity_distance.data = std::numeric_limits<double>::infinity();
+    port_singularity_distance.setDataSample(singularity_distance);
+    joint_singularity_distance.setConstant(number_of_joints, std::numeric_limits<double>::infinity());
+    port_joint_singularity_distance.setDataSample(joint_singularity_distance);
+    level_publisher.close();
+    if (!shared_memory_name.empty()) {
+      std::string error;
+      if (!level_publisher.open(shared_memory_name, number_of_joints, error)) {
+        RTT::Logger::log(RTT::Logger::Error) << error << RTT::endlog();
+        return false;
+      }
+    }
+    if (journal.opened() && journal.dropped() > 0)
+      RTT::Logger::log(RTT::Logger::Warning) << journal.dropped() << " level transitions were not journaled"
+                                             << RTT::endlog();
+    journal.close();
+    if (!journal_file.empty()) {
+      std::string error;
+      if (journal_capacity <= 0 || !journal.open(journal_file, number_of_joints, journal_capacity, error)) {
+        RTT::Logger::log(RTT::Logger::Error) << (journal_capacity <= 0 ? "journal capacity must be positive" : error)
+                                             << RTT::endlog();
+        return false;
+      }
+    }
+    journal_joint_levels.assign(number_of_joints, 0);
+    joint_velocity.setZero(number_of_joints);
+    previous_joint_position.setZero(number_of_joints);
+    previous_sample_valid = false;
+    predicted_singularity_scaling.data = 1;
+    port_predicted_singularity_scaling.setDataSample(predicted_singularity_scaling);
+    singularity_entry_time.data = std::numeric_limits<double>::infinity();
+    port_singularity_entry_time.setDataSample(singularity_entry_time);
+    joint_singularity_entry_time.setConstant(number_of_joints, std::numeric_limits<double>::infinity());
+    port_joint_singularity_entry_time.setDataSample(joint_singularity_entry_time);
+    joint_burst.setZero(number_of_joints, input_burst_size);
+    joint_burst_levels.assign(input_burst_size, 0);
+    joint_burst_count = 0;
+    worst_sample_time.data = 0.0;
+    port_worst_sample_time.setDataSample(worst_sample_time);
+    // joint state samples of the same size are copied into these buffers without allocating
+    joint_state.name.assign(number_of_joints, std::string());
+    for (std::size_t i=0; i<joint_state.name.size(); i++)
+      joint_state.name[i].reserve(64);
+    joint_state.position.assign(number_of_joints, 0.0);
+    joint_state.velocity.reserve(number_of_joints);
+    joint_state.effort.reserve(number_of_joints);
+    singularity_level_stamped.header.seq = 0;
+    singularity_level_stamped.level = 0;
+    singularity_level_stamped.proximity = 0.0;
+    singularity_level_stamped.sample_age = 0.0;
+    singularity_level_stamped.stale_samples = 0;
+    port_singularity_level_stamped.setDataSample(singularity_level_stamped);
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+    latency_recorder.reset(latency_ring_capacity > 0 ? latency_ring_capacity : 1);
+    latency_diagnostics.setZero(kLatencyStatisticsSize);
+    port_latency_diagnostics.setDataSample(latency_diagnostics);
+    latency_diagnostics_counter = 0;
+#endif
 
     return true;
   } catch (std::exception &e) {
@@ -52,16 +324,788 @@ bool SingularityDetector::configureHook() {
 }
 
 
+/**
+ * @brief Forget the last classified and published level, so the first cycle always publishes
+ * 
+ * @return true   if the component can be started
+ * @return false  if an attached joint buffer does not match the configured number of joints
+ */
+bool SingularityDetector::startHook() {
+  if (joint_buffer && joint_buffer->number_of_joints() != joint_position.size()) {
+    RTT::Logger::log(RTT::Logger::Error) << "attached joint buffer wrong size: " << joint_buffer->number_of_joints()
+                                         << ", configured for: " << joint_position.size() << RTT::endlog();
+    return false;
+  }
+  {
+    // updateHook() acquires the set at the start of every cycle, here it is only looked at
+    std::lock_guard<std::mutex> lock(limits_mutex);
+    limits = &limit_sets.published();
+    limits_version = limit_sets.version();
+    level_filtering = limits->hysteresis > 0.0 || level_filter.min_dwell() > 0.0;
+  }
+  incremental_classifier.reset(number_of_joints);
+  level_filter.reset();
+  raw_singularity_level = 0;
+  previous_sample_valid = false;
+  scaling_published = false;
+  joint_buffer_read = false;
+  joint_burst_count = 0;
+  previous_burst_valid = false;
+  singularity_level_stamped.stale_samples = 0;
+  journal_level = singularity_scaling.data-1;
+  return true;
+}
+
+
+/**
+ * @brief Read joint positions directly from a controller's buffer instead of port_joint_position
+ * 
+ * To be called in-process while the component is not running, typically by the
+ * controller whose activity drives this component through a SlaveActivity.
+ * 
+ * @param buffer  controller buffer of number_of_joints size, NULL to read the port again
+ * @return true   if the buffer has been attached
+ * @return false  if the component is running or the buffer has wrong size
+ */
+bool SingularityDetector::attachJointBuffer(const SharedJointBuffer* buffer) {
+  if (this->isRunning())
+    return false;
+  if (buffer && buffer->number_of_joints() != number_of_joints) {
+    RTT::Logger::log(RTT::Logger::Error) << "joint buffer wrong size: " << buffer->number_of_joints()
+                                         << ", should be: " << number_of_joints << RTT::endlog();
+    return false;
+  }
+  joint_buffer = buffer;
+  joint_buffer_read = false;
+  return true;
+}
+
+
+/**
+ * @brief Read a new sample of port_joint_state into joint_position and sample_stamp
+ * 
+ * Samples without a stamp are stamped with the read time. Samples older than
+ * max_sample_age are counted in stale_samples and dropped.
+ * 
+ * @return true   if a new sample of number_of_joints positions is to be classified
+ * @return false  if there is no new sample or it has wrong size or is stale
+ */
+bool SingularityDetector::readJointState() {
+  if (port_joint_state.read(joint_state, false) != RTT::NewData ||
+      joint_state.position.size() != static_cast<std::size_t>(number_of_joints))
+    return false;
+  const ros::Time now = rtt_rosclock::host_now();
+  sample_stamp = joint_state.header.stamp.isZero() ? now : joint_state.header.stamp;
+  if (max_sample_age > 0.0 && (now - sample_stamp).toSec() > max_sample_age) {
+    singularity_level_stamped.stale_samples++;
+    return false;
+  }
+  joint_position = Eigen::Map<const Eigen::VectorXd>(&joint_state.position[0], number_of_joints);
+  return true;
+}
+
+
+/**
+ * @brief Read the next sample of port_joint_position into joint_sample
+ * 
+ * A sample of wrong size reallocates joint_sample, and so does restoring its
+ * size; these are the only allocations allowed in updateHook(), so a peer
+ * sending the wrong number of joints does not trip the allocation trap, and
+ * joint_position keeps its size.
+ * 
+ * @param copy_old_data   passed to the port, whether an old sample is read again
+ * @param valid           whether the sample has number_of_joints positions, restored to that size otherwise
+ * @return true   if a new sample has been read
+ * @return false  otherwise
+ */
+bool SingularityDetector::readJointSample(bool copy_old_data, bool& valid) {
+  ScopedAllocationPermit allocation_permit;
+  const bool new_data = port_joint_position.read(joint_sample, copy_old_data) == RTT::NewData;
+  valid = joint_sample.size() == number_of_joints;
+  if (!valid)
+    joint_sample.setZero(number_of_joints);
+  return new_data;
+}
+
+
+/**
+ * @brief Drain the samples pending on a buffered port_joint_position connection into joint_burst
+ * 
+ * At most input_burst_size samples are taken, the rest are left for the next
+ * cycle. Samples of wrong size are dropped. joint_position is the latest one.
+ * 
+ * @return int  number of samples taken
+ */
+int SingularityDetector::readJointBurst() {
+  joint_burst_count = 0;
+  bool valid;
+  while (joint_burst_count < input_burst_size && readJointSample(false, valid)) {
+    if (valid)
+      joint_burst.col(joint_burst_count++) = joint_sample;
+  }
+  if (joint_burst_count > 0)
+    joint_position = joint_burst.col(joint_burst_count-1);
+  return joint_burst_count;
+}
+
+
+/**
+ * @brief Classify the samples of the last burst in one batch and estimate when the worst one was taken
+ * 
+ * The samples carry no time of their own: they are assumed input_sample_period
+ * apart and the latest one to be taken now, or evenly spread since the last
+ * burst when the period is not given. worst_sample_time is the estimate for
+ * the first sample of the worst level.
+ * 
+ * @return int  index of the worst singularity level of the burst
+ */
+int SingularityDetector::classifyJointBurst() {
+  checkSingularityLevels(joint_burst.leftCols(joint_burst_count), &joint_burst_levels[0]);
+  int worst = 0;
+  for (int k=1; k<joint_burst_count; k++) {
+    if (joint_burst_levels[k] > joint_burst_levels[worst])
+      worst = k;
+  }
+  const RTT::os::TimeService::ticks now = RTT::os::TimeService::Instance()->getTicks();
+  const double now_seconds = 1e-9 * RTT::os::TimeService::ticks2nsecs(now);
+  double spacing = input_sample_period;
+  if (spacing <= 0.0)
+    spacing = previous_burst_valid ? 1e-9 * RTT::os::TimeService::ticks2nsecs(now - previous_burst_time) /
+                                     joint_burst_count : 0.0;
+  worst_sample_time.data = now_seconds - (joint_burst_count-1-worst) * spacing;
+  previous_burst_time = now;
+  previous_burst_valid = true;
+  return joint_burst_levels[worst];
+}
+
+
+/**
+ * @brief Select and prepare the detection backend given by the detection_backend property
+ * 
+ * @return true   if the backend is ready
+ * @return false  if the backend is unknown or its configuration is invalid
+ */
+bool SingularityDetector::configureBackend() {
+  if (detection_backend == "interval") {
+    backend = kIntervalBackend;
+    return true;
+  }
+  if (detection_backend != "manipulability") {
+    RTT::Logger::log(RTT::Logger::Error) << "unknown detection backend: " << detection_backend << RTT::endlog();
+    return false;
+  }
+  if (publish_proximity || publish_joint_levels) {
+    RTT::Logger::log(RTT::Logger::Error) << "proximity and joint levels are only published by the interval backend"
+                                         << RTT::endlog();
+    return false;
+  }
+  ManipulabilityBackend::Metric metric;
+  if (!ManipulabilityBackend::parseMetric(manipulability_metric, metric)) {
+    RTT::Logger::log(RTT::Logger::Error) << "unknown manipulability metric: " << manipulability_metric << RTT::endlog();
+    return false;
+  }
+  KDL::Tree tree;
+  KDL::Chain chain;
+  if (!kdl_parser::treeFromString(robot_description, tree) || !tree.getChain(base_link, tip_link, chain)) {
+    RTT::Logger::log(RTT::Logger::Error) << "no kinematic chain from " << base_link << " to " << tip_link
+                                         << " in robot_description" << RTT::endlog();
+    return false;
+  }
+  if (static_cast<int>(chain.getNrOfJoints()) != number_of_joints) {
+    RTT::Logger::log(RTT::Logger::Error) << "kinematic chain has " << chain.getNrOfJoints() << " joints, should be: "
+                                         << number_of_joints << RTT::endlog();
+    return false;
+  }
+  if (!manipulability_backend.configure(chain, metric, manipulability_thresholds, jacobian_reuse_tolerance)) {
+    RTT::Logger::log(RTT::Logger::Error) << "manipulability thresholds must be positive and strictly decreasing"
+                                         << RTT::endlog();
+    return false;
+  }
+  backend = kManipulabilityBackend;
+  return true;
+}
+
+
+/**
+ * @brief Compile a limit set from singularity_bands or, when it is empty, from the three levels of named limits
+ * 
+ * Allocates, so it runs in configureHook() or in the thread of reloadLimits(), never in updateHook().
+ * Every problem of the limits is logged, not only the first one. The
+ * manipulability backend does not need interval limits: without any, the set
+ * is left without a limit table and the interval queries refuse every
+ * configuration.
+ * 
+ * @param limit_set   set to fill, left unusable when the limits are invalid
+ * @return true   if the set has been built
+ * @return false  if the limits have wrong size, are not ordered, the bands are not nested or do not survive
+ *                the quantization of numeric_mode
+ */
+bool SingularityDetector::buildLimitSet(LimitSet& limit_set) const {
+  SingularityLimitTable& table = limit_set.limit_table;
+  if (backend == kManipulabilityBackend && singularity_bands.empty() && l1_lower.empty() && l1_upper.empty() &&
+      l2_lower.empty() && l2_upper.empty() && l3_lower.empty() && l3_upper.empty()) {
+    table = SingularityLimitTable();
+    limit_set.hysteresis_table = SingularityLimitTable();
+    limit_set.edge_cache = BandEdgeCache();
+    limit_set.group_tables.clear();
+    limit_set.hysteresis = 0.0;
+    limit_set.core_variant = kDynamicCore;
+    RTT::Logger::log(RTT::Logger::Info) << "no interval limits, levels come from the manipulability backend only"
+                                        << RTT::endlog();
+    return true;
+  }
+  LimitTableCompiler compiler;
+  LimitTableSource source;
+  bool gathered = true;
+  if (singularity_bands.empty()) {
+    const std::vector<double>* const lower_limits[] = {&l1_lower, &l2_lower, &l3_lower};
+    const std::vector<double>* const upper_limits[] = {&l1_upper, &l2_upper, &l3_upper};
+    gathered = compiler.gather(number_of_joints, lower_limits, upper_limits, source);
+  } else {
+    source.number_of_joints = number_of_joints;
+    source.bands = singularity_bands;
+  }
+  source.periods = joint_periods;
+  source.hysteresis = level_hysteresis;
+  const bool compiled = gathered && compiler.compile(source, limit_cache_directory, table, limit_set.hysteresis_table,
+                                                     limit_set.edge_cache);
+  for (std::size_t k=0; k<compiler.warnings().size(); k++)
+    RTT::Logger::log(RTT::Logger::Warning) << compiler.warnings()[k] << RTT::endlog();
+  for (std::size_t k=0; k<compiler.errors().size(); k++)
+    RTT::Logger::log(RTT::Logger::Error) << compiler.errors()[k] << RTT::endlog();
+  if (!compiled)
+    return false;
+  if (!singularity_bands.empty())
+    RTT::Logger::log(RTT::Logger::Info) << table.number_of_levels() << " singularity levels" << RTT::endlog();
+  if (compiler.cached())
+    RTT::Logger::log(RTT::Logger::Info) << "compiled limit tables taken from the cache in " << limit_cache_directory
+                                        << RTT::endlog();
+  limit_set.hysteresis = level_hysteresis;
+  if (batch_parallel_threshold > 0) {
+    table.setParallelThreshold(batch_parallel_threshold);
+    limit_set.hysteresis_table.setParallelThreshold(batch_parallel_threshold);
+  }
+  // built in every numeric mode, so that no set is left with the group tables of an earlier one
+  limit_set.group_tables.resize(group_first_joints.size());
+  for (std::size_t g=0; g<group_first_joints.size(); g++) {
+    const int end = g + 1 < group_first_joints.size() ? group_first_joints[g+1] : number_of_joints;
+    limit_set.group_tables[g].slice(table, group_first_joints[g], end - group_first_joints[g]);
+  }
+  if (numeric_mode != "double") {
+    CompactLimitTable::Mode mode;
+    std::string error;
+    if (!CompactLimitTable::parseMode(numeric_mode, mode)) {
+      RTT::Logger::log(RTT::Logger::Error) << "unknown numeric mode: " << numeric_mode << RTT::endlog();
+      return false;
+    }
+    if (!limit_set.compact_table.build(table, mode, position_resolution, quantization_tolerance, error)) {
+      RTT::Logger::log(RTT::Logger::Error) << error << RTT::endlog();
+      return false;
+    }
+    limit_set.core_variant = kCompactCore;
+    return true;
+  }
+  // fixed joint counts get a classifier unrolled at compile time, others the SIMD table
+  if (limit_set.core6.build(table))
+    limit_set.core_variant = kCore6;
+  else if (limit_set.core7.build(table))
+    limit_set.core_variant = kCore7;
+  else
+    limit_set.core_variant = kDynamicCore;
+  return true;
+}
+
+
+/**
+ * @brief Operation replacing the limits by the current limit properties while the component keeps running
+ * 
+ * The new limits are validated and built in the caller's thread; updateHook()
+ * takes them over at the start of its next cycle, so it never waits and never
+ * sees a partially updated set. The coupled regions and the joint groups are
+ * kept, the level hysteresis follows the reloaded level_hysteresis.
+ * 
+ * @return true   if the new limits will be used from the next cycle on
+ * @return false  if the component is not configured, the limits are invalid, the joint groups changed or do
+ *                not fit the reloaded properties, or the previous limits are still in use
+ */
+bool SingularityDetector::reloadLimits() {
+  std::lock_guard<std::mutex> lock(limits_mutex);
+  if (joint_position.size() == 0 || joint_position.size() != number_of_joints) {
+    RTT::Logger::log(RTT::Logger::Error) << "limits are reloaded only with the configured number of joints"
+                                         << RTT::endlog();
+    return false;
+  }
+  if (singularity_map.loaded()) {
+    RTT::Logger::log(RTT::Logger::Error) << "limits cannot be reloaded over the singularity map baked from them"
+                                         << RTT::endlog();
+    return false;
+  }
+  if (joint_groups != group_first_joints) {
+    RTT::Logger::log(RTT::Logger::Error) << "joint groups are changed only by configure, not by a reload"
+                                         << RTT::endlog();
+    return false;
+  }
+  // the workers keep classifying the groups, which the reloaded properties have to allow
+  if (!group_first_joints.empty() && !checkJointGroups())
+    return false;
+  LimitSet* limit_set = beginLimitSetWrite();
+  if (!limit_set || !buildLimitSet(*limit_set))
+    return false;
+  limit_set->coupled_regions = limit_sets.published().coupled_regions;
+  if (!checkCoupledRegionLevels(*limit_set))
+    return false;
+  limit_sets.publish();
+  RTT::Logger::log(RTT::Logger::Info) << "singularity limits reloaded" << RTT::endlog();
+  return true;
+}
+
+
+/**
+ * @brief Wait for a slot of limit_sets to write, to be called with limits_mutex held
+ * 
+ * The slot is the one used before the last publish, free once updateHook()
+ * has finished the cycle it was taken in and the queries started before have returned.
+ * 
+ * @return LimitSet*  slot to fill, NULL if it stays in use for longer than one second
+ */
+SingularityDetector::LimitSet* SingularityDetector::beginLimitSetWrite() {
+  for (int attempt=0; attempt<1000; attempt++) {
+    LimitSet* limit_set = limit_sets.beginWrite();
+    if (limit_set)
+      return limit_set;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  RTT::Logger::log(RTT::Logger::Error) << "previous limits are still in use" << RTT::endlog();
+  return NULL;
+}
+
+
+/**
+ * @brief Load the regions of coupled_regions_file into the spatial index of a limit set
+ * 
+ * Touches only the coupled regions of the set, so it may run while its limits are compiled.
+ * Their levels are checked by checkCoupledRegionLevels() once the limit table is built.
+ * 
+ * @param limit_set   set to load the regions into
+ * @return true   if the regions have been loaded, always when no file is given
+ * @return false  if the file cannot be read or holds invalid regions
+ */
+bool SingularityDetector::configureCoupledRegions(LimitSet& limit_set) const {
+  CoupledRegionIndex& coupled_regions = limit_set.coupled_regions;
+  std::string error;
+  if (coupled_regions_file.empty()) {
+    coupled_regions.build(number_of_joints, std::vector<CoupledRegionIndex::Region>(), error);
+    return true;
+  }
+  std::ifstream file(coupled_regions_file.c_str());
+  if (!file) {
+    RTT::Logger::log(RTT::Logger::Error) << "cannot open coupled regions file: " << coupled_regions_file
+                                         << RTT::endlog();
+    return false;
+  }
+  if (!coupled_regions.load(file, number_of_joints, error)) {
+    RTT::Logger::log(RTT::Logger::Error) << error << RTT::endlog();
+    return false;
+  }
+  if (incremental_evaluation && !coupled_regions.empty())
+    RTT::Logger::log(RTT::Logger::Warning) << "classification is not skipped with coupled regions" << RTT::endlog();
+  RTT::Logger::log(RTT::Logger::Info) << coupled_regions.size() << " coupled singularity regions loaded"
+                                      << RTT::endlog();
+  return true;
+}
+
+
+/**
+ * @brief Check the levels of the coupled regions of a limit set against the levels of its limit table
+ * 
+ * @param limit_set   set whose limit table and coupled regions are built
+ * @return true   if no region is above the highest level of the table
+ * @return false  otherwise
+ */
+bool SingularityDetector::checkCoupledRegionLevels(const LimitSet& limit_set) const {
+  int max_level = limit_set.limit_table.number_of_levels();
+  if (backend == kManipulabilityBackend)
+    max_level = std::max(max_level, static_cast<int>(manipulability_thresholds.size()));
+  if (limit_set.coupled_regions.max_level() > max_level) {
+    RTT::Logger::log(RTT::Logger::Error) << "coupled region level above " << max_level << RTT::endlog();
+    return false;
+  }
+  return true;
+}
+
+
+/**
+ * @brief Map the baked singularity map of singularity_map_file and check it against the runtime classifiers
+ * 
+ * The map must have been baked from the configured bands and joint periods of the interval
+ * backend and must not report a level above the runtime classifiers, checked
+ * always. singularity_map_verification_samples random positions of the map
+ * domain are classified both ways in addition. A conservative map must never
+ * report a lower level.
+ * 
+ * @return true   if the map is ready, always when no file is given
+ * @return false  if the map cannot be used or fails the verification
+ */
+bool SingularityDetector::configureSingularityMap() {
+  singularity_map.close();
+  if (singularity_map_file.empty())
+    return true;
+  std::string error;
+  if (!singularity_map.open(singularity_map_file, error)) {
+    RTT::Logger::log(RTT::Logger::Error) << error << RTT::endlog();
+    return false;
+  }
+  if (singularity_map.number_of_joints() != number_of_joints) {
+    RTT::Logger::log(RTT::Logger::Error) << "singularity map of " << singularity_map.number_of_joints()
+                                         << " joints, should be: " << number_of_joints << RTT::endlog();
+    singularity_map.close();
+    return false;
+  }
+  if (backend == kIntervalBackend && singularity_map.bands_key() != SingularityMap::bandsKey(limits->limit_table)) {
+    RTT::Logger::log(RTT::Logger::Error) << "singularity map was baked from other singularity bands or joint periods" << RTT::endlog();
+    singularity_map.close();
+    return false;
+  }
+  const int runtime_max_level = std::max(limits->coupled_regions.max_level(), backend == kManipulabilityBackend ?
+                                         static_cast<int>(manipulability_thresholds.size()) :
+                                         limits->limit_table.number_of_levels());
+  if (singularity_map.max_level() > runtime_max_level) {
+    RTT::Logger::log(RTT::Logger::Error) << "singularity map reports level " << singularity_map.max_level()
+                                         << ", above the highest runtime level " << runtime_max_level << RTT::endlog();
+    singularity_map.close();
+    return false;
+  }
+  if (publish_proximity || publish_joint_levels)
+    RTT::Logger::log(RTT::Logger::Warning) << "singularity map is not used while the proximity or the joint levels"
+                                           << " are published" << RTT::endlog();
+
+  std::mt19937_64 generator(0);
+  const SingularityMapHeader& header = *singularity_map.header();
+  Eigen::VectorXd position(number_of_joints);
+  int below = 0, above = 0;
+  for (int s=0; s<singularity_map_verification_samples; s++) {
+    for (int j=0; j<number_of_joints; j++)
+      position(j) = std::uniform_real_distribution<double>(header.lower[j], header.upper[j])(generator);
+    int level = backend == kManipulabilityBackend ? manipulability_backend.classify(position)
+                                                  : checkSingularityLevel(position);
+    level = std::max(level, limits->coupled_regions.classify(position.data()));
+    const int baked = singularity_map.lookup(position.data());
+    below += baked < level;
+    above += baked > level;
+  }
+  if (singularity_map_verification_samples > 0)
+    RTT::Logger::log(RTT::Logger::Info) << "singularity map verified at " << singularity_map_verification_samples
+                                        << " positions, below runtime: " << below << ", above runtime: " << above
+                                        << RTT::endlog();
+  if (singularity_map.conservative() && below > 0) {
+    RTT::Logger::log(RTT::Logger::Error) << "conservative singularity map reports lower levels than the runtime"
+                                         << " classifiers, it was baked from other limits" << RTT::endlog();
+    singularity_map.close();
+    return false;
+  }
+  return true;
+}
+
+
 /**
  * @brief Check singularity level in each periodic step 
  * 
+ * Real-time safe: only the limit table and the buffers preallocated in configureHook() are used.
  */
 void SingularityDetector::updateHook() {
-  if (port_joint_position.read(joint_position) == RTT::NewData) {
-    int singularity_level = checkSingularityLevel(number_of_joints, joint_position, l1_lower, l1_upper, l2_lower, l2_upper, l3_lower, l3_upper);
+  ScopedAllocationTrap allocation_trap;
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+  const RTT::os::TimeService::ticks cycle_start = RTT::os::TimeService::Instance()->getTicks();
+  RTT::os::TimeService::ticks sample_time = cycle_start;
+#endif
+  bool new_sample;
+  bool stamped = false;
+  if (joint_buffer) {
+    // the buffer may be written from another thread, so take a consistent snapshot of it
+    uint32_t sequence;
+    new_sample = joint_buffer->read(joint_position.data(), sequence) &&
+                 (!joint_buffer_read || sequence != joint_buffer_sequence);
+    if (new_sample) {
+      joint_buffer_read = true;
+      joint_buffer_sequence = sequence;
+    }
+  } else if (port_joint_state.connected()) {
+    new_sample = readJointState();
+    stamped = true;
+  } else if (input_burst_size > 0) {
+    new_sample = readJointBurst() > 0;
+  } else {
+    bool valid;
+    new_sample = readJointSample(true, valid) && valid;
+    if (new_sample)
+      joint_position = joint_sample;
+  }
+  if (new_sample && !stamped)
+    sample_stamp = rtt_rosclock::host_now();
+  // limits reloaded since the last cycle are taken over here, never in the middle of a cycle
+  uint64_t version;
+  limits = &limit_sets.acquire(version);
+  if (version != limits_version) {
+    // the slot may be the one used before, refilled by two reloads
+    limits_version = version;
+    incremental_classifier.invalidate();
+    // reloaded limits may switch the hysteresis on or off
+    level_filtering = limits->hysteresis > 0.0 || level_filter.min_dwell() > 0.0;
+  }
+  if (new_sample) {
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+    sample_time = RTT::os::TimeService::Instance()->getTicks();
+#endif
+    int singularity_level;
+    bool distance_measured = false;
+    // the map replaces the backend and the coupled regions inside of its domain
+    const int map_level = singularity_map.loaded() && !publish_proximity && !publish_joint_levels ?
+                          singularity_map.lookup(joint_position.data()) : -1;
+    if (map_level >= 0)
+      singularity_level = map_level;
+    else if (backend == kManipulabilityBackend)
+      singularity_level = manipulability_backend.classify(joint_position);
+    else if (publish_proximity)
+      singularity_level = limits->limit_table.classifyProximity(joint_position.data(),
+                                                                joint_singularity_proximity.data(),
+                                                                singularity_proximity.data,
+                                                                publish_joint_levels ?
+                                                                &joint_singularity_levels.data[0] : NULL);
+    else if (publish_joint_levels)
+      singularity_level = limits->limit_table.classifyEdges(joint_position.data(), &joint_singularity_levels.data[0]);
+    else if (publish_edge_distance && group_first_joints.empty()) {
+      singularity_level = limits->edge_cache.classifyDistance(joint_position.data(), joint_singularity_distance.data(),
+                                                              singularity_distance.data);
+      distance_measured = true;
+    } else if (!incremental_evaluation || !limits->coupled_regions.empty() || singularity_map.loaded() ||
+             incremental_classifier.needsUpdate(joint_position.data())) {
+      singularity_level = group_first_joints.empty() ? checkSingularityLevel(joint_position) : classifyJointGroups();
+      if (incremental_evaluation)
+        incremental_classifier.update(joint_position.data(), limits->edge_cache);
+    } else {
+      singularity_level = raw_singularity_level;   // still inside the last classified cell
+    }
+    if (publish_edge_distance && !distance_measured)
+      limits->edge_cache.classifyDistance(joint_position.data(), joint_singularity_distance.data(),
+                                          singularity_distance.data);
+    if (map_level < 0 && !limits->coupled_regions.empty())
+      singularity_level = std::max(singularity_level, limits->coupled_regions.classify(joint_position.data()));
+    raw_singularity_level = singularity_level;
+    // a short excursion between two cycles raises the level as if it was the latest sample
+    if (joint_burst_count > 0)
+      singularity_level = std::max(singularity_level, classifyJointBurst());
+    if (level_filtering)
+      singularity_level = filterLevel(singularity_level);
     singularity_scaling.data = singularity_level+1;
+    if (journal.opened() && singularity_level != journal_level)
+      recordTransition(singularity_level);
+  }
+  // every cycle, so that cross-process readers see the detector alive by the increasing cycle
+  if (level_publisher.opened())
+    level_publisher.publish(singularity_scaling.data-1, singularity_proximity.data,
+                            publish_proximity ? joint_singularity_proximity.data() : NULL,
+                            publish_joint_levels ? &joint_singularity_levels.data[0] : NULL);
+  if (!incremental_evaluation || !scaling_published || singularity_scaling.data != published_scaling ||
+      (heartbeat_period > 0.0 && RTT::os::TimeService::Instance()->secondsSince(last_publish_time) >= heartbeat_period)) {
+    port_singularity_scaling.write(singularity_scaling);
+    scaling_published = true;
+    published_scaling = singularity_scaling.data;
+    last_publish_time = RTT::os::TimeService::Instance()->getTicks();
+  }
+  if (new_sample && port_singularity_level_stamped.connected()) {
+    singularity_level_stamped.header.seq++;
+    singularity_level_stamped.header.stamp = sample_stamp;
+    singularity_level_stamped.level = singularity_scaling.data-1;
+    singularity_level_stamped.proximity = singularity_proximity.data;
+    singularity_level_stamped.sample_age = (rtt_rosclock::host_now() - sample_stamp).toSec();
+    port_singularity_level_stamped.write(singularity_level_stamped);
+  }
+  if (new_sample && look_ahead_horizon > 0.0)
+    predictSingularityLevel();
+  if (publish_proximity) {
+    port_singularity_proximity.write(singularity_proximity);
+    port_joint_singularity_proximity.write(joint_singularity_proximity);
+  }
+  if (publish_joint_levels)
+    port_joint_singularity_levels.write(joint_singularity_levels);
+  if (!group_first_joints.empty())
+    port_joint_group_levels.write(joint_group_levels);
+  if (publish_edge_distance) {
+    port_singularity_distance.write(singularity_distance);
+    port_joint_singularity_distance.write(joint_singularity_distance);
+  }
+  if (new_sample && joint_burst_count > 0)
+    port_worst_sample_time.write(worst_sample_time);
+  // a reload may refill the set from now until the next cycle takes it again
+  limit_sets.release();
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+  const RTT::os::TimeService::ticks cycle_end = RTT::os::TimeService::Instance()->getTicks();
+  latency_recorder.record(RTT::os::TimeService::ticks2nsecs(cycle_end - cycle_start),
+                          new_sample ? RTT::os::TimeService::ticks2nsecs(cycle_end - sample_time) : -1);
+  if (latency_diagnostics_period > 0 && ++latency_diagnostics_counter >= latency_diagnostics_period) {
+    latency_diagnostics_counter = 0;
+    fillLatencyStatistics(latency_diagnostics.data());
+    port_latency_diagnostics.write(latency_diagnostics);
+  }
+#endif
+}
+
+
+/**
+ * @brief Check joint_groups and joint_group_cpus and take the groups over for the limit sets to build
+ * 
+ * The groups partition the joints, so the overall level stays the level of
+ * all joints; the proximity and joint level outputs, the singularity map and
+ * the other backends classify all joints at once and are not combined with groups.
+ * 
+ * @return true   if the groups are valid, always when none are given
+ * @return false  if the groups are not ascending from joint 0, a CPU is invalid or the configuration does
+ *                not support groups
+ */
+bool SingularityDetector::configureJointGroups() {
+  group_pool.stop();
+  group_first_joints.clear();
+  if (joint_groups.empty()) {
+    if (!joint_group_cpus.empty())
+      RTT::Logger::log(RTT::Logger::Warning) << "joint group cpus are ignored without joint groups" << RTT::endlog();
+    return true;
+  }
+  if (std::count_if(joint_group_cpus.begin(), joint_group_cpus.end(), [](int cpu) { return cpu < -1; }) > 0) {
+    RTT::Logger::log(RTT::Logger::Error) << "joint group cpus must be CPU numbers or -1" << RTT::endlog();
+    return false;
+  }
+  if (!checkJointGroups())
+    return false;
+  group_first_joints = joint_groups;
+  return true;
+}
+
+
+/**
+ * @brief Check joint_groups against the number of joints and the properties the groups cannot be combined with
+ * 
+ * Run by configureHook() and again by reloadLimits(), which rebuilds the group tables from the properties.
+ * 
+ * @return true   if the groups can be classified on the worker pool
+ * @return false  if the groups are invalid or incompatible
+ */
+bool SingularityDetector::checkJointGroups() const {
+  bool valid = joint_groups[0] == 0;
+  for (std::size_t g=1; g<joint_groups.size(); g++)
+    valid &= joint_groups[g] > joint_groups[g-1];
+  if (!valid || joint_groups.back() >= number_of_joints) {
+    RTT::Logger::log(RTT::Logger::Error) << "joint groups must start at joint 0 and ascend below " << number_of_joints
+                                         << RTT::endlog();
+    return false;
+  }
+  if (detection_backend != "interval" || numeric_mode != "double" || publish_proximity || publish_joint_levels ||
+      !singularity_map_file.empty()) {
+    RTT::Logger::log(RTT::Logger::Error) << "joint groups need the interval backend in double mode, without "
+                                         << "proximity, joint levels or a singularity map" << RTT::endlog();
+    return false;
+  }
+  return true;
+}
+
+
+/**
+ * @brief Classify every joint group of joint_position on the worker pool, real-time safe
+ * 
+ * @return int  index of the highest singularity level of all groups
+ */
+int SingularityDetector::classifyJointGroups() {
+  group_pool.run();
+  int level = 0;
+  for (int g=0; g<group_pool.number_of_tasks(); g++) {
+    joint_group_levels.data[g] = static_cast<uint8_t>(group_pool.result(g));
+    level = std::max(level, group_pool.result(g));
+  }
+  return level;
+}
+
+
+/**
+ * @brief Task of group_pool: classify one joint group of joint_position against the limits of the cycle
+ * 
+ * @param context   the detector
+ * @param group     index of the joint group
+ * @return int      index of the singularity level of the group
+ */
+int SingularityDetector::classifyJointGroup(void* context, int group) {
+  const SingularityDetector* detector = static_cast<const SingularityDetector*>(context);
+  return detector->limits->group_tables[group].classify(detector->joint_position.data() +
+                                                        detector->group_first_joints[group]);
+}
+
+
+/**
+ * @brief Journal a transition of the published level to the level of joint_position
+ * 
+ * Real-time safe and only called on transitions. The triggering joint is the
+ * first joint whose band of the new level holds it, -1 if the level does not
+ * come from a single joint's band.
+ * 
+ * @param level   index of the newly published singularity level
+ */
+void SingularityDetector::recordTransition(int level) {
+  int trigger_joint = -1;
+  if (level > 0 && backend == kIntervalBackend) {
+    limits->limit_table.classifyJoints(joint_position.data(), &journal_joint_levels[0]);
+    for (int i=0; i<number_of_joints && trigger_joint<0; i++) {
+      if (journal_joint_levels[i] == level)
+        trigger_joint = i;
+    }
   }
-  port_singularity_scaling.write(singularity_scaling);
+  journal.record(static_cast<int64_t>(sample_stamp.toNSec()), journal_level, level, trigger_joint,
+                 joint_position.data());
+  journal_level = level;
+}
+
+
+/**
+ * @brief Pass the level of the last sample through the hysteresis and dwell time filter
+ * 
+ * @param raw_level   index of the singularity level of joint_position
+ * @return int        index of the singularity level to publish
+ */
+int SingularityDetector::filterLevel(int raw_level) {
+  int released_level = raw_level;
+  // the widened bands only matter while a lower level waits to be released
+  if (raw_level < level_filter.level() && backend == kIntervalBackend && limits->hysteresis > 0.0)
+    released_level = std::max(limits->hysteresis_table.classify(joint_position.data()),
+                              limits->coupled_regions.classify(joint_position.data()));
+  const double now = 1e-9 * RTT::os::TimeService::ticks2nsecs(RTT::os::TimeService::Instance()->getTicks());
+  return level_filter.update(raw_level, released_level, now);
+}
+
+
+/**
+ * @brief Predict the level reached within look_ahead_horizon from joint_position and publish it
+ * 
+ * The velocity is read from port_joint_velocity when it is connected, otherwise
+ * it is the finite difference of the last two samples.
+ */
+void SingularityDetector::predictSingularityLevel() {
+  const RTT::os::TimeService::ticks now = RTT::os::TimeService::Instance()->getTicks();
+  if (!port_joint_velocity.connected() || port_joint_velocity.read(joint_velocity) == RTT::NoData ||
+      joint_velocity.size() != number_of_joints) {
+    const double dt = 1e-9 * RTT::os::TimeService::ticks2nsecs(now - previous_sample_time);
+    if (previous_sample_valid && dt > 0.0)
+      joint_velocity = (joint_position - previous_joint_position) / dt;
+    else
+      joint_velocity.setZero(number_of_joints);
+  }
+  previous_joint_position = joint_position;
+  previous_sample_time = now;
+  previous_sample_valid = true;
+
+  const int predicted_level = limits->limit_table.predictLevel(joint_position.data(), joint_velocity.data(),
+                                                               look_ahead_horizon, joint_singularity_entry_time.data(),
+                                                               singularity_entry_time.data);
+  predicted_singularity_scaling.data = predicted_level+1;
+  port_predicted_singularity_scaling.write(predicted_singularity_scaling);
+  port_singularity_entry_time.write(singularity_entry_time);
+  port_joint_singularity_entry_time.write(joint_singularity_entry_time);
 }
 
 
@@ -79,24 +1123,14 @@ void SingularityDetector::updateHook() {
  * @return false  if any of singularity level limits has wrong size
  */
 bool SingularityDetector::checkAllLimitsSize(int number_of_joints_,
-                                              std::vector<double> l1_lower_, std::vector<double> l1_upper_, 
-                                              std::vector<double> l2_lower_, std::vector<double> l2_upper_, 
-                                              std::vector<double> l3_lower_, std::vector<double> l3_upper_) {
-  std::vector<std::vector<double> > lower_limits {l1_lower_,l2_lower_,l3_lower_};
-  std::vector<std::vector<double> > upper_limits {l1_upper_,l2_upper_,l3_upper_};
-  for (int i=0; i<lower_limits.size(); i++){
-    if (lower_limits[i].size() != number_of_joints_){
-      RTT::Logger::log(RTT::Logger::Error)  << i << " lower limit wrong size: " << lower_limits[i].size() 
-                                            << ", should be: " << number_of_joints_ << RTT::endlog();
-      return false;
-    }
-  }
-  for (int i=0; i<upper_limits.size(); i++){
-    if (upper_limits[i].size() != number_of_joints_){
-      RTT::Logger::log(RTT::Logger::Error)  << i << " upper limit wrong size: " << upper_limits[i].size() 
-                                            << ", should be: " << number_of_joints_ << RTT::endlog();
-      return false;
-    }
+                                              const std::vector<double>& l1_lower_, const std::vector<double>& l1_upper_, 
+                                              const std::vector<double>& l2_lower_, const std::vector<double>& l2_upper_, 
+                                              const std::vector<double>& l3_lower_, const std::vector<double>& l3_upper_) const {
+  std::string error;
+  if (!singularity_detector::checkAllLimitsSize(number_of_joints_, l1_lower_, l1_upper_, l2_lower_, l2_upper_,
+                                                l3_lower_, l3_upper_, error)) {
+    RTT::Logger::log(RTT::Logger::Error) << error << RTT::endlog();
+    return false;
   }
   return true;
 }
@@ -114,33 +1148,172 @@ bool SingularityDetector::checkAllLimitsSize(int number_of_joints_,
  * @param l3_upper_           vector of upper limits for 3st singularity stage for all joints
  * @return int                index of the singularity level of actual position 
  */
-int SingularityDetector::checkSingularityLevel(int number_of_joints_, Eigen::VectorXd joint_position, 
-                                                  std::vector<double> l1_lower_, std::vector<double> l1_upper_, 
-                                                  std::vector<double> l2_lower_, std::vector<double> l2_upper_, 
-                                                  std::vector<double> l3_lower_, std::vector<double> l3_upper_) {
-  int max = 0;
-  int temp = 0;
-  //find the highest level of proximity to the singularity achieved by any axis
-  for (int i=0; i< number_of_joints; i++) {
-    if (joint_position[i]<l3_upper_[i] && joint_position[i]>l3_lower_[i]) {
-      temp = 3;
-      max = 3;
-      break;
-    }
-    else if (joint_position[i]<l2_upper_[i] && joint_position[i]>l2_lower_[i]) {
-      temp = 2;
-    }
-    else if (joint_position[i]<l1_upper_[i] && joint_position[i]>l1_lower_[i]) {
-      temp = 1;
-    }
-    else {
-      temp = 0;
-    }
-    if (temp >= max) {
-      max = temp;
-    }
+int SingularityDetector::checkSingularityLevel(int number_of_joints_, const Eigen::VectorXd& joint_position, 
+                                                  const std::vector<double>& l1_lower_, const std::vector<double>& l1_upper_, 
+                                                  const std::vector<double>& l2_lower_, const std::vector<double>& l2_upper_, 
+                                                  const std::vector<double>& l3_lower_, const std::vector<double>& l3_upper_) const {
+  return singularity_detector::checkSingularityLevel(number_of_joints_, joint_position.data(), l1_lower_, l1_upper_,
+                                                     l2_lower_, l2_upper_, l3_lower_, l3_upper_);
+}
+
+/**
+ * @brief Compare joint position to the limits taken over by updateHook()
+ * 
+ * @param joint_position      joint position being checked, of number_of_joints size
+ * @return int                index of the singularity level of actual position 
+ */
+int SingularityDetector::checkSingularityLevel(const Eigen::VectorXd& joint_position) const {
+  return classify(*limits, joint_position);
+}
+
+/**
+ * @brief Compare joint position to the limits of a limit set
+ * 
+ * @param limit_set           limits built by buildLimitSet()
+ * @param joint_position      joint position being checked, of number_of_joints size
+ * @return int                index of the singularity level of actual position 
+ */
+int SingularityDetector::classify(const LimitSet& limit_set, const Eigen::VectorXd& joint_position) {
+  switch (limit_set.core_variant) {
+    case kCore6:
+      return limit_set.core6.classify(joint_position.data());
+    case kCore7:
+      return limit_set.core7.classify(joint_position.data());
+    case kCompactCore:
+      return limit_set.compact_table.classify(joint_position.data());
+    default:
+      return limit_set.limit_table.classify(joint_position.data());
+  }
+}
+
+/**
+ * @brief Classify a batch of joint positions at once against the limits taken over by updateHook()
+ * 
+ * @param waypoints   joint positions, one column of number_of_joints size per waypoint
+ * @param levels      caller-provided buffer for the singularity level index of every waypoint
+ */
+void SingularityDetector::checkSingularityLevels(const Eigen::Ref<const Eigen::MatrixXd, 0, Eigen::OuterStride<> >& waypoints,
+                                                 uint8_t* levels) const {
+  classifyBatch(*limits, waypoints, levels);
+}
+
+/**
+ * @brief Classify a batch of joint positions at once
+ * 
+ * @param limit_set   limits built by buildLimitSet()
+ * @param waypoints   joint positions, one column of number_of_joints size per waypoint
+ * @param levels      caller-provided buffer for the singularity level index of every waypoint
+ */
+void SingularityDetector::classifyBatch(const LimitSet& limit_set,
+                                        const Eigen::Ref<const Eigen::MatrixXd, 0, Eigen::OuterStride<> >& waypoints,
+                                        uint8_t* levels) const {
+  limit_set.limit_table.classifyBatch(waypoints.data(), waypoints.cols(), waypoints.outerStride(), levels);
+  if (!limit_set.coupled_regions.empty()) {
+    for (Eigen::Index k=0; k<waypoints.cols(); k++)
+      levels[k] = std::max<int>(levels[k], limit_set.coupled_regions.classify(waypoints.col(k).data()));
+  }
+}
+
+/**
+ * @brief Operation classifying a whole trajectory for planners, executed in the caller's thread
+ * 
+ * Pins the last published limits without any lock, see classifyConfiguration().
+ * 
+ * @param waypoints   joint positions, one column of number_of_joints size per waypoint
+ * @param levels      singularity level index of every waypoint, resized only when too short
+ * @return true       if the trajectory has been classified
+ * @return false      if the component is not configured, has no interval limits or the waypoints have wrong size
+ */
+bool SingularityDetector::classifyTrajectory(const Eigen::MatrixXd& waypoints, std::vector<uint8_t>& levels) const {
+  int slot;
+  const LimitSet& limit_set = limit_sets.pin(slot);
+  const bool valid = limit_set.limit_table.number_of_joints() != 0 &&
+                     waypoints.rows() == limit_set.limit_table.number_of_joints();
+  if (valid) {
+    levels.resize(waypoints.cols());
+    if (waypoints.cols() > 0)
+      classifyBatch(limit_set, waypoints, &levels[0]);
+  }
+  limit_sets.unpin(slot);
+  return valid;
+}
+
+/**
+ * @brief Operation and in-process API classifying one configuration on demand, from any thread
+ * 
+ * The last published limits and coupled regions are pinned without any lock
+ * and never modified while pinned, so any number of threads may query at
+ * once without touching the state of updateHook() or delaying it. The
+ * limits are evaluated directly: neither the baked map nor the level filter
+ * are applied, and the manipulability backend is not queried.
+ * 
+ * @param joint_position      configuration to classify, of number_of_joints size
+ * @return int                index of its singularity level, -1 if the component is not configured,
+ *                            has no interval limits or the configuration has wrong size
+ */
+int SingularityDetector::classifyConfiguration(const Eigen::VectorXd& joint_position) const {
+  int slot;
+  const LimitSet& limit_set = limit_sets.pin(slot);
+  int level = -1;
+  if (limit_set.limit_table.number_of_joints() != 0 &&
+      joint_position.size() == limit_set.limit_table.number_of_joints())
+    level = std::max(classify(limit_set, joint_position), limit_set.coupled_regions.classify(joint_position.data()));
+  limit_sets.unpin(slot);
+  return level;
+}
+
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+void SingularityDetector::fillLatencyStatistics(double* statistics) const {
+  const LatencyHistogram::Summary summaries[] = {latency_recorder.cycle().summary(),
+                                                 latency_recorder.sample_to_output().summary()};
+  for (int h=0; h<2; h++) {
+    const LatencyHistogram::Summary& summary = summaries[h];
+    double* values = statistics + h * kLatencyStatisticsSize / 2;
+    values[0] = static_cast<double>(summary.count);
+    values[1] = summary.min;
+    values[2] = summary.p50;
+    values[3] = summary.p90;
+    values[4] = summary.p99;
+    values[5] = summary.p999;
+    values[6] = summary.max;
+  }
+}
+
+/**
+ * @brief Operation returning the statistics of cycle time and sample-to-output latency
+ * 
+ * @return std::vector<double>  count, min, p50, p90, p99, p99.9, max [us] of the cycle time, then the same of
+ *                              the time from reading a new joint position to writing its level
+ */
+std::vector<double> SingularityDetector::getLatencyStatistics() const {
+  std::vector<double> statistics(kLatencyStatisticsSize);
+  fillLatencyStatistics(&statistics[0]);
+  return statistics;
+}
+
+/**
+ * @brief Operation clearing the latency histograms, done by updateHook() at its next cycle
+ * 
+ */
+void SingularityDetector::resetLatencyStatistics() {
+  latency_recorder.requestClear();
+}
+
+/**
+ * @brief Operation taking all raw latency samples buffered since the last call
+ * 
+ * @return std::vector<double>  cycle time and sample-to-output latency [ns] of every buffered cycle, interleaved
+ */
+std::vector<double> SingularityDetector::drainLatencySamples() {
+  std::vector<double> samples;
+  LatencyRecorder::Sample sample;
+  while (latency_recorder.pop(sample)) {
+    samples.push_back(static_cast<double>(sample.cycle_ns));
+    samples.push_back(static_cast<double>(sample.sample_to_output_ns));
   }
-  return max;
+  return samples;
 }
+#endif
 
-ORO_CREATE_COMPONENT(SingularityDetector)
+ORO_CREATE_COMPONENT_LIBRARY()
+ORO_LIST_COMPONENT_TYPE(SingularityDetector)
@@ -12,17 +12,46 @@
 #include <rtt/Component.hpp>
 
 #include <rtt/extras/SlaveActivity.hpp>
+#include <rtt/os/TimeService.hpp>
 
+#include <mutex>
 #include <string>
 
 #include <eigen3/Eigen/Dense>
+#include <ros/time.h>
+#include <sensor_msgs/JointState.h>
+#include <singularity_detector/SingularityLevelStamped.h>
+#include <std_msgs/Float64.h>
 #include <std_msgs/UInt8.h>
+#include <std_msgs/UInt8MultiArray.h>
 #include <vector>
 
+#include "BandEdgeCache.h"
+#include "CompactLimitTable.h"
+#include "CoupledRegionIndex.h"
+#include "DoubleBuffer.h"
+#include "IncrementalClassifier.h"
+#include "JointGroupPool.h"
+#include "LevelFilter.h"
+#include "LimitTableCompiler.h"
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+#include "LatencyRecorder.h"
+#endif
+#include "ManipulabilityBackend.h"
+#include "SharedJointBuffer.h"
+#include "SingularityDetectorCore.h"
+#include "SingularityLevelPublisher.h"
+#include "SingularityLimitTable.h"
+#include "SingularityMap.h"
+#include "TransitionJournal.h"
 
 /**
  * @brief Class to detect and classify the position of a robot in the proximity of a singular position
  * 
+ * Besides the periodic mode, the detector may run as a slave of the controller's
+ * activity (RTT::extras::SlaveActivity) with the controller's SharedJointBuffer
+ * attached: the controller writes the buffer and calls update(), so the level
+ * of a position is available in the same tick the position was produced.
  */
 class SingularityDetector : public RTT::TaskContext {
  public:
@@ -40,15 +69,68 @@ class SingularityDetector : public RTT::TaskContext {
   virtual ~SingularityDetector();
 
   bool configureHook();
+  bool startHook();
   void updateHook();
-  bool checkAllLimitsSize(int number_of_joints_, std::vector<double> l1_lower_, std::vector<double> l1_upper_, std::vector<double> l2_lower_, std::vector<double> l2_upper_, std::vector<double> l3_lower_, std::vector<double> l3_upper_);
-  int checkSingularityLevel(int number_of_joints_, Eigen::VectorXd joint_position, std::vector<double> l1_lower_, std::vector<double> l1_upper_, std::vector<double> l2_lower_, std::vector<double> l2_upper_, std::vector<double> l3_lower_, std::vector<double> l3_upper_);
+  bool configureBackend();
+  bool reloadLimits();
+  bool configureSingularityMap();
+  int filterLevel(int raw_level);
+  void predictSingularityLevel();
+  bool attachJointBuffer(const SharedJointBuffer* buffer);
+  bool readJointState();
+  bool readJointSample(bool copy_old_data, bool& valid);
+  int readJointBurst();
+  int classifyJointBurst();
+  void recordTransition(int level);
+  bool configureJointGroups();
+  int classifyJointGroups();
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+  std::vector<double> getLatencyStatistics() const;
+  void resetLatencyStatistics();
+  std::vector<double> drainLatencySamples();
+#endif
+  bool checkAllLimitsSize(int number_of_joints_, const std::vector<double>& l1_lower_, const std::vector<double>& l1_upper_, const std::vector<double>& l2_lower_, const std::vector<double>& l2_upper_, const std::vector<double>& l3_lower_, const std::vector<double>& l3_upper_) const;
+  int checkSingularityLevel(int number_of_joints_, const Eigen::VectorXd& joint_position, const std::vector<double>& l1_lower_, const std::vector<double>& l1_upper_, const std::vector<double>& l2_lower_, const std::vector<double>& l2_upper_, const std::vector<double>& l3_lower_, const std::vector<double>& l3_upper_) const;
+  int checkSingularityLevel(const Eigen::VectorXd& joint_position) const;
+  void checkSingularityLevels(const Eigen::Ref<const Eigen::MatrixXd, 0, Eigen::OuterStride<> >& waypoints, uint8_t* levels) const;
+  bool classifyTrajectory(const Eigen::MatrixXd& waypoints, std::vector<uint8_t>& levels) const;
+  int classifyConfiguration(const Eigen::VectorXd& joint_position) const;
 
  protected:
   /// Input port to read actual position
   RTT::InputPort<Eigen::VectorXd> port_joint_position; 
+  /// Input port to read actual position with the time it was taken, used instead of port_joint_position when connected
+  RTT::InputPort<sensor_msgs::JointState> port_joint_state;
+  /// Output port to send the level with the time of its sample and the sample age
+  RTT::OutputPort<singularity_detector::SingularityLevelStamped> port_singularity_level_stamped;
   /// Output port to send singularity scaling coefficient
   RTT::OutputPort<std_msgs::UInt8> port_singularity_scaling;  
+  /// Output port to send the highest continuous proximity to the singularity of all joints
+  RTT::OutputPort<std_msgs::Float64> port_singularity_proximity;
+  /// Output port to send the continuous proximity to the singularity of every joint
+  RTT::OutputPort<Eigen::VectorXd> port_joint_singularity_proximity;
+  /// Output port to send the level of every joint and the band edge it is closer to, as (level, edge) pairs
+  RTT::OutputPort<std_msgs::UInt8MultiArray> port_joint_singularity_levels;
+  /// Output port to send the level of every joint group, see joint_groups
+  RTT::OutputPort<std_msgs::UInt8MultiArray> port_joint_group_levels;
+  /// Output port to send the signed distance of the joint closest to a level transition, see BandEdgeCache
+  RTT::OutputPort<std_msgs::Float64> port_singularity_distance;
+  /// Output port to send the signed distance of every joint to its nearest level transition
+  RTT::OutputPort<Eigen::VectorXd> port_joint_singularity_distance;
+  /// Input port to read actual velocity in look-ahead mode, estimated from the positions when not connected
+  RTT::InputPort<Eigen::VectorXd> port_joint_velocity;
+  /// Output port to send the singularity scaling coefficient predicted within look_ahead_horizon
+  RTT::OutputPort<std_msgs::UInt8> port_predicted_singularity_scaling;
+  /// Output port to send the time until the predicted level is reached
+  RTT::OutputPort<std_msgs::Float64> port_singularity_entry_time;
+  /// Output port to send the time until every joint enters its predicted band
+  RTT::OutputPort<Eigen::VectorXd> port_joint_singularity_entry_time;
+  /// Output port to send the estimated time [s] of the sample with the worst level of the last burst
+  RTT::OutputPort<std_msgs::Float64> port_worst_sample_time;
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+  /// Output port to send the latency statistics returned by getLatencyStatistics
+  RTT::OutputPort<Eigen::VectorXd> port_latency_diagnostics;
+#endif
   
  private:
   std::vector<double> l1_lower;
@@ -57,9 +139,187 @@ class SingularityDetector : public RTT::TaskContext {
   std::vector<double> l2_upper;
   std::vector<double> l3_lower;
   std::vector<double> l3_upper;
+  /// limits of any number of nested levels, each 2*number_of_joints long: lower limits, then upper ones;
+  /// replaces the singularity_level* properties when not empty
+  std::vector<double> singularity_bands;
+  /// period [rad] of every joint, e.g. 2*pi for continuous joints and 0 for the others; empty if none is periodic.
+  /// Coupled regions and the baked map see the positions as read, without reduction; the map has to be baked
+  /// with the same periods
+  std::vector<double> joint_periods;
+  /// directory the compiled limit tables are cached in, keyed by a hash of the limits; empty for no cache.
+  /// Limits found in the cache are neither validated nor built again
+  std::string limit_cache_directory;
   int number_of_joints;
+  /// classifier picked in configureHook() for the configured number of joints
+  enum CoreVariant { kDynamicCore, kCore6, kCore7, kCompactCore };
+  /// detection backend selected by the detection_backend property
+  enum Backend { kIntervalBackend, kManipulabilityBackend };
+
+  /// everything derived from the limit properties, replaced as a whole by reloadLimits()
+  struct LimitSet {
+    LimitSet() : hysteresis(0.0), core_variant(kDynamicCore) {}
+
+    SingularityLimitTable limit_table;
+    /// limit_table widened by hysteresis, the level_hysteresis the set was built with
+    SingularityLimitTable hysteresis_table;
+    double hysteresis;
+    SingularityDetectorCore<6> core6;
+    SingularityDetectorCore<7> core7;
+    CoreVariant core_variant;
+    /// regions of coupled_regions_file
+    CoupledRegionIndex coupled_regions;
+    /// sorted edges of limit_table
+    BandEdgeCache edge_cache;
+    /// limit_table quantized to numeric_mode, unused in double mode
+    CompactLimitTable compact_table;
+    /// joints of limit_table of every joint group, empty without joint groups
+    std::vector<SingularityLimitTable> group_tables;
+  };
+  bool buildLimitSet(LimitSet& limit_set) const;
+  bool configureCoupledRegions(LimitSet& limit_set) const;
+  bool checkCoupledRegionLevels(const LimitSet& limit_set) const;
+  bool checkJointGroups() const;
+  LimitSet* beginLimitSetWrite();
+  static int classifyJointGroup(void* context, int group);
+  static int classify(const LimitSet& limit_set, const Eigen::VectorXd& joint_position);
+  void classifyBatch(const LimitSet& limit_set,
+                     const Eigen::Ref<const Eigen::MatrixXd, 0, Eigen::OuterStride<> >& waypoints,
+                     uint8_t* levels) const;
+
+  /// limits built in configureHook() and reloadLimits(), taken over by updateHook() at the start of a cycle
+  DoubleBuffer<LimitSet> limit_sets;
+  /// set taken by updateHook(), read-only and valid until the end of the cycle
+  const LimitSet* limits;
+  /// version of limits in limit_sets, a new one is taken over with the hysteresis and the incremental state
+  uint64_t limits_version;
+  /// serializes the writers of limit_sets, readers pin its slots without any lock
+  std::mutex limits_mutex;
+  /// file of singularity regions over several joints, empty for none
+  std::string coupled_regions_file;
+  /// baked map answering lookups in place of the backend and the coupled regions, empty for none
+  std::string singularity_map_file;
+  /// number of random positions the map is sampled at in configureHook(), its bands and highest level are always checked
+  int singularity_map_verification_samples;
+  SingularityMap singularity_map;
+  /// number of waypoints from which a trajectory is classified on several threads
+  int batch_parallel_threshold;
+  /// numbers the level is classified in: "double" (default), "float32" or "fixed32";
+  /// the proximity, distances, prediction and trajectories stay in double
+  std::string numeric_mode;
+  /// fixed32 only: fixed-point units per joint position unit of every joint, e.g. encoder counts per radian
+  std::vector<double> position_resolution;
+  /// largest distance [rad] from a band edge at which the quantized limits may decide differently
+  double quantization_tolerance;
+  /// first joint of every joint group, ascending from 0, a group spans the joints up to the first of the next;
+  /// empty for a single group of all joints
+  std::vector<int> joint_groups;
+  /// CPU every worker classifying the joint groups is pinned to, -1 for a worker that is not pinned;
+  /// empty to classify the groups in the thread of updateHook()
+  std::vector<int> joint_group_cpus;
+  /// joint_groups taken over by configureHook(), the limit sets are built for these
+  std::vector<int> group_first_joints;
+  JointGroupPool group_pool;
+  std_msgs::UInt8MultiArray joint_group_levels;
+  /// publish the continuous proximity next to the level
+  bool publish_proximity;
+  /// publish the level and the closer band edge of every joint next to the level
+  bool publish_joint_levels;
+  /// publish the signed distance to the nearest level transition next to the level
+  bool publish_edge_distance;
+  /// "interval" (default) or "manipulability"; the interval limits are optional with the manipulability backend
+  std::string detection_backend;
+  /// URDF of the robot, used by the manipulability backend
+  std::string robot_description;
+  std::string base_link;
+  std::string tip_link;
+  /// "manipulability" or "min_singular_value"
+  std::string manipulability_metric;
+  /// measure below which level 1, 2, 3 is reached
+  std::vector<double> manipulability_thresholds;
+  /// largest joint motion [rad] for which the last Jacobian evaluation is reused
+  double jacobian_reuse_tolerance;
+  Backend backend;
+  ManipulabilityBackend manipulability_backend;
+  /// skip classification while the level cannot have changed and publish only on level change
+  bool incremental_evaluation;
+  /// period [s] of republishing an unchanged level in incremental mode, 0 to publish only on change
+  double heartbeat_period;
+  IncrementalClassifier incremental_classifier;
+  /// level of the last sample before filtering
+  int raw_singularity_level;
+  /// width [rad] the bands are widened by before a lower level is released, 0 for no hysteresis
+  double level_hysteresis;
+  /// time [s] a lower level has to persist before it is published, 0 to publish it at once
+  double level_min_dwell;
+  bool level_filtering;
+  LevelFilter level_filter;
+  /// time [s] the joints are extrapolated at constant velocity, 0 to disable look-ahead
+  double look_ahead_horizon;
+  Eigen::VectorXd joint_velocity;
+  Eigen::VectorXd previous_joint_position;
+  RTT::os::TimeService::ticks previous_sample_time;
+  bool previous_sample_valid;
+  std_msgs::UInt8 predicted_singularity_scaling;
+  std_msgs::Float64 singularity_entry_time;
+  Eigen::VectorXd joint_singularity_entry_time;
+  bool scaling_published;
+  uint8_t published_scaling;
+  RTT::os::TimeService::ticks last_publish_time;
+  /// controller buffer read instead of port_joint_position when attached
+  const SharedJointBuffer* joint_buffer;
+  bool joint_buffer_read;
+  uint32_t joint_buffer_sequence;
+  /// largest number of samples drained from a buffered port_joint_position connection per cycle,
+  /// 0 to read only the latest sample
+  int input_burst_size;
+  /// period [s] the samples are written to port_joint_position at, 0 to spread a burst evenly over the last cycle
+  double input_sample_period;
+  /// samples of the last burst, one column per sample, the latest one last
+  Eigen::MatrixXd joint_burst;
+  std::vector<uint8_t> joint_burst_levels;
+  int joint_burst_count;
+  RTT::os::TimeService::ticks previous_burst_time;
+  bool previous_burst_valid;
+  std_msgs::Float64 worst_sample_time;
+  sensor_msgs::JointState joint_state;
+  /// age [s] from which a stamped sample is dropped without being classified, 0 to classify every sample
+  double max_sample_age;
+  /// time the last sample was taken, the read time for samples without a stamp
+  ros::Time sample_stamp;
+  singularity_detector::SingularityLevelStamped singularity_level_stamped;
+#ifdef SINGULARITY_DETECTOR_INSTRUMENTATION
+  /// count, min, p50, p90, p99, p99.9, max of the cycle time and of the sample-to-output latency
+  static const int kLatencyStatisticsSize = 14;
+  void fillLatencyStatistics(double* statistics) const;
+
+  /// number of cycles between two writes of port_latency_diagnostics, 0 to never write it
+  int latency_diagnostics_period;
+  /// number of raw samples buffered for drainLatencySamples
+  int latency_ring_capacity;
+  int latency_diagnostics_counter;
+  LatencyRecorder latency_recorder;
+  Eigen::VectorXd latency_diagnostics;
+#endif
   std_msgs::UInt8 singularity_scaling;
+  std_msgs::Float64 singularity_proximity;
+  Eigen::VectorXd joint_singularity_proximity;
+  std_msgs::UInt8MultiArray joint_singularity_levels;
+  std_msgs::Float64 singularity_distance;
+  Eigen::VectorXd joint_singularity_distance;
+  /// POSIX shared-memory segment the level is written to every cycle, empty for none
+  std::string shared_memory_name;
+  SingularityLevelPublisher level_publisher;
+  /// binary file every transition of the published level is journaled to, empty for none
+  std::string journal_file;
+  /// number of transitions buffered until the drain thread writes them
+  int journal_capacity;
+  TransitionJournal journal;
+  /// published level the last transition was journaled to
+  int journal_level;
+  std::vector<uint8_t> journal_joint_levels;
   Eigen::VectorXd joint_position;
+  /// sample read from port_joint_position, taken over by joint_position only if it has the right size
+  Eigen::VectorXd joint_sample;
 };
 
 #endif  // SINGULARITY_DETECTOR_H_
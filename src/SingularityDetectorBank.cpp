@@ -0,0 +1,148 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "SingularityDetectorBank.h"
+#include "AllocationTrap.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+SingularityDetectorBank::SingularityDetectorBank(const std::string& name)
+    : RTT::TaskContext(name, PreOperational),
+      concatenated_input(false) {
+
+  this->addProperty("number_of_joints", number_of_joints);
+  this->addProperty("singularity_level1_lower", l1_lower);
+  this->addProperty("singularity_level1_upper", l1_upper);
+  this->addProperty("singularity_level2_lower", l2_lower);
+  this->addProperty("singularity_level2_upper", l2_upper);
+  this->addProperty("singularity_level3_lower", l3_lower);
+  this->addProperty("singularity_level3_upper", l3_upper);
+  this->addProperty("concatenated_input", concatenated_input);
+  this->addPort("JointPosition", port_joint_position);
+}
+
+SingularityDetectorBank::~SingularityDetectorBank() {
+}
+
+
+/**
+ * @brief Build the common limit table and create the ports of every robot
+ * 
+ * @return true   to indicate that configuration succeeded and the Stopped state may be entered. 
+ * @return false  to indicate that configuration failed and the Preoperational state is entered. 
+ */
+bool SingularityDetectorBank::configureHook() {
+  try {
+    removeRobotPorts();
+    if (number_of_joints.empty())
+      return false;
+    int total_joints = 0;
+    joint_offset.clear();
+    for (size_t r=0; r<number_of_joints.size(); r++) {
+      if (number_of_joints[r] <= 0) {
+        RTT::Logger::log(RTT::Logger::Error) << "robot " << r << " has no joints" << RTT::endlog();
+        return false;
+      }
+      joint_offset.push_back(total_joints);
+      total_joints += number_of_joints[r];
+    }
+    const std::vector<double>* const lower_limits[] = {&l1_lower, &l2_lower, &l3_lower};
+    const std::vector<double>* const upper_limits[] = {&l1_upper, &l2_upper, &l3_upper};
+    if (!limit_table.build(total_joints, lower_limits, upper_limits)) {
+      RTT::Logger::log(RTT::Logger::Error) << "every limit should have " << total_joints
+                                           << " values, the joints of all robots" << RTT::endlog();
+      return false;
+    }
+
+    // positions not received yet are NaN, which no band holds
+    joint_position.setConstant(total_joints, std::numeric_limits<double>::quiet_NaN());
+    joint_levels.assign(total_joints, 0);
+    robot_joint_position.resize(number_of_joints.size());
+    singularity_scaling.resize(number_of_joints.size());
+    for (size_t r=0; r<number_of_joints.size(); r++) {
+      std::ostringstream index;
+      index << r;
+      if (!concatenated_input) {
+        robot_joint_position[r].setZero(number_of_joints[r]);
+        port_robot_joint_position.emplace_back(new RTT::InputPort<Eigen::VectorXd>());
+        this->addPort("JointPosition" + index.str(), *port_robot_joint_position.back());
+      }
+      singularity_scaling[r].data = 1;   // init scaling parameter value
+      port_singularity_scaling.emplace_back(new RTT::OutputPort<std_msgs::UInt8>());
+      port_singularity_scaling.back()->setDataSample(singularity_scaling[r]);
+      this->addPort("SingularityScaler" + index.str(), *port_singularity_scaling.back());
+    }
+    return true;
+  } catch (std::exception &e) {
+    RTT::Logger::log(RTT::Logger::Error) << e.what() << RTT::endlog();
+    return false;
+  } catch (...) {
+    RTT::Logger::log(RTT::Logger::Error) << "unknown exception !!!"
+                                         << RTT::endlog();
+    return false;
+  }
+  return true;
+}
+
+
+/**
+ * @brief Check singularity level of all robots in one pass in each periodic step
+ * 
+ */
+void SingularityDetectorBank::updateHook() {
+  ScopedAllocationTrap allocation_trap;
+  bool new_data = false;
+  if (concatenated_input) {
+    if (port_joint_position.read(joint_position) == RTT::NewData && joint_position.size() == limit_table.number_of_joints())
+      new_data = true;
+  } else {
+    for (size_t r=0; r<port_robot_joint_position.size(); r++) {
+      if (port_robot_joint_position[r]->read(robot_joint_position[r]) == RTT::NewData &&
+          robot_joint_position[r].size() == number_of_joints[r]) {
+        joint_position.segment(joint_offset[r], number_of_joints[r]) = robot_joint_position[r];
+        new_data = true;
+      }
+    }
+  }
+
+  if (new_data && joint_position.size() == limit_table.number_of_joints()) {
+    limit_table.classifyJoints(joint_position.data(), &joint_levels[0]);
+    for (size_t r=0; r<singularity_scaling.size(); r++) {
+      const std::vector<uint8_t>::const_iterator first = joint_levels.begin() + joint_offset[r];
+      singularity_scaling[r].data = *std::max_element(first, first + number_of_joints[r]) + 1;
+    }
+  }
+  for (size_t r=0; r<port_singularity_scaling.size(); r++)
+    port_singularity_scaling[r]->write(singularity_scaling[r]);
+}
+
+
+/**
+ * @brief Remove the ports of every robot created in configureHook()
+ * 
+ */
+void SingularityDetectorBank::cleanupHook() {
+  removeRobotPorts();
+}
+
+void SingularityDetectorBank::removeRobotPorts() {
+  for (size_t r=0; r<port_robot_joint_position.size(); r++) {
+    std::ostringstream index;
+    index << r;
+    this->ports()->removePort("JointPosition" + index.str());
+  }
+  for (size_t r=0; r<port_singularity_scaling.size(); r++) {
+    std::ostringstream index;
+    index << r;
+    this->ports()->removePort("SingularityScaler" + index.str());
+  }
+  port_robot_joint_position.clear();
+  port_singularity_scaling.clear();
+}
+
+ORO_LIST_COMPONENT_TYPE(SingularityDetectorBank)
@@ -0,0 +1,82 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SINGULARITY_DETECTOR_BANK_H_
+#define SINGULARITY_DETECTOR_BANK_H_
+
+#include <rtt/TaskContext.hpp>
+#include <rtt/Port.hpp>
+#include <rtt/Component.hpp>
+
+#include <memory>
+#include <string>
+
+#include <eigen3/Eigen/Dense>
+#include <std_msgs/UInt8.h>
+#include <stdint.h>
+#include <vector>
+
+#include "SingularityLimitTable.h"
+
+
+/**
+ * @brief Class to detect and classify the proximity to a singular position of several robots at once
+ * 
+ * The limits of all robots are packed into one limit table, so every cycle
+ * classifies all joints of all robots in a single vectorized pass.
+ */
+class SingularityDetectorBank : public RTT::TaskContext {
+ public:
+  /**
+   * @brief Construct a new Singularity Detector Bank:: Singularity Detector Bank object
+   * 
+   * @param name 
+   */
+  explicit SingularityDetectorBank(const std::string& name);
+
+  /**
+   * @brief Destroy the Singularity Detector Bank:: Singularity Detector Bank object
+   * 
+   */
+  virtual ~SingularityDetectorBank();
+
+  bool configureHook();
+  void updateHook();
+  void cleanupHook();
+
+ protected:
+  /// Input port to read actual position of all robots concatenated, used with concatenated_input
+  RTT::InputPort<Eigen::VectorXd> port_joint_position;
+  /// Input ports to read actual position of every robot, used without concatenated_input
+  std::vector<std::unique_ptr<RTT::InputPort<Eigen::VectorXd> > > port_robot_joint_position;
+  /// Output ports to send singularity scaling coefficient of every robot
+  std::vector<std::unique_ptr<RTT::OutputPort<std_msgs::UInt8> > > port_singularity_scaling;
+
+ private:
+  void removeRobotPorts();
+
+  /// number of joints of every robot
+  std::vector<int> number_of_joints;
+  /// limits of all robots concatenated in the order of number_of_joints
+  std::vector<double> l1_lower;
+  std::vector<double> l1_upper;
+  std::vector<double> l2_lower;
+  std::vector<double> l2_upper;
+  std::vector<double> l3_lower;
+  std::vector<double> l3_upper;
+  /// read the positions of all robots from one port instead of one port per robot
+  bool concatenated_input;
+
+  SingularityLimitTable limit_table;
+  /// index of the first joint of every robot in the concatenated position
+  std::vector<int> joint_offset;
+  Eigen::VectorXd joint_position;
+  std::vector<Eigen::VectorXd> robot_joint_position;
+  std::vector<uint8_t> joint_levels;
+  std::vector<std_msgs::UInt8> singularity_scaling;
+};
+
+#endif  // SINGULARITY_DETECTOR_BANK_H_
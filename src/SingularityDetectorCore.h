@@ -0,0 +1,84 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SINGULARITY_DETECTOR_CORE_H_
+#define SINGULARITY_DETECTOR_CORE_H_
+
+#include <array>
+
+#include <eigen3/Eigen/Dense>
+
+#include "SingularityLimitTable.h"
+
+
+/**
+ * @brief Singularity classifier specialized at compile time for N joints
+ *
+ * With the joint count known to the compiler the joint loop is fully
+ * unrolled and the limits live inline in the object, so a classification is
+ * a fixed sequence of compares without any per-cycle indirection.
+ *
+ * @tparam N  number of robot joints
+ */
+template <int N>
+class SingularityDetectorCore {
+ public:
+  typedef Eigen::Matrix<double, N, 1> JointVector;
+  static const int kNumberOfLevels = SingularityLimitTable::kNumberOfLevels;
+
+  SingularityDetectorCore()
+      : lower_(),
+        upper_() {
+  }
+
+  /**
+   * @brief Copy the limits from a table
+   *
+   * @param table   limit table built for N joints
+   * @return true   if the limits have been copied
+   * @return false  if the table describes a different number of joints or levels, or periodic joints
+   */
+  bool build(const SingularityLimitTable& table) {
+    if (table.number_of_joints() != N || table.view().number_of_levels != kNumberOfLevels || table.periodic())
+      return false;
+    for (int l=0; l<kNumberOfLevels; l++) {
+      for (int i=0; i<N; i++) {
+        lower_[l][i] = table.lower(l+1, i);
+        upper_[l][i] = table.upper(l+1, i);
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Find the highest level of proximity to the singularity achieved by any axis
+   *
+   * @param joint_position  joint position being checked, of N size
+   * @return int            index of the singularity level of the position, 0 if none
+   */
+  template <typename Derived>
+  int classify(const Eigen::MatrixBase<Derived>& joint_position) const {
+    int level = 0;
+    for (int l=0; l<kNumberOfLevels; l++) {
+      bool inside = false;
+      for (int i=0; i<N; i++)
+        inside |= (joint_position[i] < upper_[l][i]) & (joint_position[i] > lower_[l][i]);
+      // levels are visited in increasing order, so a hit always raises the level
+      level = inside ? l+1 : level;
+    }
+    return level;
+  }
+
+  int classify(const double* joint_position) const {
+    return classify(Eigen::Map<const JointVector>(joint_position));
+  }
+
+ private:
+  std::array<std::array<double, N>, kNumberOfLevels> lower_;
+  std::array<std::array<double, N>, kNumberOfLevels> upper_;
+};
+
+#endif  // SINGULARITY_DETECTOR_CORE_H_
@@ -0,0 +1,94 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "SingularityLevelPublisher.h"
+
+#include <cstring>
+#include <sstream>
+#include <time.h>
+
+using singularity_detector::SingularityLevelSegment;
+
+SingularityLevelPublisher::SingularityLevelPublisher()
+    : segment_(NULL),
+      number_of_joints_(0) {
+}
+
+SingularityLevelPublisher::~SingularityLevelPublisher() {
+  close();
+}
+
+void SingularityLevelPublisher::close() {
+  if (segment_)
+    munmap(segment_, sizeof(SingularityLevelSegment));
+  segment_ = NULL;
+  number_of_joints_ = 0;
+}
+
+bool SingularityLevelPublisher::open(const std::string& name, int number_of_joints, std::string& error) {
+  close();
+  if (number_of_joints <= 0 || number_of_joints > SingularityLevelSegment::kMaxJoints) {
+    std::ostringstream message;
+    message << "shared memory segment holds at most " << SingularityLevelSegment::kMaxJoints << " joints";
+    error = message.str();
+    return false;
+  }
+  const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    error = "cannot create shared memory: " + name;
+    return false;
+  }
+  void* mapping = MAP_FAILED;
+  if (ftruncate(fd, sizeof(SingularityLevelSegment)) == 0)
+    mapping = mmap(NULL, sizeof(SingularityLevelSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    error = "cannot map shared memory: " + name;
+    return false;
+  }
+  // keep the page resident, a page fault in publish() would stall the real-time thread
+  mlock(mapping, sizeof(SingularityLevelSegment));
+
+  segment_ = static_cast<SingularityLevelSegment*>(mapping);
+  number_of_joints_ = number_of_joints;
+  // a reused segment keeps its sequence, so readers never see it go back
+  uint32_t sequence = segment_->sequence.load(std::memory_order_relaxed);
+  sequence += sequence & 1;
+  segment_->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  segment_->version = SingularityLevelSegment::kVersion;
+  segment_->number_of_joints = number_of_joints;
+  segment_->level = 0;
+  segment_->proximity = 0.0;
+  std::memset(segment_->joint_proximity, 0, sizeof(segment_->joint_proximity));
+  std::memset(segment_->joint_levels, 0, sizeof(segment_->joint_levels));
+  std::memcpy(segment_->magic, singularity_detector::kSingularityLevelSegmentMagic,
+              sizeof(singularity_detector::kSingularityLevelSegmentMagic));
+  segment_->sequence.store(sequence + 2, std::memory_order_release);
+  return true;
+}
+
+void SingularityLevelPublisher::publish(int level, double proximity, const double* joint_proximity,
+                                        const uint8_t* joint_levels) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const uint32_t sequence = segment_->sequence.load(std::memory_order_relaxed);
+  segment_->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  segment_->level = level;
+  segment_->cycle++;
+  segment_->stamp_ns = static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+  segment_->proximity = proximity;
+  if (joint_proximity) {
+    for (int i=0; i<number_of_joints_; i++)
+      segment_->joint_proximity[i] = joint_proximity[i];
+  }
+  if (joint_levels) {
+    for (int i=0; i<2*number_of_joints_; i++)
+      segment_->joint_levels[i] = joint_levels[i];
+  }
+  segment_->sequence.store(sequence + 2, std::memory_order_release);
+}
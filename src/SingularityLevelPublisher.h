@@ -0,0 +1,60 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SINGULARITY_LEVEL_PUBLISHER_H_
+#define SINGULARITY_LEVEL_PUBLISHER_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "singularity_detector/SingularityLevelSegment.h"
+
+
+/**
+ * @brief Writer of the shared-memory segment read by singularity_detector::SingularityLevelReader
+ *
+ * The segment is created or reused by open(), outside of the real-time path;
+ * publish() only stores into the mapped memory and never blocks or
+ * allocates. The segment outlives the publisher, so readers keep their
+ * mapping across detector restarts and see the cycle stop while it is down.
+ */
+class SingularityLevelPublisher {
+ public:
+  SingularityLevelPublisher();
+  ~SingularityLevelPublisher();
+
+  /**
+   * @brief Create or reuse a shared-memory segment and map it
+   *
+   * @param name              POSIX shared-memory name, e.g. "/singularity_level"
+   * @param number_of_joints  number of robot joints, at most SingularityLevelSegment::kMaxJoints
+   * @param error             description of the problem when the segment cannot be used
+   * @return true   if the segment is ready for publish()
+   * @return false  if it cannot be created or mapped
+   */
+  bool open(const std::string& name, int number_of_joints, std::string& error);
+  void close();
+  bool opened() const { return segment_ != NULL; }
+
+  /**
+   * @brief Write the fields of one cycle
+   *
+   * @param level             index of the singularity level
+   * @param proximity         highest proximity of all joints
+   * @param joint_proximity   number_of_joints proximities, NULL to leave them zero
+   * @param joint_levels      number_of_joints (level, edge) pairs, NULL to leave them zero
+   */
+  void publish(int level, double proximity, const double* joint_proximity, const uint8_t* joint_levels);
+
+ private:
+  SingularityLevelPublisher(const SingularityLevelPublisher&);
+  SingularityLevelPublisher& operator=(const SingularityLevelPublisher&);
+
+  singularity_detector::SingularityLevelSegment* segment_;
+  int number_of_joints_;
+};
+
+#endif  // SINGULARITY_LEVEL_PUBLISHER_H_
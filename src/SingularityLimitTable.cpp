@@ -0,0 +1,343 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "SingularityLimitTable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#ifdef SINGULARITY_DETECTOR_WITH_TBB
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif
+
+namespace {
+
+/// default number of waypoints from which a batch is split over several threads
+const std::size_t kDefaultParallelThreshold = 4096;
+#ifdef SINGULARITY_DETECTOR_WITH_TBB
+/// smallest number of waypoints classified by one thread of the parallel batch
+const std::size_t kParallelGrainSize = 1024;
+#endif
+
+}  // namespace
+
+SingularityLimitTable::SingularityLimitTable()
+    : isa_(BandKernel::detect()),
+      classify_(BandKernel::classifyFunction(isa_)),
+      joint_levels_(BandKernel::jointLevelsFunction(isa_)),
+      parallel_threshold_(kDefaultParallelThreshold) {
+  view_.bands = NULL;
+  view_.wrap = NULL;
+  view_.number_of_levels = 0;
+  view_.number_of_joints = 0;
+  view_.padded_joints = 0;
+  view_.nested = false;
+}
+
+SingularityLimitTable::SingularityLimitTable(const SingularityLimitTable& other)
+    : bands_(other.bands_),
+      view_(other.view_),
+      isa_(other.isa_),
+      classify_(other.classify_),
+      joint_levels_(other.joint_levels_),
+      parallel_threshold_(other.parallel_threshold_) {
+  updateView(other.periodic());
+}
+
+SingularityLimitTable& SingularityLimitTable::operator=(const SingularityLimitTable& other) {
+  bands_ = other.bands_;
+  view_ = other.view_;
+  updateView(other.periodic());
+  isa_ = other.isa_;
+  classify_ = other.classify_;
+  joint_levels_ = other.joint_levels_;
+  parallel_threshold_ = other.parallel_threshold_;
+  return *this;
+}
+
+bool SingularityLimitTable::build(int number_of_joints,
+                                  const std::vector<double>* const lower_limits[kNumberOfLevels],
+                                  const std::vector<double>* const upper_limits[kNumberOfLevels]) {
+  if (number_of_joints <= 0)
+    return false;
+  std::vector<double> bands;
+  bands.reserve(2 * kNumberOfLevels * number_of_joints);
+  for (int l=0; l<kNumberOfLevels; l++) {
+    if (lower_limits[l]->size() != static_cast<std::size_t>(number_of_joints) ||
+        upper_limits[l]->size() != static_cast<std::size_t>(number_of_joints))
+      return false;
+    bands.insert(bands.end(), lower_limits[l]->begin(), lower_limits[l]->end());
+    bands.insert(bands.end(), upper_limits[l]->begin(), upper_limits[l]->end());
+  }
+  return build(number_of_joints, kNumberOfLevels, bands);
+}
+
+bool SingularityLimitTable::build(int number_of_joints, int number_of_levels, const std::vector<double>& bands) {
+  if (number_of_joints <= 0 || number_of_levels <= 0 || number_of_levels > kMaxLevels ||
+      bands.size() != static_cast<std::size_t>(2 * number_of_levels * number_of_joints))
+    return false;
+  const int width = BandKernel::kSimdWidth;
+  view_.number_of_levels = number_of_levels;
+  view_.number_of_joints = number_of_joints;
+  view_.padded_joints = (number_of_joints + width - 1) / width * width;
+
+  // padding lanes get an empty band (+inf, -inf) that no position falls into
+  bands_.resize(2 * number_of_levels * view_.padded_joints);
+  for (int l=0; l<number_of_levels; l++) {
+    double* lower = &bands_[row(l+1)];
+    double* upper = lower + view_.padded_joints;
+    const double* source = &bands[2 * l * number_of_joints];
+    for (int i=0; i<view_.padded_joints; i++) {
+      lower[i] = i < number_of_joints ? source[i] : std::numeric_limits<double>::infinity();
+      upper[i] = i < number_of_joints ? source[number_of_joints + i] : -std::numeric_limits<double>::infinity();
+    }
+  }
+  updateView(false);
+  view_.nested = true;
+  for (int l=1; l<number_of_levels; l++) {
+    for (int i=0; i<number_of_joints; i++)
+      view_.nested &= lower(l+1, i) >= lower(l, i) && upper(l+1, i) <= upper(l, i);
+  }
+  return true;
+}
+
+bool SingularityLimitTable::slice(const SingularityLimitTable& table, int first_joint, int number_of_joints) {
+  const int levels = table.number_of_levels();
+  if (number_of_joints <= 0 || first_joint < 0 || first_joint + number_of_joints > table.number_of_joints())
+    return false;
+  std::vector<double> bands;
+  bands.reserve(2 * levels * number_of_joints);
+  for (int l=1; l<=levels; l++) {
+    for (int i=0; i<number_of_joints; i++)
+      bands.push_back(table.lower(l, first_joint + i));
+    for (int i=0; i<number_of_joints; i++)
+      bands.push_back(table.upper(l, first_joint + i));
+  }
+  std::vector<double> periods;
+  if (table.periodic()) {
+    for (int i=0; i<number_of_joints; i++)
+      periods.push_back(table.period(first_joint + i));
+  }
+  std::string error;
+  if (!build(number_of_joints, levels, bands) || !setPeriods(periods, error))
+    return false;
+  setKernel(table.kernel());
+  parallel_threshold_ = table.parallel_threshold_;
+  return true;
+}
+
+void SingularityLimitTable::updateView(bool periodic) {
+  view_.bands = bands_.empty() ? NULL : &bands_[0];
+  view_.wrap = periodic ? &bands_[row(view_.number_of_levels + 1)] : NULL;
+}
+
+void SingularityLimitTable::widen(double margin) {
+  // the window of a periodic joint depends on its bands
+  bands_.resize(row(view_.number_of_levels + 1));
+  updateView(false);
+  // padding lanes stay empty, an infinite limit does not move
+  for (int l=1; l<=view_.number_of_levels; l++) {
+    double* lower = &bands_[row(l)];
+    double* upper = lower + view_.padded_joints;
+    for (int i=0; i<view_.padded_joints; i++) {
+      lower[i] -= margin;
+      upper[i] += margin;
+    }
+  }
+}
+
+bool SingularityLimitTable::setPeriods(const std::vector<double>& periods, std::string& error) {
+  const int n = view_.number_of_joints;
+  bands_.resize(row(view_.number_of_levels + 1));
+  updateView(false);
+  if (periods.empty() || std::count(periods.begin(), periods.end(), 0.0) == static_cast<long>(periods.size()))
+    return true;
+  if (periods.size() != static_cast<std::size_t>(n)) {
+    error = "joint periods wrong size";
+    return false;
+  }
+  // padding lanes and joints that are not periodic stay at zero period and inverse
+  std::vector<double> wrap(3 * view_.padded_joints, 0.0);
+  for (int i=0; i<n; i++) {
+    if (periods[i] == 0.0)
+      continue;
+    double lowest = std::numeric_limits<double>::infinity();
+    double highest = -std::numeric_limits<double>::infinity();
+    for (int l=1; l<=view_.number_of_levels; l++) {
+      lowest = std::min(lowest, lower(l, i));
+      highest = std::max(highest, upper(l, i));
+    }
+    if (!(periods[i] > 0.0) || !std::isfinite(lowest) || !std::isfinite(highest) || highest - lowest > periods[i]) {
+      error = "bands of periodic joint " + std::to_string(i) + " do not fit into its period";
+      return false;
+    }
+    wrap[i] = 0.5 * (lowest + highest);
+    wrap[view_.padded_joints + i] = periods[i];
+    wrap[2 * view_.padded_joints + i] = 1.0 / periods[i];
+  }
+  bands_.insert(bands_.end(), wrap.begin(), wrap.end());
+  updateView(true);
+  return true;
+}
+
+bool SingularityLimitTable::write(std::FILE* file) const {
+  const int32_t sizes[] = {view_.number_of_joints, view_.number_of_levels, view_.padded_joints, periodic(),
+                           view_.nested};
+  return std::fwrite(sizes, sizeof(sizes), 1, file) == 1 &&
+         (bands_.empty() || std::fwrite(&bands_[0], sizeof(double), bands_.size(), file) == bands_.size());
+}
+
+bool SingularityLimitTable::read(std::FILE* file, int number_of_joints) {
+  const int width = BandKernel::kSimdWidth;
+  int32_t sizes[5];
+  // the rows are padded to the SIMD width of the build that wrote them
+  if (std::fread(sizes, sizeof(sizes), 1, file) != 1 || number_of_joints <= 0 || sizes[0] != number_of_joints ||
+      sizes[1] <= 0 || sizes[1] > kMaxLevels || sizes[2] != (number_of_joints + width - 1) / width * width)
+    return false;
+  std::vector<double, AlignedAllocator<double, BandKernel::kAlignment> > bands(
+      (2 * sizes[1] + (sizes[3] ? 3 : 0)) * sizes[2]);
+  if (std::fread(&bands[0], sizeof(double), bands.size(), file) != bands.size())
+    return false;
+  bands_.swap(bands);
+  view_.number_of_joints = sizes[0];
+  view_.number_of_levels = sizes[1];
+  view_.padded_joints = sizes[2];
+  view_.nested = sizes[4] != 0;
+  updateView(sizes[3] != 0);
+  return true;
+}
+
+void SingularityLimitTable::setKernel(BandKernel::Isa isa) {
+  isa_ = BandKernel::isAvailable(isa) ? isa : BandKernel::kScalar;
+  classify_ = BandKernel::classifyFunction(isa_);
+  joint_levels_ = BandKernel::jointLevelsFunction(isa_);
+}
+
+int SingularityLimitTable::classifyEdges(const double* joint_position, uint8_t* joint_levels) const {
+  const int levels = view_.number_of_levels;
+  int max = 0;
+  for (int i=0; i<view_.number_of_joints; i++) {
+    const double q = wrap(i, joint_position[i]);
+    int level = 0;
+    for (int l=1; l<=levels; l++)
+      level = (q < upper(l, i) && q > lower(l, i)) ? l : level;
+    joint_levels[2*i] = static_cast<uint8_t>(level);
+    joint_levels[2*i+1] = closerEdge(level, i, q);
+    max = std::max(max, level);
+  }
+  return max;
+}
+
+int SingularityLimitTable::classifyProximity(const double* joint_position, double* proximity, double& overall,
+                                             uint8_t* joint_levels) const {
+  const int levels = view_.number_of_levels;
+  int max = 0;
+  overall = 0.0;
+  for (int i=0; i<view_.number_of_joints; i++) {
+    const double q = wrap(i, joint_position[i]);
+    int level = 0;
+    for (int l=1; l<=levels; l++)
+      level = (q < upper(l, i) && q > lower(l, i)) ? l : level;
+
+    double fraction = 0.0;
+    if (level == levels) {
+      // innermost band: 0 at its edges, 1 at its center
+      const double half_width = 0.5 * (upper(level, i) - lower(level, i));
+      const double center = lower(level, i) + half_width;
+      fraction = half_width > 0.0 ? 1.0 - std::fabs(q - center) / half_width : 1.0;
+    } else if (level > 0) {
+      // between the edge of this band and the edge of the next, inner one on the same side
+      const double outer = q <= lower(level+1, i) ? lower(level, i) : upper(level, i);
+      const double inner = q <= lower(level+1, i) ? lower(level+1, i) : upper(level+1, i);
+      fraction = inner != outer ? (q - outer) / (inner - outer) : 1.0;
+    }
+    fraction = std::min(std::max(fraction, 0.0), 1.0);
+    proximity[i] = level > 0 ? (level - 1 + fraction) / levels : 0.0;
+    if (joint_levels) {
+      joint_levels[2*i] = static_cast<uint8_t>(level);
+      joint_levels[2*i+1] = closerEdge(level, i, q);
+    }
+
+    max = std::max(max, level);
+    overall = std::max(overall, proximity[i]);
+  }
+  return max;
+}
+
+int SingularityLimitTable::predictLevel(const double* joint_position, const double* joint_velocity, double horizon,
+                                        double* entry_time, double& overall_entry_time) const {
+  const double never = std::numeric_limits<double>::infinity();
+  int max = 0;
+  overall_entry_time = never;
+  for (int i=0; i<view_.number_of_joints; i++) {
+    const double q = wrap(i, joint_position[i]);
+    const double v = joint_velocity[i];
+    const double p = period(i);
+    int level = 0;
+    double time = never;
+    // bands are nested, so every inner band is reached no earlier than the outer ones
+    for (int l=1; l<=view_.number_of_levels; l++) {
+      double t = never;
+      if (q < upper(l, i) && q > lower(l, i))
+        t = 0.0;
+      else if (q <= lower(l, i) && v > 0.0)
+        t = (lower(l, i) - q) / v;
+      else if (q >= upper(l, i) && v < 0.0)
+        t = (upper(l, i) - q) / v;
+      // a periodic joint moving away from the band reaches its image beyond the wrap of the window
+      else if (p > 0.0 && v > 0.0)
+        t = (lower(l, i) + p - q) / v;
+      else if (p > 0.0 && v < 0.0)
+        t = (upper(l, i) - p - q) / v;
+      if (t <= horizon) {
+        level = l;
+        time = t;
+      }
+    }
+    entry_time[i] = time;
+    if (level > max) {
+      max = level;
+      overall_entry_time = time;
+    } else if (level == max && level > 0) {
+      overall_entry_time = std::min(overall_entry_time, time);
+    }
+  }
+  return max;
+}
+
+void SingularityLimitTable::edgeMargins(const double* joint_position, double* margins) const {
+  for (int i=0; i<view_.number_of_joints; i++) {
+    const double q = wrap(i, joint_position[i]);
+    const double p = period(i);
+    double margin = std::numeric_limits<double>::infinity();
+    for (int l=1; l<=view_.number_of_levels; l++) {
+      margin = std::min(margin, std::min(std::fabs(q - lower(l, i)), std::fabs(q - upper(l, i))));
+      // edges of a periodic joint repeat one period away from the window
+      if (p > 0.0)
+        margin = std::min(margin, std::min(std::fabs(q - (lower(l, i) + p)), std::fabs(q - (upper(l, i) - p))));
+    }
+    margins[i] = margin;
+  }
+}
+
+void SingularityLimitTable::classifyBatch(const double* waypoints, std::size_t count, std::size_t stride,
+                                          uint8_t* levels) const {
+#ifdef SINGULARITY_DETECTOR_WITH_TBB
+  if (count >= parallel_threshold_) {
+    tbb::parallel_for(tbb::blocked_range<std::size_t>(0, count, kParallelGrainSize),
+                      [&](const tbb::blocked_range<std::size_t>& range) {
+      for (std::size_t k=range.begin(); k<range.end(); k++)
+        levels[k] = static_cast<uint8_t>(classify_(view_, waypoints + k * stride));
+    });
+    return;
+  }
+#endif
+  for (std::size_t k=0; k<count; k++)
+    levels[k] = static_cast<uint8_t>(classify_(view_, waypoints + k * stride));
+}
@@ -0,0 +1,263 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SINGULARITY_LIMIT_TABLE_H_
+#define SINGULARITY_LIMIT_TABLE_H_
+
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "AlignedAllocator.h"
+#include "BandKernel.h"
+
+
+/**
+ * @brief Singularity level limits of all joints, precomputed once at configuration time
+ *
+ * The table owns a private copy of the limits, so evaluating a joint position
+ * only reads preallocated memory and never touches the heap. Limits are stored
+ * as a structure of arrays, every row aligned and padded to the SIMD width,
+ * and classified by the fastest BandKernel the CPU supports.
+ */
+class SingularityLimitTable {
+ public:
+  /// Number of singularity levels of the legacy limits
+  static const int kNumberOfLevels = 3;
+  /// Highest number of singularity levels, the outputs report level+1 as uint8_t
+  static const int kMaxLevels = 254;
+  /// Edge of the band of its level a joint is closer to, reported next to the level by classifyEdges()
+  enum BandEdge { kNoEdge = 0, kLowerEdge = 1, kUpperEdge = 2 };
+
+  SingularityLimitTable();
+  SingularityLimitTable(const SingularityLimitTable& other);
+  SingularityLimitTable& operator=(const SingularityLimitTable& other);
+
+  /**
+   * @brief Copy the limits of all singularity levels into the table
+   *
+   * @param number_of_joints    number of robot joints
+   * @param lower_limits        lower limits of every singularity level, ordered from level 1
+   * @param upper_limits        upper limits of every singularity level, ordered from level 1
+   * @return true   if the table has been built
+   * @return false  if any of the limits has wrong size
+   */
+  bool build(int number_of_joints,
+             const std::vector<double>* const lower_limits[kNumberOfLevels],
+             const std::vector<double>* const upper_limits[kNumberOfLevels]);
+
+  /**
+   * @brief Copy an arbitrary number of singularity levels into the table
+   *
+   * @param number_of_joints    number of robot joints
+   * @param number_of_levels    number of singularity levels, at most kMaxLevels
+   * @param bands               2*number_of_joints limits per level, ordered from level 1:
+   *                            first the lower limits of all joints, then the upper ones
+   * @return true   if the table has been built
+   * @return false  if the limits have wrong size
+   */
+  bool build(int number_of_joints, int number_of_levels, const std::vector<double>& bands);
+
+  /**
+   * @brief Copy the limits and the periods of a range of joints of another table, e.g. of a joint group
+   *
+   * @param table               table to take the joints from
+   * @param first_joint         first joint of the range
+   * @param number_of_joints    number of joints of the range
+   * @return true   if the table has been built
+   * @return false  if the range is empty or not within the joints of table
+   */
+  bool slice(const SingularityLimitTable& table, int first_joint, int number_of_joints);
+
+  /**
+   * @brief Widen every band by the same margin on both sides
+   *
+   * @param margin  distance the lower limits are decreased and the upper limits increased by
+   */
+  void widen(double margin);
+
+  /**
+   * @brief Make joints periodic, e.g. continuous joints with a period of 2*pi
+   *
+   * A periodic joint is reduced into a window of one period around the center
+   * of its bands before being compared, so a band is hit after any number of
+   * full turns. All bands of a periodic joint have to fit into one period.
+   * To be called after build() and widen(), which drop the periods.
+   *
+   * @param periods   number_of_joints() periods, 0 for a joint that is not periodic; empty for none
+   * @param error     description of the first invalid period
+   * @return true   if the periods have been set
+   * @return false  if the periods have wrong size, are negative, or the bands of a periodic joint are
+   *                infinite or do not fit into one period
+   */
+  bool setPeriods(const std::vector<double>& periods, std::string& error);
+  /// Whether any joint is periodic
+  bool periodic() const { return view_.wrap != NULL; }
+  /// Period of a joint, 0 if it is not periodic
+  double period(int joint) const { return view_.wrap ? view_.wrap[view_.padded_joints + joint] : 0.0; }
+  /// Center of the period window of a joint, 0 if it is not periodic
+  double period_center(int joint) const { return view_.wrap ? view_.wrap[joint] : 0.0; }
+
+  /**
+   * @brief Reduce a joint position into the period window of its joint, the position itself if not periodic
+   */
+  double wrap(int joint, double q) const {
+    if (!view_.wrap)
+      return q;
+    return wrapPosition(q, view_.wrap[joint], view_.wrap[view_.padded_joints + joint],
+                        view_.wrap[2 * view_.padded_joints + joint]);
+  }
+
+  /**
+   * @brief Find the highest level of proximity to the singularity achieved by any axis
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   * @return int            index of the singularity level of the position, 0 if none
+   */
+  int classify(const double* joint_position) const { return classify_(view_, joint_position); }
+
+  /**
+   * @brief Find for every joint the highest level whose band holds it
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   * @param levels          buffer for number_of_joints() singularity level indices
+   */
+  void classifyJoints(const double* joint_position, uint8_t* levels) const {
+    joint_levels_(view_, joint_position, levels);
+  }
+
+  /**
+   * @brief Find the level of every joint and the band edge it is closer to, together with the highest level
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   * @param joint_levels    buffer for number_of_joints() pairs of singularity level index and BandEdge,
+   *                        kNoEdge for a joint outside of all bands
+   * @return int            index of the singularity level of the position, 0 if none
+   */
+  int classifyEdges(const double* joint_position, uint8_t* joint_levels) const;
+
+  /**
+   * @brief Classify a position and measure its continuous proximity to the singularity in the same pass
+   *
+   * Inside the band of level k and outside the band of level k+1 the proximity
+   * of a joint grows linearly from (k-1)/L at the outer edge to k/L at the
+   * inner one, L being the number of levels. In the innermost band it reaches
+   * 1 at the band center. Outside of all bands the proximity is 0.
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   * @param proximity       buffer for number_of_joints() proximities in [0,1]
+   * @param overall         highest proximity of all joints
+   * @param joint_levels    buffer for the pairs of classifyEdges(), NULL if not needed
+   * @return int            index of the singularity level of the position, 0 if none
+   */
+  int classifyProximity(const double* joint_position, double* proximity, double& overall,
+                        uint8_t* joint_levels = NULL) const;
+
+  /**
+   * @brief Predict the highest level reached within a time horizon at constant joint velocity
+   *
+   * A joint reaches a band once it is inside it or moves towards it and
+   * arrives before the horizon ends. Bands crossed completely within the
+   * horizon count as reached. A periodic joint reaches the next image of a
+   * band in its direction of motion, also through the wrap of its window.
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   * @param joint_velocity  pointer to number_of_joints() joint velocities
+   * @param horizon         look-ahead time [s]
+   * @param entry_time      buffer for number_of_joints() times [s] until every joint enters its predicted band,
+   *                        infinity if it reaches no band
+   * @param overall_entry_time  earliest entry time [s] of any joint into the band of the predicted level,
+   *                        infinity if no band is reached
+   * @return int            index of the predicted singularity level, 0 if none
+   */
+  int predictLevel(const double* joint_position, const double* joint_velocity, double horizon,
+                   double* entry_time, double& overall_entry_time) const;
+
+  /**
+   * @brief Measure how far every joint is from the closest edge of any band
+   *
+   * As long as no joint moves by more than its margin, no joint can leave or
+   * enter a band, so the level of the position cannot change.
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   * @param margins         buffer for number_of_joints() distances to the closest band edge
+   */
+  void edgeMargins(const double* joint_position, double* margins) const;
+
+  /**
+   * @brief Classify a whole trajectory against the table
+   *
+   * Trajectories of at least parallel_threshold() waypoints are split over
+   * several threads when the package is built with TBB.
+   *
+   * @param waypoints   pointer to the first joint of the first waypoint
+   * @param count       number of waypoints
+   * @param stride      distance in doubles between the first joints of consecutive waypoints
+   * @param levels      caller-provided buffer of count singularity level indices
+   */
+  void classifyBatch(const double* waypoints, std::size_t count, std::size_t stride, uint8_t* levels) const;
+
+  /**
+   * @brief Write the compiled limits and periods in the binary layout read back by read()
+   *
+   * @param file    stream opened for binary writing
+   * @return false  if the table could not be written completely
+   */
+  bool write(std::FILE* file) const;
+
+  /**
+   * @brief Read limits and periods written by write(), the kernel and the parallel threshold are kept
+   *
+   * @param file                stream opened for binary reading
+   * @param number_of_joints    number of joints the table must have
+   * @return true   if the table has been read
+   * @return false  if the stream holds no table of number_of_joints joints padded like this build, the
+   *                table is left unchanged then
+   */
+  bool read(std::FILE* file, int number_of_joints);
+
+  std::size_t parallel_threshold() const { return parallel_threshold_; }
+  void setParallelThreshold(std::size_t threshold) { parallel_threshold_ = threshold; }
+
+  /**
+   * @brief Select the classification kernel, the scalar one if the CPU does not support the instruction set
+   */
+  void setKernel(BandKernel::Isa isa);
+  BandKernel::Isa kernel() const { return isa_; }
+
+  int number_of_joints() const { return view_.number_of_joints; }
+  int number_of_levels() const { return view_.number_of_levels; }
+  /// Whether the band of every level lies within the band of the level below for all joints
+  bool nested() const { return view_.nested; }
+
+  int padded_joints() const { return view_.padded_joints; }
+  const BandTableView& view() const { return view_; }
+  double lower(int level, int joint) const { return bands_[row(level) + joint]; }
+  double upper(int level, int joint) const { return bands_[row(level) + view_.padded_joints + joint]; }
+
+ private:
+  int row(int level) const { return 2 * (level - 1) * view_.padded_joints; }
+  /// point view_ into bands_, the period rows follow the level rows when any joint is periodic
+  void updateView(bool periodic);
+  uint8_t closerEdge(int level, int joint, double q) const {
+    if (level == 0)
+      return kNoEdge;
+    return q - lower(level, joint) <= upper(level, joint) - q ? kLowerEdge : kUpperEdge;
+  }
+
+  /// rows stored level after level: [level 1 lower | level 1 upper | level 2 lower | ...],
+  /// then [center | period | inverse period] with periodic joints
+  std::vector<double, AlignedAllocator<double, BandKernel::kAlignment> > bands_;
+  BandTableView view_;
+  BandKernel::Isa isa_;
+  BandKernel::ClassifyFunction classify_;
+  BandKernel::JointLevelsFunction joint_levels_;
+  std::size_t parallel_threshold_;
+};
+
+#endif  // SINGULARITY_LIMIT_TABLE_H_
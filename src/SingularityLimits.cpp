@@ -0,0 +1,118 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "SingularityLimits.h"
+
+#include <cstddef>
+#include <sstream>
+
+#include "SingularityLimitTable.h"
+
+namespace singularity_detector {
+
+bool checkAllLimitsSize(int number_of_joints,
+                        const std::vector<double>& l1_lower, const std::vector<double>& l1_upper,
+                        const std::vector<double>& l2_lower, const std::vector<double>& l2_upper,
+                        const std::vector<double>& l3_lower, const std::vector<double>& l3_upper,
+                        std::string& error) {
+  const std::vector<double>* const lower_limits[] = {&l1_lower, &l2_lower, &l3_lower};
+  const std::vector<double>* const upper_limits[] = {&l1_upper, &l2_upper, &l3_upper};
+  const std::size_t size = number_of_joints > 0 ? number_of_joints : 0;
+  for (int i=0; i<3; i++){
+    if (lower_limits[i]->size() != size){
+      std::ostringstream message;
+      message << i << " lower limit wrong size: " << lower_limits[i]->size() << ", should be: " << number_of_joints;
+      error = message.str();
+      return false;
+    }
+  }
+  for (int i=0; i<3; i++){
+    if (upper_limits[i]->size() != size){
+      std::ostringstream message;
+      message << i << " upper limit wrong size: " << upper_limits[i]->size() << ", should be: " << number_of_joints;
+      error = message.str();
+      return false;
+    }
+  }
+  return true;
+}
+
+int checkSingularityLevel(int number_of_joints, const double* joint_position,
+                          const std::vector<double>& l1_lower, const std::vector<double>& l1_upper,
+                          const std::vector<double>& l2_lower, const std::vector<double>& l2_upper,
+                          const std::vector<double>& l3_lower, const std::vector<double>& l3_upper) {
+  int max = 0;
+  int temp = 0;
+  //find the highest level of proximity to the singularity achieved by any axis
+  for (int i=0; i< number_of_joints; i++) {
+    if (joint_position[i]<l3_upper[i] && joint_position[i]>l3_lower[i]) {
+      temp = 3;
+      max = 3;
+      break;
+    }
+    else if (joint_position[i]<l2_upper[i] && joint_position[i]>l2_lower[i]) {
+      temp = 2;
+    }
+    else if (joint_position[i]<l1_upper[i] && joint_position[i]>l1_lower[i]) {
+      temp = 1;
+    }
+    else {
+      temp = 0;
+    }
+    if (temp >= max) {
+      max = temp;
+    }
+  }
+  return max;
+}
+
+bool checkBandTable(int number_of_joints, const std::vector<double>& bands, int& number_of_levels, std::string& error) {
+  std::ostringstream message;
+  const std::size_t row = number_of_joints > 0 ? 2 * number_of_joints : 0;
+  if (row == 0 || bands.empty() || bands.size() % row != 0 || bands.size() / row > static_cast<std::size_t>(SingularityLimitTable::kMaxLevels)) {
+    message << "band table wrong size: " << bands.size() << ", should be a multiple of " << row
+            << " for at most " << SingularityLimitTable::kMaxLevels << " levels";
+    error = message.str();
+    return false;
+  }
+  const int levels = bands.size() / row;
+  for (int l=0; l<levels; l++) {
+    const double* lower = &bands[l * row];
+    const double* upper = lower + number_of_joints;
+    for (int i=0; i<number_of_joints; i++) {
+      if (!(lower[i] <= upper[i])) {
+        message << "level " << l+1 << " joint " << i << " lower limit above the upper one";
+        error = message.str();
+        return false;
+      }
+      if (l > 0 && !(lower[i] >= lower[i - static_cast<int>(row)] && upper[i] <= upper[i - static_cast<int>(row)])) {
+        message << "level " << l+1 << " joint " << i << " band not within the band of level " << l;
+        error = message.str();
+        return false;
+      }
+    }
+  }
+  number_of_levels = levels;
+  return true;
+}
+
+int checkSingularityLevel(int number_of_joints, int number_of_levels, const double* joint_position,
+                          const std::vector<double>& bands) {
+  int max = 0;
+  for (int i=0; i<number_of_joints; i++) {
+    for (int l=number_of_levels; l>max; l--) {
+      const double* lower = &bands[2 * (l - 1) * number_of_joints];
+      const double* upper = lower + number_of_joints;
+      if (joint_position[i] < upper[i] && joint_position[i] > lower[i]) {
+        max = l;
+        break;
+      }
+    }
+  }
+  return max;
+}
+
+}  // namespace singularity_detector
@@ -0,0 +1,91 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SINGULARITY_LIMITS_H_
+#define SINGULARITY_LIMITS_H_
+
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief Plain C++ core of the singularity classification, free of any RTT dependency
+ */
+namespace singularity_detector {
+
+/**
+ * @brief Check if all of singularity level limits have proper size
+ * 
+ * @param number_of_joints    number of robot joints
+ * @param l1_lower            vector of lower limits for 1st singularity stage for all joints
+ * @param l1_upper            vector of upper limits for 1st singularity stage for all joints
+ * @param l2_lower            vector of lower limits for 2st singularity stage for all joints
+ * @param l2_upper            vector of upper limits for 2st singularity stage for all joints
+ * @param l3_lower            vector of lower limits for 3st singularity stage for all joints
+ * @param l3_upper            vector of upper limits for 3st singularity stage for all joints
+ * @param error               description of the first wrong limit
+ * @return true   if all of singularity level limits have proper size 
+ * @return false  if any of singularity level limits has wrong size
+ */
+bool checkAllLimitsSize(int number_of_joints,
+                        const std::vector<double>& l1_lower, const std::vector<double>& l1_upper,
+                        const std::vector<double>& l2_lower, const std::vector<double>& l2_upper,
+                        const std::vector<double>& l3_lower, const std::vector<double>& l3_upper,
+                        std::string& error);
+
+/**
+ * @brief Compare every joint position to upper and lower limits of different singularity level
+ * 
+ * Reference implementation for the optimized classifiers, which must give the same result.
+ * 
+ * @param number_of_joints    number of robot joints
+ * @param joint_position      pointer to number_of_joints joint positions
+ * @param l1_lower            vector of lower limits for 1st singularity stage for all joints
+ * @param l1_upper            vector of upper limits for 1st singularity stage for all joints
+ * @param l2_lower            vector of lower limits for 2st singularity stage for all joints
+ * @param l2_upper            vector of upper limits for 2st singularity stage for all joints
+ * @param l3_lower            vector of lower limits for 3st singularity stage for all joints
+ * @param l3_upper            vector of upper limits for 3st singularity stage for all joints
+ * @return int                index of the singularity level of the position
+ */
+int checkSingularityLevel(int number_of_joints, const double* joint_position,
+                          const std::vector<double>& l1_lower, const std::vector<double>& l1_upper,
+                          const std::vector<double>& l2_lower, const std::vector<double>& l2_upper,
+                          const std::vector<double>& l3_lower, const std::vector<double>& l3_upper);
+
+/**
+ * @brief Check a band table of an arbitrary number of singularity levels
+ * 
+ * The table holds 2*number_of_joints limits per level, ordered from level 1:
+ * first the lower limits of all joints, then the upper ones. The band of every
+ * level has to lie within the band of the level below it.
+ * 
+ * @param number_of_joints    number of robot joints
+ * @param bands               band table
+ * @param number_of_levels    number of singularity levels of a valid table
+ * @param error               description of the first wrong limit
+ * @return true   if the table has proper size and its bands are nested
+ * @return false  otherwise
+ */
+bool checkBandTable(int number_of_joints, const std::vector<double>& bands, int& number_of_levels, std::string& error);
+
+/**
+ * @brief Compare every joint position to the bands of a band table
+ * 
+ * Reference implementation of the classifiers for an arbitrary number of levels.
+ * 
+ * @param number_of_joints    number of robot joints
+ * @param number_of_levels    number of singularity levels
+ * @param joint_position      pointer to number_of_joints joint positions
+ * @param bands               band table in the layout checked by checkBandTable
+ * @return int                index of the singularity level of the position
+ */
+int checkSingularityLevel(int number_of_joints, int number_of_levels, const double* joint_position,
+                          const std::vector<double>& bands);
+
+}  // namespace singularity_detector
+
+#endif  // SINGULARITY_LIMITS_H_
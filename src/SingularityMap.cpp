@@ -0,0 +1,169 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "SingularityMap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char kSingularityMapMagic[8] = {'S', 'D', 'M', 'A', 'P', '\0', '\0', '\0'};
+
+namespace {
+
+/// largest number of cells of a dense block, keeps in-block positions within 32 bits
+const unsigned kMaxBlockCellBits = 24;
+const uint64_t kFnvOffset = 14695981039346656037ull;
+const uint64_t kFnvPrime = 1099511628211ull;
+
+uint64_t fnv1a(uint64_t hash, const void* data, std::size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (std::size_t k=0; k<size; k++)
+    hash = (hash ^ bytes[k]) * kFnvPrime;
+  return hash;
+}
+
+}  // namespace
+
+SingularityMap::SingularityMap()
+    : mapping_(NULL),
+      mapping_size_(0),
+      header_(NULL),
+      index_(NULL),
+      cells_(NULL),
+      number_of_joints_(0),
+      max_level_(0),
+      block_bits_(0),
+      block_mask_(0) {
+}
+
+SingularityMap::~SingularityMap() {
+  close();
+}
+
+void SingularityMap::close() {
+  if (mapping_)
+    munmap(mapping_, mapping_size_);
+  mapping_ = NULL;
+  mapping_size_ = 0;
+  header_ = NULL;
+  index_ = NULL;
+  cells_ = NULL;
+  number_of_joints_ = 0;
+  max_level_ = 0;
+}
+
+uint64_t SingularityMap::bandsKey(const SingularityLimitTable& table) {
+  const int32_t sizes[2] = {table.number_of_joints(), table.number_of_levels()};
+  uint64_t hash = fnv1a(kFnvOffset, sizes, sizeof(sizes));
+  for (int l=1; l<=sizes[1]; l++) {
+    for (int j=0; j<sizes[0]; j++) {
+      // adding zero turns -0 into 0, the same edge hashes the same
+      const double edges[2] = {table.lower(l, j) + 0.0, table.upper(l, j) + 0.0};
+      hash = fnv1a(hash, edges, sizeof(edges));
+    }
+  }
+  // a joint wrapped at runtime but not when baking reaches other levels
+  for (int j=0; j<sizes[0]; j++) {
+    const double period = table.period(j) + 0.0;
+    hash = fnv1a(hash, &period, sizeof(period));
+  }
+  return hash;
+}
+
+bool SingularityMap::open(const std::string& path, std::string& error) {
+  close();
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error = "cannot open singularity map: " + path;
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(SingularityMapHeader)) {
+    ::close(fd);
+    error = "singularity map too short: " + path;
+    return false;
+  }
+  int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  flags |= MAP_POPULATE;
+#endif
+  void* mapping = mmap(NULL, status.st_size, PROT_READ, flags, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    error = "cannot map singularity map: " + path;
+    return false;
+  }
+  mapping_ = mapping;
+  mapping_size_ = status.st_size;
+
+  const SingularityMapHeader* header = static_cast<const SingularityMapHeader*>(mapping);
+  const int n = header->number_of_joints;
+  std::ostringstream message;
+  if (std::memcmp(header->magic, kSingularityMapMagic, sizeof(kSingularityMapMagic)) != 0 ||
+      header->version != SingularityMapHeader::kVersion) {
+    message << "not a singularity map of version " << SingularityMapHeader::kVersion;
+  } else if (n <= 0 || n > SingularityMapHeader::kMaxJoints || header->block_bits * n > kMaxBlockCellBits) {
+    message << "unsupported number of joints " << n << " or block size " << header->block_bits;
+  } else {
+    uint64_t blocks = 1;
+    for (int j=0; j<n && message.str().empty(); j++) {
+      const uint32_t block = 1u << header->block_bits;
+      if (header->cells[j] == 0 || header->cells[j] % block != 0 || !(header->lower[j] < header->upper[j]))
+        message << "joint " << j << " has an invalid grid";
+      blocks *= header->cells[j] / block;
+    }
+    const uint64_t dense_size = header->number_of_dense_blocks << (header->block_bits * n);
+    if (message.str().empty() && (blocks != header->number_of_blocks ||
+        header->index_offset + 4 * blocks > mapping_size_ || header->cells_offset + dense_size > mapping_size_ ||
+        header->index_offset % 4 != 0))
+      message << "grid does not match the file size";
+  }
+  int max_level = 0;
+  if (message.str().empty()) {
+    // a corrupt index could address memory past the mapping
+    const uint32_t* index = reinterpret_cast<const uint32_t*>(static_cast<const char*>(mapping) + header->index_offset);
+    for (uint64_t b=0; b<header->number_of_blocks; b++) {
+      if (!(index[b] & SingularityMapHeader::kUniformBlock) && index[b] >= header->number_of_dense_blocks) {
+        message << "block " << b << " refers to a missing dense block";
+        break;
+      }
+      if (index[b] & SingularityMapHeader::kUniformBlock)
+        max_level = std::max(max_level, static_cast<int>(index[b] & 0xFF));
+    }
+    const uint8_t* cells = reinterpret_cast<const uint8_t*>(static_cast<const char*>(mapping) + header->cells_offset);
+    const uint8_t* cells_end = cells + (header->number_of_dense_blocks << (header->block_bits * n));
+    if (cells != cells_end)
+      max_level = std::max(max_level, static_cast<int>(*std::max_element(cells, cells_end)));
+  }
+  if (!message.str().empty()) {
+    close();
+    error = path + ": " + message.str();
+    return false;
+  }
+
+  header_ = header;
+  index_ = reinterpret_cast<const uint32_t*>(static_cast<const char*>(mapping) + header->index_offset);
+  cells_ = reinterpret_cast<const uint8_t*>(static_cast<const char*>(mapping) + header->cells_offset);
+  number_of_joints_ = n;
+  max_level_ = max_level;
+  block_bits_ = header->block_bits;
+  block_mask_ = (static_cast<std::size_t>(1) << block_bits_) - 1;
+  std::size_t stride = 1;
+  for (int j=0; j<n; j++) {
+    lower_[j] = header->lower[j];
+    scale_[j] = header->cells[j] / (header->upper[j] - header->lower[j]);
+    cell_limit_[j] = header->cells[j];
+    stride_[j] = stride;
+    stride *= header->cells[j] >> block_bits_;
+  }
+  return true;
+}
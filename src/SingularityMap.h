@@ -0,0 +1,135 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SINGULARITY_MAP_H_
+#define SINGULARITY_MAP_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+#include "SingularityLimitTable.h"
+
+
+/**
+ * @brief Fixed-size header at the start of a baked singularity map file
+ *
+ * The joint space domain [lower, upper) of every joint is divided into
+ * cells[j] cells, grouped into blocks of 2^block_bits cells per joint. The
+ * coarse index holds one uint32_t per block at index_offset: either
+ * kUniformBlock | level for a block of a single level, or the number of a
+ * dense block of uint8_t cell levels at cells_offset. Cell c_j of joint j
+ * lies in coarse block sum((c_j >> block_bits) * stride_j), joint 0 varying
+ * first, at the in-block position sum((c_j & mask) << (block_bits * j)).
+ * bands_key identifies the band limits and joint periods the map was baked from.
+ */
+struct SingularityMapHeader {
+  static const int kMaxJoints = 16;
+  static const uint32_t kVersion = 3;
+  static const uint32_t kUniformBlock = 0x80000000u;
+  /// every cell holds the highest level of any position inside it, not the level of its center
+  static const uint32_t kConservative = 1u;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t number_of_joints;
+  uint32_t block_bits;
+  uint32_t flags;
+  uint64_t number_of_blocks;
+  uint64_t number_of_dense_blocks;
+  uint64_t index_offset;
+  uint64_t cells_offset;
+  /// SingularityMap::bandsKey() of the band table the map was baked from
+  uint64_t bands_key;
+  double lower[kMaxJoints];
+  double upper[kMaxJoints];
+  uint32_t cells[kMaxJoints];
+};
+
+/// Magic bytes of a singularity map file
+extern const char kSingularityMapMagic[8];
+
+/**
+ * @brief Baked singularity level grid, memory-mapped read-only from its file
+ *
+ * Opening the map validates the header and the coarse index but copies
+ * nothing: lookups read the mapped pages directly, which are prefaulted when
+ * the map is opened so that the first lookups do not page fault. The highest
+ * level of all cells is found while opening.
+ */
+class SingularityMap {
+ public:
+  SingularityMap();
+  ~SingularityMap();
+
+  /**
+   * @brief Map a baked singularity map file
+   *
+   * @param path    file written by the bake_singularity_map tool
+   * @param error   description of the problem when the file cannot be used
+   * @return true   if the map is ready for lookups
+   * @return false  if the file cannot be mapped or is malformed
+   */
+  bool open(const std::string& path, std::string& error);
+  void close();
+
+  /**
+   * @brief 64-bit FNV-1a hash of the number of joints, the levels, the band edges and the periods of a table
+   */
+  static uint64_t bandsKey(const SingularityLimitTable& table);
+
+  /**
+   * @brief Look the singularity level of a position up in the grid
+   *
+   * @param joint_position  pointer to number_of_joints() joint positions
+   * @return int            index of the singularity level, -1 if the position is outside of the domain
+   */
+  int lookup(const double* joint_position) const {
+    std::size_t coarse = 0;
+    std::size_t fine = 0;
+    for (int j=0; j<number_of_joints_; j++) {
+      const double x = (joint_position[j] - lower_[j]) * scale_[j];
+      // negated so that NaN falls outside as well
+      if (!(x >= 0.0 && x < cell_limit_[j]))
+        return -1;
+      const std::size_t cell = static_cast<std::size_t>(x);
+      coarse += (cell >> block_bits_) * stride_[j];
+      fine |= (cell & block_mask_) << (block_bits_ * j);
+    }
+    const uint32_t entry = index_[coarse];
+    if (entry & SingularityMapHeader::kUniformBlock)
+      return static_cast<int>(entry & 0xFF);
+    return cells_[(static_cast<std::size_t>(entry) << (block_bits_ * number_of_joints_)) + fine];
+  }
+
+  bool loaded() const { return header_ != NULL; }
+  bool conservative() const { return header_ && (header_->flags & SingularityMapHeader::kConservative); }
+  int number_of_joints() const { return number_of_joints_; }
+  /// Highest level of any cell
+  int max_level() const { return max_level_; }
+  uint64_t bands_key() const { return header_ ? header_->bands_key : 0; }
+  const SingularityMapHeader* header() const { return header_; }
+
+ private:
+  SingularityMap(const SingularityMap&);
+  SingularityMap& operator=(const SingularityMap&);
+
+  void* mapping_;
+  std::size_t mapping_size_;
+  const SingularityMapHeader* header_;
+  const uint32_t* index_;
+  const uint8_t* cells_;
+  int number_of_joints_;
+  int max_level_;
+  unsigned block_bits_;
+  std::size_t block_mask_;
+  double lower_[SingularityMapHeader::kMaxJoints];
+  double scale_[SingularityMapHeader::kMaxJoints];
+  double cell_limit_[SingularityMapHeader::kMaxJoints];
+  std::size_t stride_[SingularityMapHeader::kMaxJoints];
+};
+
+#endif  // SINGULARITY_MAP_H_
@@ -0,0 +1,74 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+
+/**
+ * @brief Fixed-capacity, lock-free ring for one producer and one consumer thread
+ *
+ * The storage is allocated by reset(), outside of the real-time path; push()
+ * and pop() never allocate and never block. A full ring rejects new elements.
+ */
+template <typename T>
+class SpscRing {
+ public:
+  SpscRing() : head_(0), tail_(0), dropped_(0) {}
+
+  /**
+   * @brief Allocate the storage and drop all elements, not thread-safe
+   *
+   * @param capacity  number of elements, rounded up to a power of two
+   */
+  void reset(std::size_t capacity) {
+    std::size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    buffer_.assign(size, T());
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+    dropped_.store(0, std::memory_order_relaxed);
+  }
+
+  /// Producer side: append an element, false (and counted as dropped) if the ring is full
+  bool push(const T& value) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if (buffer_.empty() || head - tail_.load(std::memory_order_acquire) == buffer_.size()) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    buffer_[head & (buffer_.size() - 1)] = value;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Consumer side: take the oldest element, false if the ring is empty
+  bool pop(T& value) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire))
+      return false;
+    value = buffer_[tail & (buffer_.size() - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::size_t capacity() const { return buffer_.size(); }
+  /// Number of elements rejected because the ring was full
+  std::size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  std::vector<T> buffer_;
+  std::atomic<std::size_t> head_;
+  std::atomic<std::size_t> tail_;
+  std::atomic<std::size_t> dropped_;
+};
+
+#endif  // SPSC_RING_H_
@@ -0,0 +1,124 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include "TransitionJournal.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+const char kJournalMagic[8] = {'S', 'D', 'J', 'R', 'N', 'L', '\0', '\0'};
+/// time the drain thread sleeps while the ring is empty
+const std::chrono::milliseconds kDrainPeriod(10);
+
+struct JournalHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t number_of_joints;
+};
+
+}  // namespace
+
+TransitionJournal::TransitionJournal()
+    : number_of_joints_(0),
+      pending_dropped_(0),
+      file_(NULL),
+      running_(false) {
+}
+
+TransitionJournal::~TransitionJournal() {
+  close();
+}
+
+bool TransitionJournal::open(const std::string& path, int number_of_joints, std::size_t capacity,
+                             std::string& error) {
+  close();
+  if (number_of_joints <= 0 || number_of_joints > kMaxJoints || capacity == 0) {
+    error = "journal needs 1 to 32 joints and a positive capacity";
+    return false;
+  }
+  JournalHeader header;
+  std::memcpy(header.magic, kJournalMagic, sizeof(kJournalMagic));
+  header.version = kVersion;
+  header.number_of_joints = number_of_joints;
+
+  // append to a journal of the same robot, replace anything else
+  bool append = false;
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (file) {
+    JournalHeader existing;
+    append = std::fread(&existing, sizeof(existing), 1, file) == 1 &&
+             std::memcmp(&existing, &header, sizeof(header)) == 0;
+    std::fclose(file);
+  }
+  file_ = std::fopen(path.c_str(), append ? "ab" : "wb");
+  if (!file_ || (!append && std::fwrite(&header, sizeof(header), 1, file_) != 1)) {
+    error = "cannot write journal: " + path;
+    if (file_)
+      std::fclose(file_);
+    file_ = NULL;
+    return false;
+  }
+  entries_.reset(capacity);
+  number_of_joints_ = number_of_joints;
+  pending_dropped_ = 0;
+  running_.store(true);
+  thread_ = std::thread(&TransitionJournal::drain, this);
+  return true;
+}
+
+void TransitionJournal::close() {
+  if (!file_)
+    return;
+  running_.store(false);
+  thread_.join();
+  std::fclose(file_);
+  file_ = NULL;
+}
+
+void TransitionJournal::record(int64_t stamp_ns, int from_level, int to_level, int trigger_joint,
+                               const double* joint_position) {
+  if (!file_)
+    return;
+  Entry entry;
+  entry.stamp_ns = stamp_ns;
+  entry.from_level = static_cast<uint8_t>(from_level);
+  entry.to_level = static_cast<uint8_t>(to_level);
+  entry.trigger_joint = static_cast<int16_t>(trigger_joint);
+  entry.dropped_before = pending_dropped_;
+  std::memcpy(entry.joint_position, joint_position, number_of_joints_ * sizeof(double));
+  if (entries_.push(entry))
+    pending_dropped_ = 0;
+  else
+    pending_dropped_++;
+}
+
+void TransitionJournal::drain() {
+  Entry entry;
+  for (;;) {
+    // read the flag first, so that entries recorded before close() are still written
+    const bool running = running_.load();
+    bool written = false;
+    while (entries_.pop(entry))
+      written |= write(entry);
+    if (written)
+      std::fflush(file_);
+    if (!running)
+      return;
+    std::this_thread::sleep_for(kDrainPeriod);
+  }
+}
+
+bool TransitionJournal::write(const Entry& entry) {
+  return std::fwrite(&entry.stamp_ns, sizeof(entry.stamp_ns), 1, file_) == 1 &&
+         std::fwrite(&entry.from_level, sizeof(entry.from_level), 1, file_) == 1 &&
+         std::fwrite(&entry.to_level, sizeof(entry.to_level), 1, file_) == 1 &&
+         std::fwrite(&entry.trigger_joint, sizeof(entry.trigger_joint), 1, file_) == 1 &&
+         std::fwrite(&entry.dropped_before, sizeof(entry.dropped_before), 1, file_) == 1 &&
+         std::fwrite(entry.joint_position, sizeof(double), number_of_joints_, file_) ==
+             static_cast<std::size_t>(number_of_joints_);
+}
@@ -0,0 +1,103 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#ifndef TRANSITION_JOURNAL_H_
+#define TRANSITION_JOURNAL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+#include "SpscRing.h"
+
+
+/**
+ * @brief Journal of singularity level transitions, recorded in real time and written to disk by its own thread
+ *
+ * record() copies the transition into a preallocated SpscRing and returns, in
+ * constant time and without allocating; a drain thread started by open()
+ * appends the entries to a binary file. Entries which find the ring full are
+ * dropped and their number is stored with the next written entry.
+ *
+ * File format, little-endian like the machine writing it:
+ * @code
+ * header:  char magic[8] = "SDJRNL", uint32 version, uint32 number_of_joints
+ * entry:   int64 stamp_ns, uint8 from_level, uint8 to_level, int16 trigger_joint,
+ *          uint32 dropped_before, double joint_position[number_of_joints]
+ * @endcode
+ */
+class TransitionJournal {
+ public:
+  static const uint32_t kVersion = 1;
+  static const int kMaxJoints = 32;
+
+  struct Entry {
+    /// time the sample causing the transition was taken
+    int64_t stamp_ns;
+    uint8_t from_level;
+    uint8_t to_level;
+    /// first joint at to_level, -1 if no single joint reaches it, e.g. in a coupled region
+    int16_t trigger_joint;
+    /// number of entries dropped right before this one
+    uint32_t dropped_before;
+    double joint_position[kMaxJoints];
+  };
+
+  TransitionJournal();
+  ~TransitionJournal();
+
+  /**
+   * @brief Allocate the ring, open the file and start the drain thread, not to be called from the real-time thread
+   *
+   * An existing file of the same joint count is appended to, otherwise it is replaced.
+   *
+   * @param path              file to write the entries to
+   * @param number_of_joints  number of robot joints, at most kMaxJoints
+   * @param capacity          number of entries buffered between two drains
+   * @param error             description of the problem when the journal cannot be started
+   * @return true   if record() writes to the file from now on
+   * @return false  if the file cannot be opened
+   */
+  bool open(const std::string& path, int number_of_joints, std::size_t capacity, std::string& error);
+
+  /// Stop the drain thread after draining the ring, and close the file
+  void close();
+  bool opened() const { return file_ != NULL; }
+
+  /**
+   * @brief Real-time side: buffer one transition
+   *
+   * @param stamp_ns        time of the sample
+   * @param from_level      published level before the transition
+   * @param to_level        published level after the transition
+   * @param trigger_joint   joint which caused the transition, -1 if none
+   * @param joint_position  number_of_joints positions of the sample
+   */
+  void record(int64_t stamp_ns, int from_level, int to_level, int trigger_joint, const double* joint_position);
+
+  /// Number of entries dropped since open() because the drain thread did not keep up
+  std::size_t dropped() const { return entries_.dropped(); }
+
+ private:
+  TransitionJournal(const TransitionJournal&);
+  TransitionJournal& operator=(const TransitionJournal&);
+
+  void drain();
+  bool write(const Entry& entry);
+
+  SpscRing<Entry> entries_;
+  int number_of_joints_;
+  /// entries dropped since the last one buffered, touched only by the real-time thread
+  uint32_t pending_dropped_;
+  std::FILE* file_;
+  std::thread thread_;
+  std::atomic<bool> running_;
+};
+
+#endif  // TRANSITION_JOURNAL_H_
@@ -0,0 +1,466 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "BandEdgeCache.h"
+#include "CompactLimitTable.h"
+#include "IncrementalClassifier.h"
+#include "SingularityDetectorCore.h"
+#include "SingularityLimitTable.h"
+
+namespace {
+
+const BandKernel::Isa kIsas[] = {BandKernel::kScalar, BandKernel::kSse2, BandKernel::kAvx2, BandKernel::kNeon};
+/// edges lie on a grid of 1/64 and periods are powers of two, so edges, their period images and the wrap are exact
+const double kGrid = 1.0 / 64.0;
+const double kInf = std::numeric_limits<double>::infinity();
+
+/**
+ * @brief Random limits and the positions they are checked at, random ones and ones at and next to the band edges
+ */
+struct RandomTable {
+  RandomTable(int number_of_joints, int number_of_levels, bool nested, bool periodic, uint32_t seed)
+      : n(number_of_joints),
+        levels(number_of_levels),
+        bands(2 * number_of_levels * number_of_joints),
+        generator(seed) {
+    if (periodic)
+      periods.assign(n, 0.0);
+    for (int i=0; i<n; i++) {
+      const bool joint_periodic = periodic && chance(0.6);
+      if (joint_periodic)
+        periods[i] = chance(0.5) ? 4.0 : 8.0;
+      // periodic joints keep all bands within 3.5 of 4, so they fit into their period
+      const double center = gridValue(-4.0, 4.0);
+      double half_width = gridValue(0.25, 1.5);
+      for (int l=0; l<levels; l++) {
+        double c = center;
+        if (nested) {
+          half_width = std::max(0.0, half_width - kGrid * std::uniform_int_distribution<int>(0, 8)(generator));
+        } else {
+          c = center + gridValue(-0.25, 0.25);
+          half_width = gridValue(0.0, 1.5);
+        }
+        lower(l, i) = c - half_width;
+        upper(l, i) = c + half_width;
+      }
+      // an unbounded outer band, of non-periodic joints only
+      if (!joint_periodic && chance(0.1)) {
+        lower(0, i) = -kInf;
+        upper(0, i) = kInf;
+      }
+    }
+    EXPECT_TRUE(table.build(n, levels, bands));
+    std::string error;
+    EXPECT_TRUE(table.setPeriods(periods, error)) << error;
+
+    std::uniform_real_distribution<double> anywhere(-12.0, 12.0);
+    for (int k=0; k<300; k++) {
+      std::vector<double> position(n);
+      for (int i=0; i<n; i++)
+        position[i] = anywhere(generator);
+      positions.push_back(position);
+    }
+    // every joint at a band edge, one grid step off it or one of its period images
+    for (int k=0; k<600; k++) {
+      std::vector<double> position(n);
+      for (int i=0; i<n; i++) {
+        const int l = std::uniform_int_distribution<int>(0, levels-1)(generator);
+        double edge = chance(0.5) ? lower(l, i) : upper(l, i);
+        if (std::isinf(edge))
+          edge = 0.0;
+        const int offset = std::uniform_int_distribution<int>(-1, 1)(generator);
+        const int turns = period(i) > 0.0 ? std::uniform_int_distribution<int>(-3, 3)(generator) : 0;
+        position[i] = edge + offset * kGrid + turns * period(i);
+      }
+      positions.push_back(position);
+    }
+  }
+
+  bool chance(double probability) { return std::uniform_real_distribution<double>(0.0, 1.0)(generator) < probability; }
+  double gridValue(double low, double high) {
+    return kGrid * std::uniform_int_distribution<int>(std::ceil(low / kGrid), std::floor(high / kGrid))(generator);
+  }
+  double& lower(int l, int i) { return bands[2 * l * n + i]; }
+  double& upper(int l, int i) { return bands[(2 * l + 1) * n + i]; }
+  double period(int i) const { return periods.empty() ? 0.0 : periods[i]; }
+
+  /**
+   * @brief Level of a joint straight from the definition: the highest open band holding any image of the position
+   */
+  int jointLevel(int i, double q) const {
+    int level = 0;
+    for (int l=0; l<levels; l++) {
+      const double low = bands[2 * l * n + i];
+      const double high = bands[(2 * l + 1) * n + i];
+      double image = q;
+      // the lowest image above the lower limit is the only one which can be inside of the band
+      if (period(i) > 0.0)
+        image = q + (std::floor((low - q) / period(i)) + 1.0) * period(i);
+      if (image > low && image < high)
+        level = l + 1;
+    }
+    return level;
+  }
+
+  /**
+   * @brief Time until a joint moving at constant velocity enters an image of a band, infinity if never
+   */
+  double entryTime(int l, int i, double q, double v) const {
+    double time = kInf;
+    // every image the position can reach within a few periods, the bands lie within 12 of zero
+    const int turns = period(i) > 0.0 ? static_cast<int>(std::ceil((std::fabs(q) + 12.0) / period(i))) : 0;
+    for (int k=-turns; k<=turns; k++) {
+      const double low = bands[2 * l * n + i] + k * period(i);
+      const double high = bands[(2 * l + 1) * n + i] + k * period(i);
+      if (q > low && q < high)
+        time = 0.0;
+      else if (q <= low && v > 0.0)
+        time = std::min(time, (low - q) / v);
+      else if (q >= high && v < 0.0)
+        time = std::min(time, (high - q) / v);
+    }
+    return time;
+  }
+
+  int level(const std::vector<double>& position) const {
+    int max = 0;
+    for (int i=0; i<n; i++)
+      max = std::max(max, jointLevel(i, position[i]));
+    return max;
+  }
+
+  std::string describe(const std::vector<double>& position) const {
+    std::string text = "position";
+    for (int i=0; i<n; i++)
+      text += " " + std::to_string(position[i]);
+    return text;
+  }
+
+  int n;
+  int levels;
+  std::vector<double> bands;
+  std::vector<double> periods;
+  std::mt19937 generator;
+  SingularityLimitTable table;
+  std::vector<std::vector<double> > positions;
+};
+
+const int kJointCounts[] = {1, 3, 4, 5, 6, 7, 8, 9, 12, 17, 32, 33};
+const int kLevelCounts[] = {1, 3, 5, 16};
+
+TEST(ClassificationTest, ReferenceMatchesScalarKernel) {
+  // the reference itself, against the plain loop of the scalar kernel
+  uint32_t seed = 1;
+  for (int n : kJointCounts) {
+    for (int levels : kLevelCounts) {
+      const RandomTable random(n, levels, true, true, seed++);
+      SingularityLimitTable table = random.table;
+      table.setKernel(BandKernel::kScalar);
+      for (std::size_t k=0; k<random.positions.size() && !HasFailure(); k++)
+        EXPECT_EQ(table.classify(&random.positions[k][0]), random.level(random.positions[k]))
+            << n << " joints, " << levels << " levels, " << random.describe(random.positions[k]);
+    }
+  }
+}
+
+TEST(ClassificationTest, EveryKernelMatchesReference) {
+  uint32_t seed = 100;
+  for (BandKernel::Isa isa : kIsas) {
+    if (!BandKernel::isAvailable(isa))
+      continue;
+    SCOPED_TRACE(BandKernel::name(isa));
+    for (int n : kJointCounts) {
+      for (int levels : kLevelCounts) {
+        for (int variant=0; variant<4; variant++) {
+          const bool nested = variant & 1;
+          const bool periodic = variant & 2;
+          const RandomTable random(n, levels, nested, periodic, seed++);
+          SingularityLimitTable table = random.table;
+          table.setKernel(isa);
+          ASSERT_EQ(table.kernel(), isa);
+          std::vector<uint8_t> joint_levels(n);
+          for (std::size_t k=0; k<random.positions.size() && !HasFailure(); k++) {
+            const std::vector<double>& position = random.positions[k];
+            EXPECT_EQ(table.classify(&position[0]), random.level(position))
+                << n << " joints, " << levels << " levels, variant " << variant << ", " << random.describe(position);
+            table.classifyJoints(&position[0], &joint_levels[0]);
+            for (int i=0; i<n; i++)
+              EXPECT_EQ(joint_levels[i], random.jointLevel(i, position[i]))
+                  << "joint " << i << " of " << n << ", " << levels << " levels, variant " << variant << ", "
+                  << random.describe(position);
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(ClassificationTest, SpecializedCoresMatchReference) {
+  for (uint32_t seed=200; seed<220; seed++) {
+    const RandomTable random6(6, 3, seed & 1, false, seed);
+    const RandomTable random7(7, 3, seed & 1, false, seed);
+    SingularityDetectorCore<6> core6;
+    SingularityDetectorCore<7> core7;
+    ASSERT_TRUE(core6.build(random6.table));
+    ASSERT_TRUE(core7.build(random7.table));
+    for (std::size_t k=0; k<random6.positions.size() && !HasFailure(); k++) {
+      EXPECT_EQ(core6.classify(&random6.positions[k][0]), random6.level(random6.positions[k]))
+          << random6.describe(random6.positions[k]);
+      EXPECT_EQ(core7.classify(&random7.positions[k][0]), random7.level(random7.positions[k]))
+          << random7.describe(random7.positions[k]);
+    }
+  }
+}
+
+TEST(ClassificationTest, EdgeCacheMatchesReference) {
+  uint32_t seed = 300;
+  for (int n : kJointCounts) {
+    for (int variant=0; variant<4; variant++) {
+      const RandomTable random(n, 5, variant & 1, variant & 2, seed++);
+      BandEdgeCache edges;
+      edges.build(random.table);
+      std::vector<double> distance(n);
+      double overall;
+      for (std::size_t k=0; k<random.positions.size() && !HasFailure(); k++)
+        EXPECT_EQ(edges.classifyDistance(&random.positions[k][0], &distance[0], overall),
+                  random.level(random.positions[k]))
+            << n << " joints, variant " << variant << ", " << random.describe(random.positions[k]);
+    }
+  }
+}
+
+TEST(ClassificationTest, CompactModesMatchReferenceBeyondQuantizationError) {
+  uint32_t seed = 400;
+  for (BandKernel::Isa isa : kIsas) {
+    if (!BandKernel::isAvailable(isa))
+      continue;
+    SCOPED_TRACE(BandKernel::name(isa));
+    for (int n : kJointCounts) {
+      for (int levels : kLevelCounts) {
+        RandomTable random(n, levels, seed & 1, false, seed);
+        seed++;
+        for (int m=0; m<2; m++) {
+          const CompactLimitTable::Mode mode = m ? CompactLimitTable::kFixed32 : CompactLimitTable::kFloat32;
+          // 1024 keys per unit quantize the grid edges by half a key, a resolution of 1000 off the grid
+          const std::vector<double> resolution(n, seed & 2 ? 1024.0 : 1000.0);
+          CompactLimitTable compact;
+          std::string error;
+          ASSERT_TRUE(compact.build(random.table, mode, resolution, 1e-3, error)) << error;
+          compact.setKernel(isa);
+          ASSERT_EQ(compact.kernel(), isa);
+          const double error_bound = compact.quantization_error();
+
+          // positions just beyond the quantization error of an edge, in addition to the random ones
+          std::vector<std::vector<double> > positions(random.positions);
+          for (std::size_t k=0; k<random.positions.size(); k++) {
+            std::vector<double> position(random.positions[k]);
+            for (int i=0; i<n; i++)
+              position[i] += (k & 1 ? 2.0 : -2.0) * error_bound;
+            positions.push_back(position);
+          }
+          std::vector<double> margins(n);
+          std::vector<float> single(n);
+          std::vector<int32_t> counts(n);
+          for (std::size_t k=0; k<positions.size() && !HasFailure(); k++) {
+            const std::vector<double>& position = positions[k];
+            random.table.edgeMargins(&position[0], &margins[0]);
+            if (*std::min_element(margins.begin(), margins.end()) <= error_bound)
+              continue;   // quantization may decide either way this close to an edge
+            const int level = random.level(position);
+            EXPECT_EQ(compact.classify(&position[0]), level)
+                << (m ? "fixed32, " : "float32, ") << n << " joints, " << levels << " levels, "
+                << random.describe(position);
+            for (int i=0; i<n; i++) {
+              single[i] = static_cast<float>(position[i]);
+              counts[i] = static_cast<int32_t>(std::nearbyint(position[i] * resolution[i]));
+            }
+            if (mode == CompactLimitTable::kFloat32)
+              EXPECT_EQ(compact.classify(&single[0]), level) << random.describe(position);
+            else
+              EXPECT_EQ(compact.classifyCounts(&counts[0]), level) << random.describe(position);
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(ClassificationTest, CompactModeRefusesEdgesMovedBeyondTolerance) {
+  RandomTable random(6, 3, true, false, 500);
+  CompactLimitTable compact;
+  std::string error;
+  // half a key of 1000 per unit is 5e-4
+  EXPECT_FALSE(compact.build(random.table, CompactLimitTable::kFixed32, std::vector<double>(6, 1000.0), 1e-4, error));
+  EXPECT_FALSE(error.empty());
+  EXPECT_TRUE(compact.build(random.table, CompactLimitTable::kFixed32, std::vector<double>(6, 1000.0), 1e-3, error));
+  EXPECT_LE(compact.quantization_error(), 1e-3);
+}
+
+TEST(ClassificationTest, GroupSlicesMatchFullTable) {
+  uint32_t seed = 600;
+  for (int n : kJointCounts) {
+    for (int variant=0; variant<4; variant++) {
+      RandomTable random(n, 3, variant & 1, variant & 2, seed++);
+      // random contiguous groups covering all joints
+      std::vector<int> first_joints(1, 0);
+      for (int i=1; i<n; i++) {
+        if (random.chance(0.3))
+          first_joints.push_back(i);
+      }
+      first_joints.push_back(n);
+      std::vector<SingularityLimitTable> groups(first_joints.size() - 1);
+      for (std::size_t g=0; g<groups.size(); g++)
+        ASSERT_TRUE(groups[g].slice(random.table, first_joints[g], first_joints[g+1] - first_joints[g]));
+      EXPECT_FALSE(groups[0].slice(random.table, n - 1, 2));
+      for (std::size_t k=0; k<random.positions.size() && !HasFailure(); k++) {
+        const std::vector<double>& position = random.positions[k];
+        int level = 0;
+        for (std::size_t g=0; g<groups.size(); g++)
+          level = std::max(level, groups[g].classify(&position[first_joints[g]]));
+        EXPECT_EQ(level, random.level(position)) << n << " joints, variant " << variant << ", "
+                                                 << random.describe(position);
+      }
+    }
+  }
+}
+
+TEST(ClassificationTest, SkippedCyclesKeepReferenceLevel) {
+  uint32_t seed = 700;
+  for (int n : kJointCounts) {
+    for (int variant=0; variant<8; variant++) {
+      RandomTable random(n, 5, variant & 1, variant & 2, seed++);
+      // half of the walks skip by the margins of the table, the other half by those of the edge cache
+      const bool cached_edges = variant & 4;
+      BandEdgeCache edges;
+      edges.build(random.table);
+      IncrementalClassifier incremental;
+      incremental.reset(n);
+      // a random walk in steps of a grid cell or less, jumping to one of the positions once in a while
+      std::vector<double> position(random.positions[0]);
+      std::normal_distribution<double> step(0.0, kGrid);
+      int level = 0;
+      int skipped = 0;
+      for (int k=0; k<2000 && !HasFailure(); k++) {
+        if (random.chance(0.01)) {
+          position = random.positions[k % random.positions.size()];
+        } else {
+          for (int i=0; i<n; i++)
+            position[i] += step(random.generator);
+        }
+        if (incremental.needsUpdate(&position[0])) {
+          level = random.table.classify(&position[0]);
+          if (cached_edges)
+            incremental.update(&position[0], edges);
+          else
+            incremental.update(&position[0], random.table);
+        } else {
+          skipped++;
+        }
+        EXPECT_EQ(level, random.level(position)) << n << " joints, variant " << variant << ", step " << k << ", "
+                                                 << random.describe(position);
+      }
+      // the skip test has to skip something on few joints, or it tests nothing
+      if (n == 1)
+        EXPECT_GT(skipped, 0);
+    }
+  }
+}
+
+TEST(ClassificationTest, PredictedEntryTimesMatchReference) {
+  uint32_t seed = 800;
+  for (int n : kJointCounts) {
+    for (int variant=0; variant<4; variant++) {
+      RandomTable random(n, 5, true, variant & 2, seed++);
+      std::vector<double> velocity(n);
+      std::vector<double> entry_time(n);
+      std::normal_distribution<double> speed(0.0, 2.0);
+      for (std::size_t k=0; k<random.positions.size() && !HasFailure(); k++) {
+        const std::vector<double>& position = random.positions[k];
+        for (int i=0; i<n; i++)
+          velocity[i] = random.chance(0.1) ? 0.0 : speed(random.generator);
+        const double horizon = std::uniform_real_distribution<double>(0.0, 3.0)(random.generator);
+        double overall_entry_time;
+        const int predicted = random.table.predictLevel(&position[0], &velocity[0], horizon, &entry_time[0],
+                                                        overall_entry_time);
+        int expected = 0;
+        double expected_overall = kInf;
+        bool ambiguous = false;
+        for (int i=0; i<n; i++) {
+          int level = 0;
+          double time = kInf;
+          for (int l=0; l<5; l++) {
+            const double t = random.entryTime(l, i, position[i], velocity[i]);
+            // the wrap into the window rounds, an entry this close to the horizon may go either way
+            ambiguous |= std::fabs(t - horizon) < 1e-9;
+            if (t <= horizon) {
+              level = l + 1;
+              time = t;
+            }
+          }
+          if (ambiguous)
+            break;
+          EXPECT_EQ(entry_time[i] == kInf, time == kInf) << "joint " << i << ", " << random.describe(position);
+          if (time != kInf)
+            EXPECT_NEAR(entry_time[i], time, 1e-9 * (1.0 + time)) << "joint " << i << ", " << random.describe(position);
+          if (level > expected) {
+            expected = level;
+            expected_overall = time;
+          } else if (level == expected && level > 0) {
+            expected_overall = std::min(expected_overall, time);
+          }
+        }
+        if (ambiguous)
+          continue;
+        EXPECT_EQ(predicted, expected) << n << " joints, variant " << variant << ", horizon " << horizon << ", "
+                                       << random.describe(position);
+        if (expected_overall != kInf)
+          EXPECT_NEAR(overall_entry_time, expected_overall, 1e-9 * (1.0 + expected_overall));
+        else
+          EXPECT_EQ(overall_entry_time, kInf);
+      }
+    }
+  }
+}
+
+TEST(ClassificationTest, PredictionOfPeriodicJointThroughTheWrap) {
+  // a band (1, 1.5) of a joint of period 4, its window [-0.75, 3.25) centered on the band
+  SingularityLimitTable table;
+  const double bands[] = {1.0, 1.5};
+  ASSERT_TRUE(table.build(1, 1, std::vector<double>(bands, bands + 2)));
+  std::string error;
+  ASSERT_TRUE(table.setPeriods(std::vector<double>(1, 4.0), error)) << error;
+  double entry_time;
+  double overall_entry_time;
+  // 3 moving up passes the wrap at 3.25 and enters the image (5, 5.5) after 2 s
+  double position = 3.0;
+  double velocity = 1.0;
+  EXPECT_EQ(table.predictLevel(&position, &velocity, 2.5, &entry_time, overall_entry_time), 1);
+  EXPECT_DOUBLE_EQ(entry_time, 2.0);
+  EXPECT_DOUBLE_EQ(overall_entry_time, 2.0);
+  EXPECT_EQ(table.predictLevel(&position, &velocity, 1.5, &entry_time, overall_entry_time), 0);
+  EXPECT_EQ(entry_time, kInf);
+  // -0.5 moving down passes the wrap at -0.75 and enters the image (-3, -2.5) after 2 s
+  position = -0.5;
+  velocity = -1.0;
+  EXPECT_EQ(table.predictLevel(&position, &velocity, 2.5, &entry_time, overall_entry_time), 1);
+  EXPECT_DOUBLE_EQ(entry_time, 2.0);
+  // the same positions several turns away
+  position = -0.5 + 3 * 4.0;
+  EXPECT_EQ(table.predictLevel(&position, &velocity, 2.5, &entry_time, overall_entry_time), 1);
+  EXPECT_DOUBLE_EQ(entry_time, 2.0);
+}
+
+}  // namespace
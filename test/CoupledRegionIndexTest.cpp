@@ -0,0 +1,182 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "CoupledRegionIndex.h"
+
+namespace {
+
+const double kInf = std::numeric_limits<double>::infinity();
+
+/// Whether a single region holds a position, straight from the definition of a region
+bool inside(const CoupledRegionIndex::Region& region, const std::vector<double>& position) {
+  const std::size_t n = position.size();
+  for (std::size_t i=0; i<n; i++) {
+    if (!(position[i] > region.lower[i] && position[i] < region.upper[i]))
+      return false;
+  }
+  for (std::size_t h=0; h<region.offsets.size(); h++) {
+    double dot = 0.0;
+    for (std::size_t i=0; i<n; i++)
+      dot += region.normals[h * n + i] * position[i];
+    if (!(dot < region.offsets[h]))
+      return false;
+  }
+  return true;
+}
+
+/// Highest level of all regions holding a position, every region tested
+int bruteForce(const std::vector<CoupledRegionIndex::Region>& regions, const std::vector<double>& position) {
+  int level = 0;
+  for (std::size_t r=0; r<regions.size(); r++) {
+    if (inside(regions[r], position))
+      level = std::max(level, regions[r].level);
+  }
+  return level;
+}
+
+/**
+ * @brief Random regions on a grid of 1/8, so that positions can lie exactly on their bounds
+ */
+struct RandomRegions {
+  RandomRegions(int number_of_joints, int number_of_regions, uint32_t seed)
+      : n(number_of_joints), generator(seed) {
+    for (int r=0; r<number_of_regions; r++) {
+      CoupledRegionIndex::Region region;
+      region.level = std::uniform_int_distribution<int>(1, 5)(generator);
+      region.lower.assign(n, -kInf);
+      region.upper.assign(n, kInf);
+      for (int i=0; i<n; i++) {
+        if (chance(0.2))
+          continue;   // unconstrained joint
+        const double low = gridValue(-4.0, 3.5);
+        region.lower[i] = low;
+        region.upper[i] = low + gridValue(0.125, 2.0);
+      }
+      const int halfspaces = std::uniform_int_distribution<int>(0, 2)(generator);
+      for (int h=0; h<halfspaces; h++) {
+        for (int i=0; i<n; i++)
+          region.normals.push_back(gridValue(-1.0, 1.0));
+        region.offsets.push_back(gridValue(-1.0, 2.0));
+      }
+      regions.push_back(region);
+    }
+    std::uniform_real_distribution<double> anywhere(-5.0, 5.0);
+    for (int k=0; k<2000; k++) {
+      std::vector<double> position(n);
+      for (int i=0; i<n; i++)
+        position[i] = k & 1 ? anywhere(generator) : gridValue(-5.0, 5.0);
+      positions.push_back(position);
+    }
+  }
+
+  bool chance(double probability) { return std::uniform_real_distribution<double>(0.0, 1.0)(generator) < probability; }
+  double gridValue(double low, double high) {
+    return 0.125 * std::uniform_int_distribution<int>(static_cast<int>(low * 8), static_cast<int>(high * 8))(generator);
+  }
+
+  int n;
+  std::mt19937 generator;
+  std::vector<CoupledRegionIndex::Region> regions;
+  std::vector<std::vector<double> > positions;
+};
+
+TEST(CoupledRegionIndexTest, HierarchyMatchesBruteForce) {
+  const int joint_counts[] = {1, 2, 3, 6, 7};
+  const int region_counts[] = {1, 3, 4, 5, 17, 100, 1000};
+  uint32_t seed = 1;
+  for (int n : joint_counts) {
+    for (int count : region_counts) {
+      const RandomRegions random(n, count, seed++);
+      CoupledRegionIndex index;
+      std::string error;
+      ASSERT_TRUE(index.build(n, random.regions, error)) << error;
+      EXPECT_EQ(index.size(), count);
+      int max_level = 0;
+      for (std::size_t r=0; r<random.regions.size(); r++)
+        max_level = std::max(max_level, random.regions[r].level);
+      EXPECT_EQ(index.max_level(), max_level);
+      for (std::size_t k=0; k<random.positions.size() && !HasFailure(); k++)
+        EXPECT_EQ(index.classify(&random.positions[k][0]), bruteForce(random.regions, random.positions[k]))
+            << n << " joints, " << count << " regions, position " << k;
+    }
+  }
+}
+
+TEST(CoupledRegionIndexTest, IdenticalBoxesMatchBruteForce) {
+  // every split of the hierarchy is degenerate, the half-spaces alone tell the regions apart
+  RandomRegions random(3, 300, 50);
+  for (std::size_t r=0; r<random.regions.size(); r++) {
+    random.regions[r].lower.assign(3, -2.0);
+    random.regions[r].upper.assign(3, 2.0);
+  }
+  CoupledRegionIndex index;
+  std::string error;
+  ASSERT_TRUE(index.build(3, random.regions, error)) << error;
+  for (std::size_t k=0; k<random.positions.size() && !HasFailure(); k++)
+    EXPECT_EQ(index.classify(&random.positions[k][0]), bruteForce(random.regions, random.positions[k]))
+        << "position " << k;
+}
+
+TEST(CoupledRegionIndexTest, ParsedRegionsMatchBruteForce) {
+  std::istringstream text(
+      "# one box and one wedge\n"
+      "region 1\n"
+      "  box 0 -1 1\n"
+      "end\n"
+      "region 2   # q0 + q1 < 0.5 inside of the box of joint 1\n"
+      "  box 1 0 2\n"
+      "  halfspace 1 1 0.5\n"
+      "end\n");
+  std::vector<CoupledRegionIndex::Region> regions;
+  std::string error;
+  ASSERT_TRUE(CoupledRegionIndex::parse(text, 2, regions, error)) << error;
+  ASSERT_EQ(regions.size(), 2u);
+  EXPECT_EQ(regions[0].lower[1], -kInf);
+  EXPECT_EQ(regions[1].offsets, std::vector<double>(1, 0.5));
+  text.clear();
+  text.seekg(0);
+  CoupledRegionIndex index;
+  ASSERT_TRUE(index.load(text, 2, error)) << error;
+  const double positions[][2] = {{0.0, -5.0}, {0.0, 0.25}, {-3.0, 1.0}, {0.25, 0.25}, {1.0, 0.25}, {5.0, 5.0}};
+  for (const double* q : positions) {
+    const std::vector<double> position(q, q + 2);
+    EXPECT_EQ(index.classify(q), bruteForce(regions, position)) << q[0] << " " << q[1];
+  }
+  EXPECT_EQ(index.classify(positions[2]), 2);
+  EXPECT_EQ(index.classify(positions[3]), 1);
+}
+
+TEST(CoupledRegionIndexTest, MalformedRegionsRefused) {
+  const char* const texts[] = {
+      "region 1\n  box 0 0 1\n",                  // no end
+      "region 1\nregion 2\nend\n",                // nested
+      "box 0 0 1\n",                              // outside of a region
+      "region 1\n  box 2 0 1\nend\n",             // no such joint
+      "region 1\n  halfspace 1 1\nend\n",         // coefficients missing
+      "region 1\n  box 0 0 1 2\nend\n",           // trailing value
+      "region 1\n  box 0 1 0\nend\n",             // empty box
+      "region 0\nend\n",                          // no level
+  };
+  for (const char* text : texts) {
+    std::istringstream in(text);
+    CoupledRegionIndex index;
+    std::string error;
+    EXPECT_FALSE(index.load(in, 2, error)) << text;
+    EXPECT_FALSE(error.empty()) << text;
+  }
+}
+
+}  // namespace
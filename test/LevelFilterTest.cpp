@@ -0,0 +1,162 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "LevelFilter.h"
+#include "SingularityLimitTable.h"
+#include "SingularityLimits.h"
+
+namespace {
+
+const int kJoints = 2;
+const int kLevels = 3;
+const double kHysteresis = 0.1;
+
+/// nested bands of kLevels levels, level l spanning (-(kLevels-l)/2, (kLevels-l)/2) on every joint, widened by margin
+std::vector<double> nestedBands(double margin) {
+  std::vector<double> bands(2 * kLevels * kJoints);
+  for (int l=0; l<kLevels; l++) {
+    for (int i=0; i<kJoints; i++) {
+      bands[2 * l * kJoints + i] = -0.5 * (kLevels - l) - margin;
+      bands[(2 * l + 1) * kJoints + i] = 0.5 * (kLevels - l) + margin;
+    }
+  }
+  return bands;
+}
+
+/**
+ * @brief Reference levels of a position, against the bands and against the bands widened by the hysteresis
+ */
+struct Levels {
+  explicit Levels(const std::vector<double>& position)
+      : raw(singularity_detector::checkSingularityLevel(kJoints, kLevels, &position[0], nestedBands(0.0))),
+        released(singularity_detector::checkSingularityLevel(kJoints, kLevels, &position[0],
+                                                             nestedBands(kHysteresis))) {}
+  int raw;
+  int released;
+};
+
+TEST(LevelFilterTest, WidenedTableMatchesWidenedReference) {
+  SingularityLimitTable table;
+  ASSERT_TRUE(table.build(kJoints, kLevels, nestedBands(0.0)));
+  table.widen(kHysteresis);
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<double> anywhere(-2.0, 2.0);
+  std::vector<double> position(kJoints);
+  for (int k=0; k<1000; k++) {
+    for (int i=0; i<kJoints; i++)
+      position[i] = anywhere(generator);
+    EXPECT_EQ(table.classify(&position[0]), Levels(position).released);
+  }
+}
+
+TEST(LevelFilterTest, HysteresisHoldsLevelUntilWidenedBandLeft) {
+  LevelFilter filter;
+  filter.configure(0.0);
+  std::vector<double> position(kJoints, 0.0);
+  // the first update takes the raw level over
+  Levels levels(position);
+  EXPECT_EQ(filter.update(levels.raw, levels.released, 0.0), 3);
+  // just outside of level 3, still inside of its widened band
+  position.assign(kJoints, 0.55);
+  levels = Levels(position);
+  ASSERT_EQ(levels.raw, 2);
+  EXPECT_EQ(filter.update(levels.raw, levels.released, 1.0), 3);
+  // beyond the hysteresis margin
+  position.assign(kJoints, 0.65);
+  levels = Levels(position);
+  EXPECT_EQ(filter.update(levels.raw, levels.released, 2.0), 2);
+  // out of every band at once, the widened level 1 holds level 1
+  position.assign(kJoints, 1.55);
+  levels = Levels(position);
+  ASSERT_EQ(levels.raw, 0);
+  EXPECT_EQ(filter.update(levels.raw, levels.released, 3.0), 1);
+  // escalation is never delayed
+  position.assign(kJoints, 0.0);
+  levels = Levels(position);
+  EXPECT_EQ(filter.update(levels.raw, levels.released, 4.0), 3);
+  EXPECT_EQ(filter.transitions(), 3u);
+  filter.reset();
+  EXPECT_EQ(filter.transitions(), 0u);
+  EXPECT_EQ(filter.update(0, 0, 5.0), 0);
+}
+
+TEST(LevelFilterTest, MinDwellDelaysRelease) {
+  LevelFilter filter;
+  filter.configure(0.5);
+  EXPECT_EQ(filter.update(2, 2, 0.0), 2);
+  EXPECT_EQ(filter.update(0, 0, 1.0), 2);
+  EXPECT_EQ(filter.update(1, 1, 1.4), 2);
+  // the dwell time runs from the first cycle below, the target is the latest level
+  EXPECT_EQ(filter.update(1, 1, 1.5), 1);
+  // back at the current level restarts the dwell time, also when only the widened band reaches it
+  EXPECT_EQ(filter.update(0, 0, 2.0), 1);
+  EXPECT_EQ(filter.update(0, 1, 2.2), 1);
+  EXPECT_EQ(filter.update(0, 0, 2.3), 1);
+  EXPECT_EQ(filter.update(0, 0, 2.7), 1);
+  EXPECT_EQ(filter.update(0, 0, 2.8), 0);
+  EXPECT_EQ(filter.transitions(), 2u);
+  // a negative dwell time is none
+  filter.configure(-1.0);
+  EXPECT_EQ(filter.min_dwell(), 0.0);
+}
+
+TEST(LevelFilterTest, RandomWalkMatchesReference) {
+  const double dwells[] = {0.0, 0.01, 0.05};
+  uint32_t seed = 10;
+  for (double dwell : dwells) {
+    LevelFilter filter;
+    filter.configure(dwell);
+    std::mt19937 generator(seed++);
+    std::normal_distribution<double> step(0.0, 0.05);
+    std::uniform_real_distribution<double> period(0.001, 0.004);
+    std::vector<double> position(kJoints, 0.0);
+    std::vector<double> times;
+    std::vector<int> targets;
+    int expected = 0;
+    // output of the cycle the filtered level changed last
+    std::size_t changed = 0;
+    unsigned transitions = 0;
+    double now = 0.0;
+    for (std::size_t k=0; k<20000 && !HasFailure(); k++) {
+      for (int i=0; i<kJoints; i++)
+        position[i] = std::max(-2.0, std::min(2.0, position[i] + step(generator)));
+      now += period(generator);
+      const Levels levels(position);
+      const int target = std::max(levels.raw, levels.released);
+      times.push_back(now);
+      targets.push_back(target);
+      if (k == 0 || levels.raw >= expected) {
+        if (k > 0 && levels.raw > expected)
+          transitions++;
+        if (k == 0 || levels.raw != expected)
+          changed = k;
+        expected = levels.raw;
+      } else if (target < expected) {
+        // the cycles below the current level since it changed or was last reached
+        std::size_t first = k;
+        while (first > changed + 1 && targets[first - 1] < expected)
+          first--;
+        if (now - times[first] >= dwell) {
+          expected = target;
+          changed = k;
+          transitions++;
+        }
+      }
+      ASSERT_EQ(filter.update(levels.raw, levels.released, now), expected) << "dwell " << dwell << ", cycle " << k;
+      EXPECT_GE(filter.level(), levels.raw);
+    }
+    EXPECT_EQ(filter.transitions(), transitions);
+    EXPECT_GT(transitions, 10u);
+  }
+}
+
+}  // namespace
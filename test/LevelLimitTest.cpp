@@ -0,0 +1,325 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "BandEdgeCache.h"
+#include "CoupledRegionIndex.h"
+#include "LimitTableCompiler.h"
+#include "SingularityLimitTable.h"
+#include "SingularityLimits.h"
+
+namespace {
+
+const int kJoints = 3;
+/// copied, the gtest macros take their arguments by reference
+const int kMaxLevels = SingularityLimitTable::kMaxLevels;
+
+/// nested bands of the given number of levels, level l spanning (-(levels-l), levels-l) on every joint
+std::vector<double> nestedBands(int levels) {
+  std::vector<double> bands(2 * levels * kJoints);
+  for (int l=0; l<levels; l++) {
+    for (int i=0; i<kJoints; i++) {
+      bands[2 * l * kJoints + i] = -(levels - l);
+      bands[(2 * l + 1) * kJoints + i] = levels - l;
+    }
+  }
+  return bands;
+}
+
+CoupledRegionIndex::Region box(int level) {
+  CoupledRegionIndex::Region region;
+  region.level = level;
+  region.lower.assign(kJoints, -1.0);
+  region.upper.assign(kJoints, 1.0);
+  return region;
+}
+
+TEST(LevelLimitTest, HighestLevelFitsTheOutputs) {
+  // the scaling outputs publish level+1 as UInt8
+  EXPECT_LE(kMaxLevels + 1, std::numeric_limits<uint8_t>::max());
+}
+
+TEST(LevelLimitTest, TableClassifiesHighestLevel) {
+  const int levels = kMaxLevels;
+  SingularityLimitTable table;
+  ASSERT_TRUE(table.build(kJoints, levels, nestedBands(levels)));
+  const double center[kJoints] = {0.0, 0.0, 0.0};
+  const double outside[kJoints] = {levels + 1.0, -levels - 1.0, levels + 1.0};
+  EXPECT_EQ(table.classify(center), levels);
+  EXPECT_EQ(table.classify(outside), 0);
+
+  SingularityLimitTable too_many;
+  EXPECT_FALSE(too_many.build(kJoints, levels + 1, nestedBands(levels + 1)));
+}
+
+TEST(LevelLimitTest, ChecksRefuseOneLevelTooMany) {
+  const int levels = kMaxLevels;
+  int number_of_levels = 0;
+  std::string error;
+  EXPECT_TRUE(singularity_detector::checkBandTable(kJoints, nestedBands(levels), number_of_levels, error)) << error;
+  EXPECT_EQ(number_of_levels, levels);
+  EXPECT_FALSE(singularity_detector::checkBandTable(kJoints, nestedBands(levels + 1), number_of_levels, error));
+
+  LimitTableSource source;
+  source.number_of_joints = kJoints;
+  source.bands = nestedBands(levels);
+  LimitTableCompiler compiler;
+  EXPECT_TRUE(compiler.validate(source, number_of_levels));
+  source.bands = nestedBands(levels + 1);
+  EXPECT_FALSE(compiler.validate(source, number_of_levels));
+
+  CoupledRegionIndex regions;
+  EXPECT_TRUE(regions.build(kJoints, std::vector<CoupledRegionIndex::Region>(1, box(levels)), error)) << error;
+  const double center[kJoints] = {0.0, 0.0, 0.0};
+  EXPECT_EQ(regions.classify(center), levels);
+  EXPECT_FALSE(regions.build(kJoints, std::vector<CoupledRegionIndex::Region>(1, box(levels + 1)), error));
+}
+
+TEST(LevelLimitTest, CachedEdgesOfHighestLevel) {
+  char directory[] = "/tmp/singularity_detector_testXXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != NULL);
+  LimitTableSource source;
+  source.number_of_joints = kJoints;
+  source.bands = nestedBands(kMaxLevels);
+  const double center[kJoints] = {0.0, 0.0, 0.0};
+  std::vector<double> distance(kJoints);
+  double overall;
+  for (int pass=0; pass<2; pass++) {
+    // the first pass stores the cache file, the second one reads it
+    LimitTableCompiler compiler;
+    SingularityLimitTable table, hysteresis_table;
+    BandEdgeCache edges;
+    ASSERT_TRUE(compiler.compile(source, directory, table, hysteresis_table, edges));
+    EXPECT_EQ(compiler.cached(), pass == 1);
+    EXPECT_EQ(edges.classifyDistance(center, &distance[0], overall), kMaxLevels);
+  }
+  unlink(LimitTableCompiler::cachePath(directory, source).c_str());
+  rmdir(directory);
+}
+
+TEST(LevelLimitTest, ValidationReportsEveryError) {
+  LimitTableSource source;
+  source.number_of_joints = kJoints;
+  source.bands = nestedBands(3);
+  source.hysteresis = -0.1;
+  // level 2 joint 2 outside of level 1, level 3 joint 0 not a number and joint 1 turned upside down
+  source.bands[3 * kJoints + 2] = 3.5;
+  source.bands[4 * kJoints] = std::nan("");
+  source.bands[4 * kJoints + 1] = 0.5;
+  source.bands[5 * kJoints + 1] = 0.25;
+  source.periods.assign(kJoints, 0.0);
+  source.periods[0] = -1.0;
+  source.periods[1] = 1.0;
+  LimitTableCompiler compiler;
+  int number_of_levels = 0;
+  EXPECT_FALSE(compiler.validate(source, number_of_levels));
+  const std::vector<std::string>& errors = compiler.errors();
+  ASSERT_EQ(errors.size(), 6u);
+  EXPECT_NE(errors[0].find("hysteresis"), std::string::npos) << errors[0];
+  EXPECT_NE(errors[1].find("level 2 joint 2 band not within"), std::string::npos) << errors[1];
+  EXPECT_NE(errors[2].find("level 3 joint 0 limit is not a number"), std::string::npos) << errors[2];
+  EXPECT_NE(errors[3].find("level 3 joint 1 lower limit above"), std::string::npos) << errors[3];
+  EXPECT_NE(errors[4].find("joint 0 period must be positive"), std::string::npos) << errors[4];
+  EXPECT_NE(errors[5].find("periodic joint 1 do not fit"), std::string::npos) << errors[5];
+
+  // the same bands only warn about the nesting when it is not required, errors accumulate
+  source.require_nested = false;
+  EXPECT_FALSE(compiler.validate(source, number_of_levels));
+  EXPECT_EQ(compiler.errors().size(), 11u);
+  EXPECT_EQ(compiler.warnings().size(), 1u);
+
+  // wrong sizes are reported by gather() for every limit at once
+  const std::vector<double> right(kJoints, 0.0), wrong(kJoints + 1, 0.0);
+  const std::vector<double>* const lower[] = {&right, &wrong, &right};
+  const std::vector<double>* const upper[] = {&wrong, &right, &wrong};
+  LimitTableCompiler sizes;
+  EXPECT_FALSE(sizes.gather(kJoints, lower, upper, source));
+  EXPECT_EQ(sizes.errors().size(), 3u);
+}
+
+/**
+ * @brief Compiler cache in a temporary directory, periodic bands of 3 levels with a warning
+ */
+class LimitCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    char directory[] = "/tmp/singularity_detector_testXXXXXX";
+    ASSERT_TRUE(mkdtemp(directory) != NULL);
+    directory_ = directory;
+    source_.number_of_joints = kJoints;
+    source_.bands = nestedBands(3);
+    source_.hysteresis = 0.25;
+    source_.require_nested = false;
+    // level 3 joint 1 reaches out of level 2
+    source_.bands[5 * kJoints + 1] = 2.5;
+    source_.periods.assign(kJoints, 0.0);
+    source_.periods[2] = 8.0;
+  }
+  void TearDown() {
+    unlink(LimitTableCompiler::cachePath(directory_, source_).c_str());
+    rmdir(directory_.c_str());
+  }
+
+  bool compile(LimitTableCompiler& compiler) {
+    return compiler.compile(source_, directory_, table_, hysteresis_table_, edges_);
+  }
+
+  /// tables built from a fresh compile without cache
+  void expectTables() const {
+    LimitTableCompiler compiler;
+    SingularityLimitTable table, hysteresis_table;
+    BandEdgeCache edges;
+    ASSERT_TRUE(compiler.compile(source_, std::string(), table, hysteresis_table, edges));
+    ASSERT_EQ(table_.number_of_levels(), table.number_of_levels());
+    EXPECT_EQ(table_.nested(), table.nested());
+    for (int i=0; i<kJoints; i++) {
+      EXPECT_EQ(table_.period(i), table.period(i));
+      EXPECT_EQ(table_.period_center(i), table.period_center(i));
+      EXPECT_EQ(hysteresis_table_.period(i), hysteresis_table.period(i));
+      for (int l=1; l<=table.number_of_levels(); l++) {
+        EXPECT_EQ(table_.lower(l, i), table.lower(l, i));
+        EXPECT_EQ(table_.upper(l, i), table.upper(l, i));
+        EXPECT_EQ(hysteresis_table_.lower(l, i), hysteresis_table.lower(l, i));
+        EXPECT_EQ(hysteresis_table_.upper(l, i), hysteresis_table.upper(l, i));
+      }
+    }
+    // a periodic joint is classified through its wrap
+    const double positions[][kJoints] = {{0.0, 0.0, 0.0}, {0.0, 2.0, 8.0}, {1.5, -1.5, -8.5}, {4.0, 0.0, 0.0}};
+    std::vector<double> distance(kJoints), expected_distance(kJoints);
+    for (int k=0; k<4; k++) {
+      double overall, expected_overall;
+      EXPECT_EQ(table_.classify(positions[k]), table.classify(positions[k])) << k;
+      EXPECT_EQ(hysteresis_table_.classify(positions[k]), hysteresis_table.classify(positions[k])) << k;
+      EXPECT_EQ(edges_.classifyDistance(positions[k], &distance[0], overall),
+                edges.classifyDistance(positions[k], &expected_distance[0], expected_overall)) << k;
+      EXPECT_EQ(overall, expected_overall) << k;
+    }
+  }
+
+  std::vector<unsigned char> readCache() const {
+    std::vector<unsigned char> contents;
+    std::FILE* file = std::fopen(LimitTableCompiler::cachePath(directory_, source_).c_str(), "rb");
+    if (!file)
+      return contents;
+    int c;
+    while ((c = std::fgetc(file)) != EOF)
+      contents.push_back(c);
+    std::fclose(file);
+    return contents;
+  }
+
+  void writeCache(const std::vector<unsigned char>& contents) const {
+    std::FILE* file = std::fopen(LimitTableCompiler::cachePath(directory_, source_).c_str(), "wb");
+    ASSERT_TRUE(file != NULL);
+    if (!contents.empty())
+      std::fwrite(&contents[0], 1, contents.size(), file);
+    std::fclose(file);
+  }
+
+  std::string directory_;
+  LimitTableSource source_;
+  SingularityLimitTable table_, hysteresis_table_;
+  BandEdgeCache edges_;
+};
+
+TEST_F(LimitCacheTest, HitTakesOverTablesAndWarnings) {
+  LimitTableCompiler miss;
+  ASSERT_TRUE(compile(miss));
+  EXPECT_FALSE(miss.cached());
+  ASSERT_EQ(miss.warnings().size(), 1u);
+  EXPECT_FALSE(readCache().empty());
+
+  LimitTableCompiler hit;
+  table_ = SingularityLimitTable();
+  hysteresis_table_ = SingularityLimitTable();
+  edges_ = BandEdgeCache();
+  ASSERT_TRUE(compile(hit));
+  EXPECT_TRUE(hit.cached());
+  EXPECT_EQ(hit.warnings(), miss.warnings());
+  EXPECT_TRUE(hit.errors().empty());
+  expectTables();
+}
+
+TEST_F(LimitCacheTest, MissOnAnyChangeOfTheSource) {
+  LimitTableCompiler first;
+  ASSERT_TRUE(compile(first));
+  const std::string path = LimitTableCompiler::cachePath(directory_, source_);
+
+  // an edge, the hysteresis or a period moves the source to another file
+  LimitTableSource sources[3] = {source_, source_, source_};
+  sources[0].bands[0] = -3.5;
+  sources[1].hysteresis = 0.5;
+  sources[2].periods[2] = 9.0;
+  for (int k=0; k<3; k++) {
+    EXPECT_NE(LimitTableCompiler::cachePath(directory_, sources[k]), path) << k;
+    LimitTableCompiler compiler;
+    ASSERT_TRUE(compiler.compile(sources[k], std::string(), table_, hysteresis_table_, edges_));
+    EXPECT_FALSE(compiler.cached()) << k;
+  }
+
+  // a file of another source renamed to this one is not taken over
+  const std::vector<unsigned char> contents = readCache();
+  source_.hysteresis = 0.5;
+  writeCache(contents);
+  LimitTableCompiler renamed;
+  ASSERT_TRUE(compile(renamed));
+  EXPECT_FALSE(renamed.cached());
+  expectTables();
+  source_.hysteresis = 0.25;
+  unlink(path.c_str());
+
+  // an invalid source is never cached
+  LimitTableCompiler invalid;
+  source_.bands[0] = 5.0;
+  EXPECT_FALSE(compile(invalid));
+  EXPECT_TRUE(readCache().empty());
+}
+
+TEST_F(LimitCacheTest, CorruptFileIsRebuilt) {
+  LimitTableCompiler first;
+  ASSERT_TRUE(compile(first));
+  const std::vector<unsigned char> contents = readCache();
+  ASSERT_FALSE(contents.empty());
+
+  std::vector<std::vector<unsigned char> > corrupt(4, contents);
+  corrupt[0].resize(contents.size() / 2);
+  corrupt[1][contents.size() - 20] ^= 0x10;
+  corrupt[2].push_back(0);
+  corrupt[3].clear();
+  for (std::size_t k=0; k<corrupt.size(); k++) {
+    writeCache(corrupt[k]);
+    LimitTableCompiler compiler;
+    table_ = SingularityLimitTable();
+    ASSERT_TRUE(compile(compiler)) << k;
+    EXPECT_FALSE(compiler.cached()) << k;
+    expectTables();
+    // the file is written again in full
+    EXPECT_EQ(readCache(), contents) << k;
+  }
+}
+
+TEST_F(LimitCacheTest, UnwritableDirectoryOnlyWarns) {
+  const std::string directory = directory_;
+  directory_ += "/missing";
+  LimitTableCompiler compiler;
+  ASSERT_TRUE(compile(compiler));
+  EXPECT_FALSE(compiler.cached());
+  ASSERT_EQ(compiler.warnings().size(), 2u);
+  EXPECT_NE(compiler.warnings()[1].find("cannot write limit cache"), std::string::npos);
+  directory_ = directory;
+}
+
+}  // namespace
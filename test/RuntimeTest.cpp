@@ -0,0 +1,546 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "DoubleBuffer.h"
+#include "JointGroupPool.h"
+#include "LatencyRecorder.h"
+#include "SingularityLimitTable.h"
+#include "SingularityLimits.h"
+#include "TransitionJournal.h"
+
+namespace {
+
+/// relative resolution of a bin above 64 ns, one of 32 sub-bins per power of two
+const double kBinResolution = 1.0 / 32.0;
+
+TEST(LatencyHistogramTest, ShortDurationsHaveABinEach) {
+  LatencyHistogram histogram;
+  for (uint64_t ns=0; ns<10; ns++)
+    histogram.record(ns);
+  const LatencyHistogram::Summary summary = histogram.summary();
+  EXPECT_EQ(summary.count, 10u);
+  EXPECT_DOUBLE_EQ(summary.min, 0.0);
+  EXPECT_DOUBLE_EQ(summary.p50, 5e-3);
+  EXPECT_DOUBLE_EQ(summary.p90, 9e-3);
+  EXPECT_DOUBLE_EQ(summary.max, 9e-3);
+}
+
+TEST(LatencyHistogramTest, EveryDurationKnownWithinItsBin) {
+  std::mt19937_64 generator(1);
+  for (int k=0; k<2000 && !HasFailure(); k++) {
+    // log-uniform from 64 ns to about 18 minutes, the longest histogram bin
+    const int bits = std::uniform_int_distribution<int>(6, 40)(generator);
+    const uint64_t ns = (uint64_t(1) << bits) | (generator() & ((uint64_t(1) << bits) - 1));
+    LatencyHistogram histogram;
+    // the median is the duration, not clamped to the longest one
+    histogram.record(ns);
+    histogram.record(0);
+    histogram.record(2 * ns);
+    const double p50 = histogram.summary().p50 * 1e3;
+    EXPECT_GE(p50, ns) << ns;
+    EXPECT_LE(p50, ns * (1.0 + kBinResolution)) << ns;
+  }
+}
+
+TEST(LatencyHistogramTest, PercentilesOfUniformDurations) {
+  LatencyHistogram histogram;
+  // 1 to 1000 microseconds, all of them once, in random order
+  std::vector<uint64_t> durations;
+  for (uint64_t us=1; us<=1000; us++)
+    durations.push_back(us * 1000);
+  std::shuffle(durations.begin(), durations.end(), std::mt19937(2));
+  for (uint64_t ns : durations)
+    histogram.record(ns);
+  const LatencyHistogram::Summary summary = histogram.summary();
+  EXPECT_EQ(summary.count, 1000u);
+  EXPECT_DOUBLE_EQ(summary.min, 1.0);
+  EXPECT_DOUBLE_EQ(summary.max, 1000.0);
+  EXPECT_GE(summary.p50, 501.0);
+  EXPECT_LE(summary.p50, 501.0 * (1.0 + kBinResolution));
+  EXPECT_GE(summary.p90, 901.0);
+  EXPECT_LE(summary.p90, 901.0 * (1.0 + kBinResolution));
+  EXPECT_GE(summary.p99, 991.0);
+  EXPECT_LE(summary.p99, 1000.0);
+  EXPECT_DOUBLE_EQ(summary.p999, 1000.0);
+}
+
+TEST(LatencyHistogramTest, PercentilesNeverBeyondLongestDuration) {
+  LatencyHistogram histogram;
+  histogram.record(100);
+  EXPECT_DOUBLE_EQ(histogram.summary().p50, 0.1);
+  // beyond the last bin
+  histogram.record(uint64_t(1) << 50);
+  histogram.record(uint64_t(1) << 50);
+  const LatencyHistogram::Summary summary = histogram.summary();
+  EXPECT_DOUBLE_EQ(summary.max, (uint64_t(1) << 50) * 1e-3);
+  EXPECT_LE(summary.p999, summary.max);
+  EXPECT_GE(summary.p50, 0.1);
+}
+
+TEST(LatencyHistogramTest, ClearForgetsEverything) {
+  LatencyHistogram histogram;
+  histogram.record(1000);
+  histogram.clear();
+  LatencyHistogram::Summary summary = histogram.summary();
+  EXPECT_EQ(summary.count, 0u);
+  EXPECT_DOUBLE_EQ(summary.max, 0.0);
+  histogram.record(70);
+  summary = histogram.summary();
+  EXPECT_EQ(summary.count, 1u);
+  EXPECT_DOUBLE_EQ(summary.min, 0.07);
+  EXPECT_DOUBLE_EQ(summary.max, 0.07);
+}
+
+TEST(LatencyRecorderTest, SamplesRingAndClearRequest) {
+  LatencyRecorder recorder;
+  recorder.reset(4);
+  recorder.record(1000, 500);
+  recorder.record(-5, -1);
+  for (int k=0; k<4; k++)
+    recorder.record(2000, 100);
+  // a negative cycle time counts as zero, a cycle without a new position has no latency
+  EXPECT_EQ(recorder.cycle().summary().count, 6u);
+  EXPECT_DOUBLE_EQ(recorder.cycle().summary().min, 0.0);
+  EXPECT_EQ(recorder.sample_to_output().summary().count, 5u);
+  EXPECT_EQ(recorder.dropped(), 2u);
+  LatencyRecorder::Sample sample;
+  ASSERT_TRUE(recorder.pop(sample));
+  EXPECT_EQ(sample.cycle_ns, 1000);
+  EXPECT_EQ(sample.sample_to_output_ns, 500);
+  ASSERT_TRUE(recorder.pop(sample));
+  EXPECT_EQ(sample.cycle_ns, -5);
+  EXPECT_EQ(sample.sample_to_output_ns, -1);
+
+  // taken over by the next record() of the recording thread
+  recorder.requestClear();
+  EXPECT_EQ(recorder.cycle().summary().count, 6u);
+  recorder.record(3000, -1);
+  EXPECT_EQ(recorder.cycle().summary().count, 1u);
+  EXPECT_EQ(recorder.sample_to_output().summary().count, 0u);
+}
+
+/**
+ * @brief Entries of a journal file, parsed from the bytes of the documented format
+ */
+struct JournalFile {
+  explicit JournalFile(const std::string& path) : valid(false), version(0), number_of_joints(0) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+      return;
+    std::vector<unsigned char> bytes;
+    unsigned char buffer[4096];
+    std::size_t count;
+    while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+      bytes.insert(bytes.end(), buffer, buffer + count);
+    std::fclose(file);
+    if (bytes.size() < 16 || std::memcmp(&bytes[0], "SDJRNL\0\0", 8) != 0)
+      return;
+    std::memcpy(&version, &bytes[8], 4);
+    std::memcpy(&number_of_joints, &bytes[12], 4);
+    const std::size_t entry_size = 16 + 8 * number_of_joints;
+    if ((bytes.size() - 16) % entry_size != 0)
+      return;
+    for (std::size_t offset=16; offset<bytes.size(); offset+=entry_size) {
+      TransitionJournal::Entry entry;
+      std::memcpy(&entry.stamp_ns, &bytes[offset], 8);
+      entry.from_level = bytes[offset + 8];
+      entry.to_level = bytes[offset + 9];
+      std::memcpy(&entry.trigger_joint, &bytes[offset + 10], 2);
+      std::memcpy(&entry.dropped_before, &bytes[offset + 12], 4);
+      std::memcpy(entry.joint_position, &bytes[offset + 16], 8 * number_of_joints);
+      entries.push_back(entry);
+    }
+    valid = true;
+  }
+
+  bool valid;
+  uint32_t version;
+  uint32_t number_of_joints;
+  std::vector<TransitionJournal::Entry> entries;
+};
+
+class TransitionJournalTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    char path[] = "/tmp/transition_journal_testXXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    path_ = path;
+  }
+  void TearDown() { unlink(path_.c_str()); }
+
+  std::string path_;
+};
+
+TEST_F(TransitionJournalTest, EntriesInDocumentedFormat) {
+  TransitionJournal journal;
+  std::string error;
+  ASSERT_TRUE(journal.open(path_, 3, 16, error)) << error;
+  const double first[3] = {0.5, -1.0, 2.0};
+  const double second[3] = {0.25, -1.5, 3.0};
+  journal.record(1000, 0, 2, 1, first);
+  journal.record(2000, 2, 1, -1, second);
+  journal.close();
+  EXPECT_FALSE(journal.opened());
+
+  const JournalFile file(path_);
+  ASSERT_TRUE(file.valid);
+  const uint32_t version = TransitionJournal::kVersion;
+  EXPECT_EQ(file.version, version);
+  EXPECT_EQ(file.number_of_joints, 3u);
+  ASSERT_EQ(file.entries.size(), 2u);
+  EXPECT_EQ(file.entries[0].stamp_ns, 1000);
+  EXPECT_EQ(file.entries[0].from_level, 0);
+  EXPECT_EQ(file.entries[0].to_level, 2);
+  EXPECT_EQ(file.entries[0].trigger_joint, 1);
+  EXPECT_EQ(file.entries[0].dropped_before, 0u);
+  EXPECT_EQ(file.entries[1].trigger_joint, -1);
+  for (int i=0; i<3; i++) {
+    EXPECT_EQ(file.entries[0].joint_position[i], first[i]);
+    EXPECT_EQ(file.entries[1].joint_position[i], second[i]);
+  }
+}
+
+TEST_F(TransitionJournalTest, AppendsOnlyToJournalOfSameJointCount) {
+  const double position[3] = {0.0, 0.0, 0.0};
+  std::string error;
+  for (int pass=0; pass<2; pass++) {
+    TransitionJournal journal;
+    ASSERT_TRUE(journal.open(path_, 3, 4, error)) << error;
+    journal.record(pass, 0, 1, 0, position);
+  }
+  EXPECT_EQ(JournalFile(path_).entries.size(), 2u);
+  TransitionJournal journal;
+  ASSERT_TRUE(journal.open(path_, 2, 4, error)) << error;
+  journal.record(5, 1, 0, 0, position);
+  journal.close();
+  const JournalFile file(path_);
+  ASSERT_TRUE(file.valid);
+  EXPECT_EQ(file.number_of_joints, 2u);
+  ASSERT_EQ(file.entries.size(), 1u);
+  EXPECT_EQ(file.entries[0].stamp_ns, 5);
+
+  const int max_joints = TransitionJournal::kMaxJoints;
+  EXPECT_FALSE(journal.open(path_, max_joints + 1, 4, error));
+  EXPECT_FALSE(journal.open(path_, 3, 0, error));
+  EXPECT_FALSE(journal.open("/nonexistent/journal", 3, 4, error));
+  EXPECT_FALSE(journal.opened());
+}
+
+TEST_F(TransitionJournalTest, DroppedEntriesCountedWithTheNextOne) {
+  TransitionJournal journal;
+  std::string error;
+  ASSERT_TRUE(journal.open(path_, 1, 4, error)) << error;
+  // much faster than the drain thread, most of them find the ring full
+  const int burst = 10000;
+  for (int k=0; k<burst; k++) {
+    const double position = k;
+    journal.record(k, k & 1, (k + 1) & 1, 0, &position);
+  }
+  // once drained, the next entry carries the drops since the last buffered one
+  while (JournalFile(path_).entries.size() + journal.dropped() < static_cast<std::size_t>(burst))
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  const std::size_t dropped = journal.dropped();
+  EXPECT_GT(dropped, 0u);
+  const double position = burst;
+  journal.record(burst, 0, 1, 0, &position);
+  journal.close();
+
+  const JournalFile file(path_);
+  ASSERT_TRUE(file.valid);
+  EXPECT_EQ(file.entries.size() + dropped, static_cast<std::size_t>(burst) + 1);
+  std::size_t counted = 0;
+  int64_t expected_stamp = 0;
+  for (std::size_t e=0; e<file.entries.size(); e++) {
+    const TransitionJournal::Entry& entry = file.entries[e];
+    // in order, the gaps are the drops
+    EXPECT_EQ(entry.stamp_ns, expected_stamp + static_cast<int64_t>(entry.dropped_before));
+    EXPECT_EQ(entry.joint_position[0], static_cast<double>(entry.stamp_ns));
+    expected_stamp = entry.stamp_ns + 1;
+    counted += entry.dropped_before;
+  }
+  EXPECT_EQ(counted, dropped);
+  EXPECT_EQ(file.entries.back().stamp_ns, burst);
+}
+
+/**
+ * @brief Groups of 3 joints of one table, every task classifying one group of the current position
+ */
+struct GroupTasks {
+  static const int kGroupJoints = 3;
+
+  explicit GroupTasks(int number_of_groups)
+      : n(number_of_groups * kGroupJoints), bands(2 * 3 * n), groups(number_of_groups), runs(number_of_groups),
+        generator(number_of_groups) {
+    std::uniform_real_distribution<double> center(-1.0, 1.0);
+    for (int i=0; i<n; i++) {
+      const double c = center(generator);
+      for (int l=0; l<3; l++) {
+        bands[2 * l * n + i] = c - 0.3 + 0.1 * l;
+        bands[(2 * l + 1) * n + i] = c + 0.3 - 0.1 * l;
+      }
+    }
+    table.build(n, 3, bands);
+    for (int g=0; g<number_of_groups; g++)
+      groups[g].slice(table, g * kGroupJoints, kGroupJoints);
+    position.assign(n, 0.0);
+  }
+
+  static int classify(void* context, int group) {
+    GroupTasks* self = static_cast<GroupTasks*>(context);
+    self->runs[group].fetch_add(1);
+    return self->groups[group].classify(&self->position[group * kGroupJoints]);
+  }
+
+  void randomPosition() {
+    std::uniform_real_distribution<double> anywhere(-1.5, 1.5);
+    for (int i=0; i<n; i++)
+      position[i] = anywhere(generator);
+  }
+
+  /// level of a group of the current position, from the reference classifier
+  int reference(int group) const {
+    std::vector<double> group_bands(2 * 3 * kGroupJoints);
+    for (int row=0; row<6; row++) {
+      for (int i=0; i<kGroupJoints; i++)
+        group_bands[row * kGroupJoints + i] = bands[row * n + group * kGroupJoints + i];
+    }
+    return singularity_detector::checkSingularityLevel(kGroupJoints, 3, &position[group * kGroupJoints], group_bands);
+  }
+
+  int n;
+  std::vector<double> bands;
+  SingularityLimitTable table;
+  std::vector<SingularityLimitTable> groups;
+  std::vector<std::atomic<int> > runs;
+  std::vector<double> position;
+  std::mt19937 generator;
+};
+
+TEST(JointGroupPoolTest, EveryTaskOnceWithReferenceResult) {
+  const int worker_counts[] = {0, 1, 3};
+  const int group_counts[] = {1, 2, 5, 16};
+  for (int workers : worker_counts) {
+    for (int groups : group_counts) {
+      GroupTasks tasks(groups);
+      JointGroupPool pool;
+      std::string error;
+      ASSERT_TRUE(pool.start(groups, std::vector<int>(workers, -1), &GroupTasks::classify, &tasks, error)) << error;
+      EXPECT_EQ(pool.number_of_workers(), workers);
+      EXPECT_EQ(pool.number_of_tasks(), groups);
+      for (int k=1; k<=200 && !HasFailure(); k++) {
+        tasks.randomPosition();
+        // now and then long enough between two runs for the workers to go to sleep
+        if (k % 50 == 0)
+          std::this_thread::sleep_for(2 * JointGroupPool::kSpinTime);
+        pool.run();
+        for (int g=0; g<groups; g++) {
+          EXPECT_EQ(tasks.runs[g].load(), k) << workers << " workers, group " << g;
+          EXPECT_EQ(pool.result(g), tasks.reference(g)) << workers << " workers, group " << g;
+        }
+      }
+      pool.stop();
+    }
+  }
+}
+
+/**
+ * @brief Tasks of which the first one started waits for all other ones to finish
+ *
+ * The remaining tasks of the queue of the waiting thread finish only if another thread steals them.
+ */
+struct StalledTasks {
+  explicit StalledTasks(int number_of_tasks) : count(number_of_tasks), started(0), done(0), stolen(false) {}
+
+  static int run(void* context, int task) {
+    StalledTasks* self = static_cast<StalledTasks*>(context);
+    if (self->started.fetch_add(1) == 0) {
+      const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+                                                             std::chrono::seconds(5);
+      while (self->done.load() < self->count - 1 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      self->stolen = self->done.load() == self->count - 1;
+    }
+    self->done.fetch_add(1);
+    return task;
+  }
+
+  int count;
+  std::atomic<int> started;
+  std::atomic<int> done;
+  bool stolen;
+};
+
+TEST(JointGroupPoolTest, IdleThreadStealsTasksOfStalledOne) {
+  // two queues of four tasks, one of the caller and one of the worker
+  StalledTasks tasks(8);
+  JointGroupPool pool;
+  std::string error;
+  ASSERT_TRUE(pool.start(8, std::vector<int>(1, -1), &StalledTasks::run, &tasks, error)) << error;
+  pool.run();
+  EXPECT_TRUE(tasks.stolen);
+  EXPECT_EQ(tasks.done.load(), 8);
+  for (int t=0; t<8; t++)
+    EXPECT_EQ(pool.result(t), t);
+}
+
+TEST(JointGroupPoolTest, RefusesInvalidCpu) {
+  GroupTasks tasks(2);
+  JointGroupPool pool;
+  std::string error;
+  EXPECT_FALSE(pool.start(2, std::vector<int>(1, 1 << 20), &GroupTasks::classify, &tasks, error));
+  EXPECT_FALSE(error.empty());
+  EXPECT_EQ(pool.number_of_workers(), 0);
+}
+
+TEST(DoubleBufferTest, PeriodicReaderHoldsOnlyItsCycle) {
+  DoubleBuffer<int> buffer;
+  uint64_t version;
+  int* slot = buffer.beginWrite();
+  ASSERT_TRUE(slot != NULL);
+  *slot = 1;
+  buffer.publish();
+  EXPECT_EQ(buffer.version(), 1u);
+  EXPECT_EQ(buffer.acquire(version), 1);
+  EXPECT_EQ(version, 1u);
+  // the other slot is free while the reader holds the published one
+  slot = buffer.beginWrite();
+  ASSERT_TRUE(slot != NULL);
+  *slot = 2;
+  buffer.publish();
+  EXPECT_EQ(buffer.published(), 2);
+  // the slot still held by the reader is not handed out
+  EXPECT_TRUE(buffer.beginWrite() == NULL);
+  buffer.release();
+  EXPECT_TRUE(buffer.beginWrite() != NULL);
+  EXPECT_EQ(buffer.acquire(version), 2);
+  EXPECT_EQ(version, 2u);
+  buffer.release();
+}
+
+TEST(DoubleBufferTest, WritesWithoutPeriodicReader) {
+  // a reader which is stopped, or never stepped, holds nothing
+  DoubleBuffer<int> buffer;
+  for (int k=1; k<=5; k++) {
+    int* slot = buffer.beginWrite();
+    ASSERT_TRUE(slot != NULL) << "write " << k;
+    *slot = k;
+    buffer.publish();
+  }
+  uint64_t version;
+  EXPECT_EQ(buffer.acquire(version), 5);
+  // a slot refilled twice since the reader held it last has a new version
+  EXPECT_EQ(version, 5u);
+  buffer.release();
+}
+
+TEST(DoubleBufferTest, PinnedSlotNotHandedOut) {
+  DoubleBuffer<int> buffer;
+  *buffer.beginWrite() = 1;
+  buffer.publish();
+  int first;
+  int second;
+  EXPECT_EQ(buffer.pin(first), 1);
+  EXPECT_EQ(buffer.pin(second), 1);
+  *buffer.beginWrite() = 2;
+  buffer.publish();
+  EXPECT_TRUE(buffer.beginWrite() == NULL);
+  buffer.unpin(first);
+  EXPECT_TRUE(buffer.beginWrite() == NULL);
+  buffer.unpin(second);
+  EXPECT_TRUE(buffer.beginWrite() != NULL);
+}
+
+/// a value which is consistent only if nobody writes it while it is read
+struct Pattern {
+  uint64_t words[16];
+};
+
+bool consistent(const Pattern& pattern) {
+  for (int w=1; w<16; w++) {
+    if (pattern.words[w] != pattern.words[0])
+      return false;
+  }
+  return true;
+}
+
+TEST(DoubleBufferTest, ReadersNeverSeeAValueBeingWritten) {
+  DoubleBuffer<Pattern> buffer;
+  Pattern* first = buffer.beginWrite();
+  std::fill(first->words, first->words + 16, 0);
+  buffer.publish();
+  std::atomic<bool> stop(false);
+  std::atomic<int> torn(0);
+  std::atomic<uint64_t> writes(0);
+  std::thread writer([&]() {
+    for (uint64_t value=1; !stop.load(); ) {
+      Pattern* slot = buffer.beginWrite();
+      if (!slot) {
+        std::this_thread::yield();
+        continue;
+      }
+      // word by word, so that a reader of this slot would see it torn
+      for (int w=0; w<16; w++) {
+        slot->words[w] = value;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+      }
+      buffer.publish();
+      value++;
+      writes.fetch_add(1);
+    }
+  });
+  std::thread querier([&]() {
+    while (!stop.load()) {
+      int slot;
+      const Pattern& pattern = buffer.pin(slot);
+      const Pattern copy = pattern;
+      std::this_thread::yield();
+      if (!consistent(copy) || !consistent(pattern) || pattern.words[0] != copy.words[0])
+        torn.fetch_add(1);
+      buffer.unpin(slot);
+    }
+  });
+  uint64_t last_version = 0;
+  uint64_t last_value = 0;
+  // cycles of the periodic reader, the other threads run in between
+  const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (writes.load() < 5000 && std::chrono::steady_clock::now() < deadline) {
+    uint64_t version;
+    const Pattern& pattern = buffer.acquire(version);
+    EXPECT_GE(version, last_version);
+    EXPECT_GE(pattern.words[0], last_value);
+    last_version = version;
+    last_value = pattern.words[0];
+    std::this_thread::yield();
+    if (!consistent(pattern) || pattern.words[0] != last_value)
+      torn.fetch_add(1);
+    buffer.release();
+    std::this_thread::yield();
+  }
+  stop.store(true);
+  writer.join();
+  querier.join();
+  EXPECT_EQ(torn.load(), 0);
+  EXPECT_GE(writes.load(), 5000u);
+}
+
+}  // namespace
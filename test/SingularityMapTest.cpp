@@ -0,0 +1,128 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "SingularityLimitTable.h"
+#include "SingularityMap.h"
+
+namespace {
+
+SingularityLimitTable twoJointTable(double edge) {
+  SingularityLimitTable table;
+  const double bands[] = {-1.0, -1.0, 1.0, 1.0, edge, -0.5, 0.5, 0.5};
+  table.build(2, 2, std::vector<double>(bands, bands + 8));
+  return table;
+}
+
+/**
+ * @brief Map of 2 joints on [0, 4) with 4 cells each in blocks of 2x2 cells, one of them dense
+ */
+class SingularityMapTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    char path[] = "/tmp/singularity_map_testXXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    path_ = path;
+    std::memset(&header_, 0, sizeof(header_));
+    std::memcpy(header_.magic, kSingularityMapMagic, sizeof(header_.magic));
+    header_.version = SingularityMapHeader::kVersion;
+    header_.number_of_joints = 2;
+    header_.block_bits = 1;
+    header_.number_of_blocks = 4;
+    header_.number_of_dense_blocks = 1;
+    header_.index_offset = sizeof(header_);
+    header_.cells_offset = sizeof(header_) + 4 * 4;
+    header_.bands_key = SingularityMap::bandsKey(twoJointTable(-0.5));
+    for (int j=0; j<2; j++) {
+      header_.lower[j] = 0.0;
+      header_.upper[j] = 4.0;
+      header_.cells[j] = 4;
+    }
+  }
+  void TearDown() { unlink(path_.c_str()); }
+
+  void write() const {
+    const uint32_t index[4] = {SingularityMapHeader::kUniformBlock | 0, SingularityMapHeader::kUniformBlock | 1,
+                               0, SingularityMapHeader::kUniformBlock | 0};
+    const uint8_t cells[4] = {0, 2, 3, 1};
+    std::FILE* file = std::fopen(path_.c_str(), "wb");
+    ASSERT_TRUE(file != NULL);
+    std::fwrite(&header_, sizeof(header_), 1, file);
+    std::fwrite(index, sizeof(index), 1, file);
+    std::fwrite(cells, sizeof(cells), 1, file);
+    std::fclose(file);
+  }
+
+  std::string path_;
+  SingularityMapHeader header_;
+};
+
+TEST_F(SingularityMapTest, OpenFindsHighestLevelAndBandsKey) {
+  write();
+  SingularityMap map;
+  std::string error;
+  ASSERT_TRUE(map.open(path_, error)) << error;
+  EXPECT_EQ(map.max_level(), 3);
+  EXPECT_EQ(map.bands_key(), SingularityMap::bandsKey(twoJointTable(-0.5)));
+  // block 2 is the dense one, its cell 0 of joint 0 and cell 1 of joint 1 holds 3
+  const double dense[2] = {0.5, 3.5};
+  const double uniform[2] = {2.5, 0.5};
+  EXPECT_EQ(map.lookup(dense), 3);
+  EXPECT_EQ(map.lookup(uniform), 1);
+  map.close();
+  EXPECT_EQ(map.max_level(), 0);
+}
+
+TEST_F(SingularityMapTest, OpenRefusesPreviousVersion) {
+  // version 2 maps have a bands key that does not cover the periods
+  for (uint32_t version=1; version<SingularityMapHeader::kVersion; version++) {
+    header_.version = version;
+    write();
+    SingularityMap map;
+    std::string error;
+    EXPECT_FALSE(map.open(path_, error)) << version;
+    EXPECT_FALSE(error.empty());
+  }
+}
+
+TEST_F(SingularityMapTest, PeriodicTableRefusesMapBakedWithoutPeriods) {
+  write();
+  SingularityMap map;
+  std::string error;
+  ASSERT_TRUE(map.open(path_, error)) << error;
+  SingularityLimitTable periodic = twoJointTable(-0.5);
+  const double periods[] = {0.0, 4.0};
+  ASSERT_TRUE(periodic.setPeriods(std::vector<double>(periods, periods + 2), error)) << error;
+  EXPECT_NE(map.bands_key(), SingularityMap::bandsKey(periodic));
+  // the key follows the value of the period, not only whether a joint is periodic
+  SingularityLimitTable longer = twoJointTable(-0.5);
+  const double longer_periods[] = {0.0, 8.0};
+  ASSERT_TRUE(longer.setPeriods(std::vector<double>(longer_periods, longer_periods + 2), error)) << error;
+  EXPECT_NE(SingularityMap::bandsKey(periodic), SingularityMap::bandsKey(longer));
+  // without periods the key is the one of the table as built
+  ASSERT_TRUE(periodic.setPeriods(std::vector<double>(), error)) << error;
+  EXPECT_EQ(map.bands_key(), SingularityMap::bandsKey(periodic));
+}
+
+TEST(SingularityMapBandsKeyTest, KeyFollowsEveryEdge) {
+  EXPECT_EQ(SingularityMap::bandsKey(twoJointTable(-0.5)), SingularityMap::bandsKey(twoJointTable(-0.5)));
+  EXPECT_NE(SingularityMap::bandsKey(twoJointTable(-0.5)), SingularityMap::bandsKey(twoJointTable(-0.25)));
+  EXPECT_EQ(SingularityMap::bandsKey(twoJointTable(0.0)), SingularityMap::bandsKey(twoJointTable(-0.0)));
+  EXPECT_NE(SingularityMap::bandsKey(twoJointTable(-0.5)), SingularityMap::bandsKey(SingularityLimitTable()));
+}
+
+}  // namespace
@@ -0,0 +1,421 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+/**
+ * @brief Offline tool baking the singularity level of a joint space grid into a map file
+ *
+ * Bake:
+ *   bake_singularity_map --joints N [--bands FILE [--periods a,b,..]] [--regions FILE]
+ *                        --lower a,b,.. --upper a,b,.. --cells C[,C,..] [--block-bits B] [--sample-centers]
+ *                        --output MAP
+ * Verify a baked map against the runtime classifiers:
+ *   bake_singularity_map --joints N [--bands FILE [--periods a,b,..]] [--regions FILE] --verify MAP [--samples S]
+ *
+ * FILE of --bands holds the limits in the layout of the singularity_bands
+ * property, separated by white space. By default every cell gets the highest
+ * level of any position inside it, derived exactly from the band and region
+ * boxes, so the map never reports a lower level than the runtime classifier.
+ * With --sample-centers cells get the level of their center instead, which is
+ * the only mode of the manipulability backend (--urdf, --base, --tip,
+ * --metric, --thresholds), available when the tool is built with KDL.
+ * --periods takes the joint_periods property, 0 for a joint that is not
+ * periodic. The bands of a periodic joint repeat every period, the grid still
+ * spans --lower to --upper as the positions are read, without reduction.
+ * The map records a hash of the bands and the periods, verification and the
+ * detector refuse a map baked from other bands or periods before sampling.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CoupledRegionIndex.h"
+#include "SingularityLimitTable.h"
+#include "SingularityLimits.h"
+#include "SingularityMap.h"
+
+#ifdef SINGULARITY_DETECTOR_WITH_KDL
+#include <kdl/tree.hpp>
+#include <kdl_parser/kdl_parser.hpp>
+
+#include "ManipulabilityBackend.h"
+#endif
+
+namespace {
+
+/// alignment of the coarse index and of the dense cells in the file
+const uint64_t kSectionAlignment = 64;
+/// fraction of a cell every cell box is grown by on both sides when baking conservatively
+const double kCellPadding = 1e-6;
+
+typedef std::map<std::string, std::string> Arguments;
+
+bool parseList(const std::string& text, std::vector<double>& values) {
+  std::istringstream stream(text);
+  std::string item;
+  values.clear();
+  while (std::getline(stream, item, ',')) {
+    char* end;
+    values.push_back(std::strtod(item.c_str(), &end));
+    if (item.empty() || *end != '\0')
+      return false;
+  }
+  return !values.empty();
+}
+
+/**
+ * @brief Every classifier the map is baked from or verified against
+ */
+struct Sources {
+  int number_of_joints;
+  SingularityLimitTable table;
+  std::vector<CoupledRegionIndex::Region> region_list;
+  CoupledRegionIndex regions;
+#ifdef SINGULARITY_DETECTOR_WITH_KDL
+  ManipulabilityBackend manipulability;
+  bool with_manipulability = false;
+#endif
+
+  bool exact() const {
+#ifdef SINGULARITY_DETECTOR_WITH_KDL
+    return !with_manipulability;
+#else
+    return true;
+#endif
+  }
+
+  int classify(const double* joint_position) {
+    int level = std::max(table.classify(joint_position), regions.classify(joint_position));
+#ifdef SINGULARITY_DETECTOR_WITH_KDL
+    if (with_manipulability)
+      level = std::max(level, manipulability.classify(Eigen::Map<const Eigen::VectorXd>(joint_position,
+                                                                                        number_of_joints)));
+#endif
+    return level;
+  }
+
+  /**
+   * @brief Bound the level of all positions of the box [lower, upper] of the joint space
+   *
+   * A band of a periodic joint is repeated every period, the box is tested
+   * against every image of the band it may reach.
+   */
+  void levelRange(const double* lower, const double* upper, const std::vector<int>& candidate_regions,
+                  int& min_level, int& max_level) const {
+    min_level = 0;
+    max_level = 0;
+    for (int j=0; j<number_of_joints; j++) {
+      const double period = table.period(j);
+      for (int l=1; l<=table.number_of_levels(); l++) {
+        double first = 0.0;
+        double last = 0.0;
+        if (period > 0.0) {
+          first = std::floor((lower[j] - table.upper(l, j)) / period);
+          last = std::ceil((upper[j] - table.lower(l, j)) / period);
+        }
+        for (double k=first; k<=last; k+=1.0) {
+          const double band_lower = table.lower(l, j) + k * period;
+          const double band_upper = table.upper(l, j) + k * period;
+          if (lower[j] < band_upper && upper[j] > band_lower)
+            max_level = std::max(max_level, l);
+          if (lower[j] > band_lower && upper[j] < band_upper)
+            min_level = std::max(min_level, l);
+        }
+      }
+    }
+    for (std::size_t k=0; k<candidate_regions.size(); k++) {
+      const CoupledRegionIndex::Region& region = region_list[candidate_regions[k]];
+      bool overlaps = true;
+      bool contains = region.offsets.empty();
+      for (int j=0; j<number_of_joints; j++) {
+        overlaps &= lower[j] < region.upper[j] && upper[j] > region.lower[j];
+        contains &= lower[j] > region.lower[j] && upper[j] < region.upper[j];
+      }
+      if (overlaps)
+        max_level = std::max(max_level, region.level);
+      if (contains)
+        min_level = std::max(min_level, region.level);
+    }
+  }
+};
+
+bool loadSources(const Arguments& arguments, Sources& sources) {
+  Arguments::const_iterator joints = arguments.find("joints");
+  Arguments::const_iterator bands_file = arguments.find("bands");
+  if (joints == arguments.end()) {
+    std::cerr << "--joints is required" << std::endl;
+    return false;
+  }
+  sources.number_of_joints = std::atoi(joints->second.c_str());
+  if (sources.number_of_joints <= 0 || sources.number_of_joints > SingularityMapHeader::kMaxJoints) {
+    std::cerr << "number of joints must be between 1 and " << SingularityMapHeader::kMaxJoints << std::endl;
+    return false;
+  }
+  std::string error;
+  if (bands_file != arguments.end()) {
+    std::ifstream bands_stream(bands_file->second.c_str());
+    const std::vector<double> bands((std::istream_iterator<double>(bands_stream)), std::istream_iterator<double>());
+    int number_of_levels;
+    if (!singularity_detector::checkBandTable(sources.number_of_joints, bands, number_of_levels, error) ||
+        !sources.table.build(sources.number_of_joints, number_of_levels, bands)) {
+      std::cerr << bands_file->second << ": " << error << std::endl;
+      return false;
+    }
+  }
+  if (arguments.count("periods")) {
+    std::vector<double> periods;
+    if (bands_file == arguments.end()) {
+      std::cerr << "--periods requires --bands" << std::endl;
+      return false;
+    }
+    if (!parseList(arguments.at("periods"), periods) || !sources.table.setPeriods(periods, error)) {
+      std::cerr << "invalid --periods: " << error << std::endl;
+      return false;
+    }
+  }
+
+  Arguments::const_iterator regions_file = arguments.find("regions");
+  if (regions_file != arguments.end()) {
+    std::ifstream regions_stream(regions_file->second.c_str());
+    if (!regions_stream || !CoupledRegionIndex::parse(regions_stream, sources.number_of_joints, sources.region_list,
+                                                      error) ||
+        !sources.regions.build(sources.number_of_joints, sources.region_list, error)) {
+      std::cerr << regions_file->second << ": " << error << std::endl;
+      return false;
+    }
+  } else {
+    sources.regions.build(sources.number_of_joints, sources.region_list, error);
+  }
+
+  if (arguments.count("urdf")) {
+#ifdef SINGULARITY_DETECTOR_WITH_KDL
+    std::ifstream urdf_stream(arguments.at("urdf").c_str());
+    const std::string urdf((std::istreambuf_iterator<char>(urdf_stream)), std::istreambuf_iterator<char>());
+    KDL::Tree tree;
+    KDL::Chain chain;
+    ManipulabilityBackend::Metric metric = ManipulabilityBackend::kManipulability;
+    std::vector<double> thresholds;
+    if (!kdl_parser::treeFromString(urdf, tree) || !arguments.count("base") || !arguments.count("tip") ||
+        !tree.getChain(arguments.at("base"), arguments.at("tip"), chain) ||
+        static_cast<int>(chain.getNrOfJoints()) != sources.number_of_joints) {
+      std::cerr << "no kinematic chain of " << sources.number_of_joints << " joints from --base to --tip" << std::endl;
+      return false;
+    }
+    if ((arguments.count("metric") && !ManipulabilityBackend::parseMetric(arguments.at("metric"), metric)) ||
+        !arguments.count("thresholds") || !parseList(arguments.at("thresholds"), thresholds) ||
+        !sources.manipulability.configure(chain, metric, thresholds, 0.0)) {
+      std::cerr << "invalid --metric or --thresholds" << std::endl;
+      return false;
+    }
+    sources.with_manipulability = true;
+#else
+    std::cerr << "built without KDL, --urdf is not supported" << std::endl;
+    return false;
+#endif
+  }
+  return true;
+}
+
+/**
+ * @brief Decode the position of the k-th item of a grid, joint 0 varying first
+ */
+void decode(uint64_t k, const std::vector<uint64_t>& extent, std::vector<uint64_t>& position) {
+  for (std::size_t j=0; j<extent.size(); j++) {
+    position[j] = k % extent[j];
+    k /= extent[j];
+  }
+}
+
+int bake(const Arguments& arguments, Sources& sources) {
+  const int n = sources.number_of_joints;
+  std::vector<double> lower, upper, cells;
+  if (!arguments.count("lower") || !parseList(arguments.at("lower"), lower) || !arguments.count("upper") ||
+      !parseList(arguments.at("upper"), upper) || !arguments.count("cells") || !parseList(arguments.at("cells"), cells) ||
+      !arguments.count("output")) {
+    std::cerr << "--lower, --upper, --cells and --output are required" << std::endl;
+    return 2;
+  }
+  if (cells.size() == 1)
+    cells.assign(n, cells[0]);
+  const unsigned block_bits = arguments.count("block-bits") ? std::atoi(arguments.at("block-bits").c_str()) : 2;
+  const uint64_t block = 1u << block_bits;
+  if (static_cast<int>(lower.size()) != n || static_cast<int>(upper.size()) != n || static_cast<int>(cells.size()) != n ||
+      block_bits * n > 24) {
+    std::cerr << "--lower, --upper and --cells need one value per joint, --block-bits times joints at most 24"
+              << std::endl;
+    return 2;
+  }
+  const bool conservative = !arguments.count("sample-centers");
+  if (conservative && !sources.exact()) {
+    std::cerr << "the manipulability backend can only be baked with --sample-centers" << std::endl;
+    return 2;
+  }
+
+  SingularityMapHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kSingularityMapMagic, sizeof(header.magic));
+  header.version = SingularityMapHeader::kVersion;
+  header.number_of_joints = n;
+  header.block_bits = block_bits;
+  header.flags = conservative ? SingularityMapHeader::kConservative : 0;
+  header.bands_key = SingularityMap::bandsKey(sources.table);
+  std::vector<uint64_t> blocks_per_joint(n), block_extent(n, block);
+  std::vector<double> step(n);
+  header.number_of_blocks = 1;
+  for (int j=0; j<n; j++) {
+    // round the cells up to whole blocks
+    const uint64_t joint_cells = (static_cast<uint64_t>(cells[j]) + block - 1) / block * block;
+    if (joint_cells == 0 || !(lower[j] < upper[j])) {
+      std::cerr << "joint " << j << " has an empty domain" << std::endl;
+      return 2;
+    }
+    header.lower[j] = lower[j];
+    header.upper[j] = upper[j];
+    header.cells[j] = joint_cells;
+    blocks_per_joint[j] = joint_cells / block;
+    step[j] = (upper[j] - lower[j]) / joint_cells;
+    header.number_of_blocks *= blocks_per_joint[j];
+  }
+
+  const uint64_t block_cells = static_cast<uint64_t>(1) << (block_bits * n);
+  std::vector<uint32_t> index(header.number_of_blocks);
+  std::vector<uint8_t> dense;
+  std::vector<uint8_t> levels(block_cells);
+  std::vector<uint64_t> block_position(n), cell_position(n);
+  std::vector<double> box_lower(n), box_upper(n), center(n);
+  std::vector<int> candidate_regions;
+  for (uint64_t b=0; b<header.number_of_blocks; b++) {
+    decode(b, blocks_per_joint, block_position);
+    // boxes are grown slightly, so rounding in SingularityMap::lookup cannot pick a neighbouring cell of lower level
+    for (int j=0; j<n; j++) {
+      box_lower[j] = lower[j] + block_position[j] * block * step[j] - kCellPadding * step[j];
+      box_upper[j] = box_lower[j] + (block + 2 * kCellPadding) * step[j];
+    }
+    // regions not touching the block cannot matter for its cells
+    candidate_regions.clear();
+    for (std::size_t r=0; r<sources.region_list.size(); r++) {
+      bool overlaps = true;
+      for (int j=0; j<n; j++)
+        overlaps &= box_lower[j] < sources.region_list[r].upper[j] && box_upper[j] > sources.region_list[r].lower[j];
+      if (overlaps)
+        candidate_regions.push_back(r);
+    }
+    int min_level = 0, max_level = 0;
+    if (conservative) {
+      sources.levelRange(&box_lower[0], &box_upper[0], candidate_regions, min_level, max_level);
+      if (min_level == max_level) {
+        index[b] = SingularityMapHeader::kUniformBlock | max_level;
+        continue;
+      }
+    }
+    for (uint64_t c=0; c<block_cells; c++) {
+      decode(c, block_extent, cell_position);
+      for (int j=0; j<n; j++) {
+        box_lower[j] = lower[j] + (block_position[j] * block + cell_position[j] - kCellPadding) * step[j];
+        box_upper[j] = box_lower[j] + (1 + 2 * kCellPadding) * step[j];
+        center[j] = box_lower[j] + (0.5 + kCellPadding) * step[j];
+      }
+      int cell_min, cell_max;
+      if (conservative)
+        sources.levelRange(&box_lower[0], &box_upper[0], candidate_regions, cell_min, cell_max);
+      else
+        cell_max = sources.classify(&center[0]);
+      levels[c] = static_cast<uint8_t>(cell_max);
+    }
+    if (std::count(levels.begin(), levels.end(), levels[0]) == static_cast<std::ptrdiff_t>(block_cells)) {
+      index[b] = SingularityMapHeader::kUniformBlock | levels[0];
+      continue;
+    }
+    index[b] = header.number_of_dense_blocks++;
+    dense.insert(dense.end(), levels.begin(), levels.end());
+  }
+
+  header.index_offset = (sizeof(header) + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+  header.cells_offset = (header.index_offset + 4 * index.size() + kSectionAlignment - 1) / kSectionAlignment *
+                        kSectionAlignment;
+  std::ofstream output(arguments.at("output").c_str(), std::ios::binary | std::ios::trunc);
+  const std::vector<char> padding(kSectionAlignment, 0);
+  output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  output.write(&padding[0], header.index_offset - sizeof(header));
+  output.write(reinterpret_cast<const char*>(&index[0]), 4 * index.size());
+  output.write(&padding[0], header.cells_offset - header.index_offset - 4 * index.size());
+  if (!dense.empty())
+    output.write(reinterpret_cast<const char*>(&dense[0]), dense.size());
+  if (!output) {
+    std::cerr << "cannot write " << arguments.at("output") << std::endl;
+    return 1;
+  }
+  std::cout << header.number_of_blocks << " blocks, " << header.number_of_dense_blocks << " dense, "
+            << header.cells_offset + dense.size() << " bytes" << (conservative ? ", conservative" : ", sampled")
+            << std::endl;
+  return 0;
+}
+
+int verify(const Arguments& arguments, Sources& sources) {
+  SingularityMap map;
+  std::string error;
+  if (!map.open(arguments.at("verify"), error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  if (map.number_of_joints() != sources.number_of_joints) {
+    std::cerr << "map of " << map.number_of_joints() << " joints" << std::endl;
+    return 1;
+  }
+  if (map.bands_key() != SingularityMap::bandsKey(sources.table)) {
+    std::cerr << "map baked from other bands or periods" << std::endl;
+    return 1;
+  }
+  const long samples = arguments.count("samples") ? std::atol(arguments.at("samples").c_str()) : 1000000;
+  std::mt19937_64 generator(0);
+  const SingularityMapHeader& header = *map.header();
+  std::vector<double> position(sources.number_of_joints);
+  long below = 0, above = 0;
+  for (long s=0; s<samples; s++) {
+    for (int j=0; j<sources.number_of_joints; j++)
+      position[j] = std::uniform_real_distribution<double>(header.lower[j], header.upper[j])(generator);
+    const int baked = map.lookup(&position[0]);
+    const int level = sources.classify(&position[0]);
+    below += baked >= 0 && baked < level;
+    above += baked > level;
+  }
+  std::cout << samples << " samples, map below runtime: " << below << ", above runtime: " << above << std::endl;
+  // a sampled map may differ near the band edges, a conservative one must never be lower
+  return map.conservative() && below > 0 ? 1 : 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Arguments arguments;
+  for (int i=1; i<argc; i++) {
+    if (std::strncmp(argv[i], "--", 2) != 0) {
+      std::cerr << "unexpected argument " << argv[i] << std::endl;
+      return 2;
+    }
+    const std::string name = argv[i] + 2;
+    if (name == "sample-centers")
+      arguments[name] = "";
+    else if (i + 1 < argc)
+      arguments[name] = argv[++i];
+    else
+      arguments[name] = "";
+  }
+  Sources sources;
+  if (!loadSources(arguments, sources))
+    return 2;
+  return arguments.count("verify") ? verify(arguments, sources) : bake(arguments, sources);
+}
@@ -0,0 +1,515 @@
+ /******************************************************************************
+ * Detect and classify the position of a robot in the proximity of a singular position
+ * EasyRobots @2022
+ *      Author: Lukasz Gruszka
+ *****************************************************************************/
+
+/**
+ * @brief Offline tool streaming recorded joint positions through the core classifiers as fast as possible
+ *
+ * Replay:
+ *   replay_singularity_log --joints N --bands FILE [--regions FILE] (--csv LOG | --binary LOG)
+ *                          [--time-column K] [--position-column K] [--time-scale S]
+ *                          [--periods a,b,..] [--hysteresis H] [--min-dwell S] [--chunk C] [--timeline OUT]
+ * Convert a CSV log into a binary columnar log, which is mapped instead of parsed:
+ *   replay_singularity_log --joints N --csv LOG [--time-column K] [--position-column K] [--time-scale S]
+ *                          --convert OUT
+ *
+ * FILE of --bands holds the limits in the layout of the singularity_bands
+ * property. Every CSV line holds the time in column --time-column (0 by
+ * default, multiplied by --time-scale to get seconds) and the N joint
+ * positions from column --position-column on (1 by default); lines that do
+ * not parse, like a header line, are skipped. Rosbags are replayed through
+ * their CSV export, e.g. rostopic echo -b BAG -p /joint_states, whose time
+ * column is in nanoseconds (--time-scale 1e-9, --position-column of the
+ * first field.position). --periods gives the period of every joint like the
+ * joint_periods property, 0 for a joint that is not periodic; coupled regions
+ * see the positions as logged, as in the component. The log is classified in chunks of C samples (65536
+ * by default), in parallel when built with TBB. The published level is then
+ * filtered like in the component and summarized as dwell statistics per
+ * level and time per band of every joint; --timeline writes it run-length
+ * encoded as start,end,level lines.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef SINGULARITY_DETECTOR_WITH_TBB
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif
+
+#include "CoupledRegionIndex.h"
+#include "LevelFilter.h"
+#include "SingularityLimitTable.h"
+#include "SingularityLimits.h"
+
+namespace {
+
+typedef std::map<std::string, std::string> Arguments;
+
+/**
+ * @brief Fixed-size header at the start of a binary columnar joint log
+ *
+ * Followed at data_offset by number_of_samples times [s], then by
+ * number_of_samples positions of every joint, joint after joint.
+ */
+struct JointLogHeader {
+  static const uint32_t kVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t number_of_joints;
+  uint64_t number_of_samples;
+  uint64_t data_offset;
+  char reserved[32];
+};
+
+const char kJointLogMagic[8] = {'S', 'D', 'J', 'L', 'O', 'G', '\0', '\0'};
+
+/**
+ * @brief Recorded log in columnar layout, parsed into memory or mapped from a binary log
+ */
+class JointLog {
+ public:
+  JointLog() : number_of_joints_(0), count_(0), time_(NULL), columns_(NULL), mapping_(NULL), mapping_size_(0) {}
+  ~JointLog() {
+    if (mapping_)
+      munmap(mapping_, mapping_size_);
+  }
+
+  bool parseCsv(const std::string& path, int number_of_joints, int time_column, int position_column,
+                double time_scale) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+      std::cerr << "cannot open " << path << std::endl;
+      return false;
+    }
+    const int last_column = std::max(time_column, position_column + number_of_joints - 1);
+    std::vector<std::vector<double> > columns(number_of_joints + 1);
+    const bool time_in_positions = time_column >= position_column && time_column < position_column + number_of_joints;
+    const int needed = number_of_joints + (time_in_positions ? 0 : 1);
+    std::vector<double> values(last_column + 1);
+    std::string line;
+    while (std::getline(file, line)) {
+      // only the needed columns have to be numbers, others may hold names or frame ids
+      const char* text = line.c_str();
+      int parsed = 0;
+      for (int c=0; c<=last_column && text; c++) {
+        if (c == time_column || (c >= position_column && c < position_column + number_of_joints)) {
+          char* end;
+          values[c] = std::strtod(text, &end);
+          if (end == text || (*end != ',' && *end != '\0' && *end != '\r'))
+            break;
+          parsed++;
+        }
+        text = std::strchr(text, ',');
+        text = text ? text + 1 : NULL;
+      }
+      if (parsed != needed)
+        continue;
+      columns[0].push_back(values[time_column] * time_scale);
+      for (int j=0; j<number_of_joints; j++)
+        columns[j+1].push_back(values[position_column + j]);
+    }
+    number_of_joints_ = number_of_joints;
+    count_ = columns[0].size();
+    storage_.clear();
+    storage_.reserve((number_of_joints + 1) * count_);
+    for (std::size_t c=0; c<columns.size(); c++)
+      storage_.insert(storage_.end(), columns[c].begin(), columns[c].end());
+    time_ = storage_.empty() ? NULL : &storage_[0];
+    columns_ = storage_.empty() ? NULL : &storage_[count_];
+    return true;
+  }
+
+  bool mapBinary(const std::string& path, int number_of_joints) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(JointLogHeader)) {
+      if (fd >= 0)
+        ::close(fd);
+      std::cerr << "cannot open " << path << std::endl;
+      return false;
+    }
+    void* mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+      std::cerr << "cannot map " << path << std::endl;
+      return false;
+    }
+    mapping_ = mapping;
+    mapping_size_ = status.st_size;
+    const JointLogHeader* header = static_cast<const JointLogHeader*>(mapping);
+    if (std::memcmp(header->magic, kJointLogMagic, sizeof(kJointLogMagic)) != 0 ||
+        header->version != JointLogHeader::kVersion || static_cast<int>(header->number_of_joints) != number_of_joints ||
+        header->data_offset % sizeof(double) != 0 ||
+        header->data_offset + (number_of_joints + 1) * header->number_of_samples * sizeof(double) > mapping_size_) {
+      std::cerr << path << " is not a binary joint log of " << number_of_joints << " joints" << std::endl;
+      return false;
+    }
+    // the log is streamed once from the start to the end
+    madvise(mapping, mapping_size_, MADV_SEQUENTIAL);
+    number_of_joints_ = number_of_joints;
+    count_ = header->number_of_samples;
+    time_ = reinterpret_cast<const double*>(static_cast<const char*>(mapping) + header->data_offset);
+    columns_ = time_ + count_;
+    return true;
+  }
+
+  bool writeBinary(const std::string& path) const {
+    JointLogHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kJointLogMagic, sizeof(header.magic));
+    header.version = JointLogHeader::kVersion;
+    header.number_of_joints = number_of_joints_;
+    header.number_of_samples = count_;
+    header.data_offset = sizeof(header);
+    std::ofstream output(path.c_str(), std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (count_ > 0) {
+      output.write(reinterpret_cast<const char*>(time_), count_ * sizeof(double));
+      output.write(reinterpret_cast<const char*>(columns_), number_of_joints_ * count_ * sizeof(double));
+    }
+    return static_cast<bool>(output);
+  }
+
+  std::size_t size() const { return count_; }
+  double time(std::size_t k) const { return time_[k]; }
+  double position(std::size_t k, int joint) const { return columns_[joint * count_ + k]; }
+
+ private:
+  JointLog(const JointLog&);
+  JointLog& operator=(const JointLog&);
+
+  int number_of_joints_;
+  std::size_t count_;
+  const double* time_;
+  const double* columns_;
+  std::vector<double> storage_;
+  void* mapping_;
+  std::size_t mapping_size_;
+};
+
+/**
+ * @brief Classifiers the log is replayed through and the per-sample results
+ */
+struct Replay {
+  int number_of_joints;
+  SingularityLimitTable table;
+  SingularityLimitTable hysteresis_table;
+  CoupledRegionIndex regions;
+  bool hysteresis;
+
+  /// level of every sample
+  std::vector<uint8_t> levels;
+  /// level of every sample against the bands widened by the hysteresis, if any
+  std::vector<uint8_t> released;
+  /// time [s] every joint spent at every level of its own, level after level
+  std::vector<double> joint_time;
+};
+
+/**
+ * @brief Classify the samples [begin, end) of the log
+ *
+ * @param joint_time  accumulator of (levels + 1) * joints times of this chunk
+ */
+void replayChunk(const JointLog& log, Replay& replay, std::size_t begin, std::size_t end, double* joint_time) {
+  const int n = replay.number_of_joints;
+  const std::size_t count = end - begin;
+  // the columns are transposed into waypoints, the layout the batch classifier reads
+  std::vector<double> waypoints(count * n);
+  for (int j=0; j<n; j++) {
+    for (std::size_t k=0; k<count; k++)
+      waypoints[k * n + j] = log.position(begin + k, j);
+  }
+  uint8_t* levels = &replay.levels[begin];
+  replay.table.classifyBatch(&waypoints[0], count, n, levels);
+  if (!replay.regions.empty()) {
+    for (std::size_t k=0; k<count; k++)
+      levels[k] = std::max<int>(levels[k], replay.regions.classify(&waypoints[k * n]));
+  }
+  if (replay.hysteresis) {
+    uint8_t* released = &replay.released[begin];
+    replay.hysteresis_table.classifyBatch(&waypoints[0], count, n, released);
+    if (!replay.regions.empty()) {
+      for (std::size_t k=0; k<count; k++)
+        released[k] = std::max<int>(released[k], replay.regions.classify(&waypoints[k * n]));
+    }
+  }
+  // every sample lasts until the next one
+  std::vector<uint8_t> joint_levels(n);
+  for (std::size_t k=0; k<count; k++) {
+    const std::size_t sample = begin + k;
+    const double duration = sample + 1 < log.size() ? std::max(log.time(sample + 1) - log.time(sample), 0.0) : 0.0;
+    replay.table.classifyJoints(&waypoints[k * n], &joint_levels[0]);
+    for (int j=0; j<n; j++)
+      joint_time[joint_levels[j] * n + j] += duration;
+  }
+}
+
+/**
+ * @brief Dwell statistics of one level of the published timeline
+ */
+struct DwellStatistics {
+  DwellStatistics() : time(0.0), entries(0), min(std::numeric_limits<double>::infinity()), max(0.0) {}
+
+  void add(double dwell) {
+    time += dwell;
+    entries++;
+    min = std::min(min, dwell);
+    max = std::max(max, dwell);
+  }
+
+  double time;
+  long entries;
+  double min;
+  double max;
+};
+
+bool parseInteger(const Arguments& arguments, const std::string& name, long fallback, long& value) {
+  Arguments::const_iterator argument = arguments.find(name);
+  if (argument == arguments.end()) {
+    value = fallback;
+    return true;
+  }
+  char* end;
+  value = std::strtol(argument->second.c_str(), &end, 10);
+  return !argument->second.empty() && *end == '\0';
+}
+
+bool parseList(const std::string& text, std::vector<double>& values) {
+  std::istringstream stream(text);
+  std::string item;
+  values.clear();
+  while (std::getline(stream, item, ',')) {
+    char* end;
+    values.push_back(std::strtod(item.c_str(), &end));
+    if (item.empty() || *end != '\0')
+      return false;
+  }
+  return !values.empty();
+}
+
+bool parseReal(const Arguments& arguments, const std::string& name, double fallback, double& value) {
+  Arguments::const_iterator argument = arguments.find(name);
+  if (argument == arguments.end()) {
+    value = fallback;
+    return true;
+  }
+  char* end;
+  value = std::strtod(argument->second.c_str(), &end);
+  return !argument->second.empty() && *end == '\0';
+}
+
+bool loadLog(const Arguments& arguments, int number_of_joints, JointLog& log) {
+  long time_column, position_column;
+  double time_scale;
+  if (!parseInteger(arguments, "time-column", 0, time_column) ||
+      !parseInteger(arguments, "position-column", 1, position_column) ||
+      !parseReal(arguments, "time-scale", 1.0, time_scale) || time_column < 0 || position_column < 0) {
+    std::cerr << "invalid --time-column, --position-column or --time-scale" << std::endl;
+    return false;
+  }
+  if (arguments.count("csv"))
+    return log.parseCsv(arguments.at("csv"), number_of_joints, time_column, position_column, time_scale);
+  if (arguments.count("binary"))
+    return log.mapBinary(arguments.at("binary"), number_of_joints);
+  std::cerr << "--csv or --binary is required" << std::endl;
+  return false;
+}
+
+bool loadClassifiers(const Arguments& arguments, Replay& replay) {
+  if (!arguments.count("bands")) {
+    std::cerr << "--bands is required" << std::endl;
+    return false;
+  }
+  std::string error;
+  std::ifstream bands_stream(arguments.at("bands").c_str());
+  const std::vector<double> bands((std::istream_iterator<double>(bands_stream)), std::istream_iterator<double>());
+  int number_of_levels;
+  if (!singularity_detector::checkBandTable(replay.number_of_joints, bands, number_of_levels, error) ||
+      !replay.table.build(replay.number_of_joints, number_of_levels, bands)) {
+    std::cerr << arguments.at("bands") << ": " << error << std::endl;
+    return false;
+  }
+  // the log is split into chunks already, one chunk is classified on one thread
+  replay.table.setParallelThreshold(std::numeric_limits<std::size_t>::max());
+
+  std::vector<CoupledRegionIndex::Region> region_list;
+  if (arguments.count("regions")) {
+    std::ifstream regions_stream(arguments.at("regions").c_str());
+    if (!regions_stream || !replay.regions.load(regions_stream, replay.number_of_joints, error)) {
+      std::cerr << arguments.at("regions") << ": " << error << std::endl;
+      return false;
+    }
+  } else {
+    replay.regions.build(replay.number_of_joints, region_list, error);
+  }
+
+  double hysteresis;
+  if (!parseReal(arguments, "hysteresis", 0.0, hysteresis) || hysteresis < 0.0) {
+    std::cerr << "invalid --hysteresis" << std::endl;
+    return false;
+  }
+  replay.hysteresis = hysteresis > 0.0;
+  replay.hysteresis_table = replay.table;
+  replay.hysteresis_table.widen(hysteresis);
+
+  // set after widening, which drops the periods
+  std::vector<double> periods;
+  if (arguments.count("periods") && !parseList(arguments.at("periods"), periods)) {
+    std::cerr << "invalid --periods" << std::endl;
+    return false;
+  }
+  if (!replay.table.setPeriods(periods, error) || !replay.hysteresis_table.setPeriods(periods, error)) {
+    std::cerr << "--periods: " << error << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int replayLog(const Arguments& arguments, const JointLog& log, Replay& replay) {
+  long chunk;
+  double min_dwell;
+  if (!parseInteger(arguments, "chunk", 65536, chunk) || chunk <= 0 ||
+      !parseReal(arguments, "min-dwell", 0.0, min_dwell) || min_dwell < 0.0) {
+    std::cerr << "invalid --chunk or --min-dwell" << std::endl;
+    return 2;
+  }
+  const int n = replay.number_of_joints;
+  const int number_of_levels = replay.table.number_of_levels();
+  const std::size_t count = log.size();
+  if (count == 0) {
+    std::cerr << "no samples in the log" << std::endl;
+    return 1;
+  }
+  const std::size_t chunks = (count + chunk - 1) / chunk;
+  replay.levels.assign(count, 0);
+  replay.released.assign(replay.hysteresis ? count : 0, 0);
+  std::vector<double> chunk_joint_time(chunks * (number_of_levels + 1) * n, 0.0);
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const std::size_t stride = (number_of_levels + 1) * n;
+#ifdef SINGULARITY_DETECTOR_WITH_TBB
+  tbb::parallel_for(tbb::blocked_range<std::size_t>(0, chunks, 1), [&](const tbb::blocked_range<std::size_t>& range) {
+    for (std::size_t c=range.begin(); c<range.end(); c++)
+      replayChunk(log, replay, c * chunk, std::min(count, (c + 1) * chunk), &chunk_joint_time[c * stride]);
+  });
+#else
+  for (std::size_t c=0; c<chunks; c++)
+    replayChunk(log, replay, c * chunk, std::min(count, (c + 1) * chunk), &chunk_joint_time[c * stride]);
+#endif
+  replay.joint_time.assign(stride, 0.0);
+  for (std::size_t c=0; c<chunks; c++) {
+    for (std::size_t i=0; i<stride; i++)
+      replay.joint_time[i] += chunk_joint_time[c * stride + i];
+  }
+
+  // the filter is sequential, but constant time per sample
+  LevelFilter filter;
+  filter.configure(min_dwell);
+  const bool filtering = replay.hysteresis || min_dwell > 0.0;
+  std::vector<DwellStatistics> statistics(number_of_levels + 1);
+  std::ofstream timeline;
+  if (arguments.count("timeline")) {
+    timeline.open(arguments.at("timeline").c_str(), std::ios::trunc);
+    timeline << std::setprecision(17) << "start,end,level\n";
+  }
+  int current = -1;
+  double since = log.time(0);
+  for (std::size_t k=0; k<count; k++) {
+    int level = replay.levels[k];
+    if (filtering)
+      level = filter.update(level, replay.hysteresis && level < filter.level() ? replay.released[k] : level,
+                            log.time(k));
+    if (level == current)
+      continue;
+    if (current >= 0) {
+      statistics[current].add(log.time(k) - since);
+      if (timeline.is_open())
+        timeline << since << ',' << log.time(k) << ',' << current << '\n';
+    }
+    current = level;
+    since = log.time(k);
+  }
+  statistics[current].add(log.time(count - 1) - since);
+  if (timeline.is_open())
+    timeline << since << ',' << log.time(count - 1) << ',' << current << '\n';
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  const double duration = log.time(count - 1) - log.time(0);
+  std::cout << count << " samples, " << duration << " s of log replayed in " << elapsed << " s ("
+            << count / elapsed * 1e-6 << " Msamples/s)" << std::endl;
+  std::cout << "level      time [s]  fraction   entries  min dwell  mean dwell   max dwell" << std::endl;
+  for (int l=0; l<=number_of_levels; l++) {
+    const DwellStatistics& s = statistics[l];
+    std::cout << std::setw(5) << l << std::setw(14) << s.time << std::setw(10)
+              << (duration > 0.0 ? s.time / duration : 0.0) << std::setw(10) << s.entries << std::setw(11)
+              << (s.entries ? s.min : 0.0) << std::setw(12) << (s.entries ? s.time / s.entries : 0.0)
+              << std::setw(12) << s.max << std::endl;
+  }
+  std::cout << "time [s] of every joint in the bands of every level" << std::endl << "joint";
+  for (int l=0; l<=number_of_levels; l++)
+    std::cout << std::setw(12) << l;
+  std::cout << std::endl;
+  for (int j=0; j<n; j++) {
+    std::cout << std::setw(5) << j;
+    for (int l=0; l<=number_of_levels; l++)
+      std::cout << std::setw(12) << replay.joint_time[l * n + j];
+    std::cout << std::endl;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Arguments arguments;
+  for (int i=1; i<argc; i++) {
+    if (std::strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) {
+      std::cerr << "unexpected argument " << argv[i] << std::endl;
+      return 2;
+    }
+    arguments[argv[i] + 2] = argv[i + 1];
+    i++;
+  }
+  long joints;
+  if (!arguments.count("joints") || !parseInteger(arguments, "joints", 0, joints) || joints <= 0) {
+    std::cerr << "--joints is required" << std::endl;
+    return 2;
+  }
+  JointLog log;
+  if (!loadLog(arguments, joints, log))
+    return 2;
+  if (arguments.count("convert")) {
+    if (!log.writeBinary(arguments.at("convert"))) {
+      std::cerr << "cannot write " << arguments.at("convert") << std::endl;
+      return 1;
+    }
+    std::cout << log.size() << " samples written" << std::endl;
+    return 0;
+  }
+  Replay replay;
+  replay.number_of_joints = joints;
+  if (!loadClassifiers(arguments, replay))
+    return 2;
+  return replayLog(arguments, log, replay);
+}